@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "mesh_cache.h"
+#include "asset_cache.h"
+
+namespace {
+	// absolute path with links and ./.. resolved, the path itself when the file does not exist
+	std::string canonicalPath(const std::string& path) {
+#ifdef _WIN32
+		char buffer[_MAX_PATH];
+		if (_fullpath(buffer, path.c_str(), _MAX_PATH) != nullptr) {
+			return buffer;
+		}
+#else
+		if (char* resolved = realpath(path.c_str(), nullptr)) {
+			std::string result = resolved;
+			free(resolved);
+			return result;
+		}
+#endif
+		return path;
+	}
+
+	std::string contentKey(uint64_t hash) {
+		char text[17];
+		std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+		return text;
+	}
+
+	size_t byteSize(const Model& model) {
+		return model.getByteSize();
+	}
+
+	size_t byteSize(const Texture2D& texture) {
+		return texture.getByteSize();
+	}
+}
+
+template <typename T>
+std::shared_ptr<T> AssetCache::find(Table<T>& table, const std::string& path, const std::string& variant,
+	const uint64_t* contentHash) {
+	const std::string pathKey = canonicalPath(path) + variant;
+	auto byPath = table.byPath.find(pathKey);
+	if (byPath != table.byPath.end()) {
+		if (std::shared_ptr<T> asset = byPath->second.asset.lock()) {
+			++_stats.hits;
+			_stats.bytesSaved += byPath->second.bytes;
+			return asset;
+		}
+	}
+
+	if (contentHash != nullptr) {
+		auto byContent = table.byContent.find(contentKey(*contentHash) + variant);
+		if (byContent != table.byContent.end()) {
+			if (std::shared_ptr<T> asset = byContent->second.asset.lock()) {
+				++_stats.hits;
+				_stats.bytesSaved += byContent->second.bytes;
+				table.byPath[pathKey] = byContent->second;
+				return asset;
+			}
+		}
+	}
+	return nullptr;
+}
+
+template <typename T>
+void AssetCache::add(Table<T>& table, const std::string& path, const std::string& variant,
+	const std::shared_ptr<T>& asset, const uint64_t* contentHash) {
+	++_stats.misses;
+	Entry<T> entry;
+	entry.asset = asset;
+	entry.bytes = byteSize(*asset);
+	table.byPath[canonicalPath(path) + variant] = entry;
+	if (contentHash != nullptr) {
+		table.byContent[contentKey(*contentHash) + variant] = entry;
+	}
+}
+
+template <typename T, typename Load>
+std::shared_ptr<T> AssetCache::get(Table<T>& table, const std::string& path, const std::string& variant, Load load) {
+	if (std::shared_ptr<T> asset = find(table, path, variant, nullptr)) {
+		return asset;
+	}
+
+	// generated assets have no file and are only matched by name
+	uint64_t hash;
+	const bool hashed = MeshCache::getSourceHash(path, &hash);
+	if (hashed) {
+		if (std::shared_ptr<T> asset = find(table, path, variant, &hash)) {
+			return asset;
+		}
+	}
+
+	std::shared_ptr<T> asset = load();
+	add(table, path, variant, asset, hashed ? &hash : nullptr);
+	return asset;
+}
+
+std::string getModelVariant(const ModelOptions& options) {
+	// differently processed versions of a mesh are different assets
+	std::string variant = "|";
+	variant += options.optimizeMesh ? 'o' : '-';
+	variant += options.packVertices ? 'p' : '-';
+	variant += options.generateLods ? 'l' : '-';
+	variant += options.buildClusters ? 'c' : '-';
+	return variant;
+}
+
+std::shared_ptr<Model> AssetCache::getModel(const std::string& path, const ModelOptions& options) {
+	return get(_models, path, getModelVariant(options), [&]() { return std::make_shared<Model>(path, options); });
+}
+
+std::shared_ptr<Texture2D> AssetCache::getTexture(const std::string& path) {
+	return get(_textures, path, "", [&]() { return std::make_shared<Texture2D>(path); });
+}
+
+std::shared_ptr<Model> AssetCache::findModel(const std::string& path, const ModelOptions& options,
+	const uint64_t* contentHash) {
+	return find(_models, path, getModelVariant(options), contentHash);
+}
+
+void AssetCache::addModel(const std::string& path, const ModelOptions& options, const std::shared_ptr<Model>& model,
+	const uint64_t* contentHash) {
+	add(_models, path, getModelVariant(options), model, contentHash);
+}
+
+std::shared_ptr<Texture2D> AssetCache::findTexture(const std::string& path, const uint64_t* contentHash) {
+	return find(_textures, path, "", contentHash);
+}
+
+void AssetCache::addTexture(const std::string& path, const std::shared_ptr<Texture2D>& texture,
+	const uint64_t* contentHash) {
+	add(_textures, path, "", texture, contentHash);
+}
+
+const AssetCacheStats& AssetCache::getStats() const {
+	return _stats;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "model.h"
+#include "texture.h"
+
+// counters of an asset cache
+struct AssetCacheStats {
+	size_t hits = 0;
+	size_t misses = 0;
+	// memory the hits would have taken as separate copies
+	size_t bytesSaved = 0;
+};
+
+// suffix that tells differently processed versions of a mesh apart in cache keys
+std::string getModelVariant(const ModelOptions& options);
+
+// hands out one shared instance per asset, so repeated props are decoded and uploaded once; requests match by
+// canonical path first and by file content next, which also catches copies of a file under another name;
+// the cache only holds weak references, an asset is freed with its last user and loaded again by the next request
+class AssetCache {
+public:
+	std::shared_ptr<Model> getModel(const std::string& path, const ModelOptions& options = ModelOptions());
+
+	std::shared_ptr<Texture2D> getTexture(const std::string& path);
+
+	// for loads done elsewhere, e.g. on a loader thread: find matches by path and, given the content hash of the
+	// file, by content, without reading the file; add registers a finished load
+	std::shared_ptr<Model> findModel(const std::string& path, const ModelOptions& options,
+		const uint64_t* contentHash = nullptr);
+
+	void addModel(const std::string& path, const ModelOptions& options, const std::shared_ptr<Model>& model,
+		const uint64_t* contentHash);
+
+	std::shared_ptr<Texture2D> findTexture(const std::string& path, const uint64_t* contentHash = nullptr);
+
+	void addTexture(const std::string& path, const std::shared_ptr<Texture2D>& texture, const uint64_t* contentHash);
+
+	const AssetCacheStats& getStats() const;
+
+private:
+	template <typename T>
+	struct Entry {
+		std::weak_ptr<T> asset;
+		size_t bytes = 0;
+	};
+
+	template <typename T>
+	struct Table {
+		std::unordered_map<std::string, Entry<T>> byPath;
+		std::unordered_map<std::string, Entry<T>> byContent;
+	};
+
+	Table<Model> _models;
+
+	Table<Texture2D> _textures;
+
+	AssetCacheStats _stats;
+
+	template <typename T>
+	std::shared_ptr<T> find(Table<T>& table, const std::string& path, const std::string& variant,
+		const uint64_t* contentHash);
+
+	template <typename T>
+	void add(Table<T>& table, const std::string& path, const std::string& variant, const std::shared_ptr<T>& asset,
+		const uint64_t* contentHash);
+
+	template <typename T, typename Load>
+	std::shared_ptr<T> get(Table<T>& table, const std::string& path, const std::string& variant, Load load);
+};
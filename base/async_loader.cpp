@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "mesh_cache.h"
+#include "async_loader.h"
+
+AsyncLoader::AsyncLoader(AssetCache* assets, unsigned threadCount) : _assets(assets) {
+	if (threadCount == 0) {
+		threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	for (unsigned i = 0; i < threadCount; ++i) {
+		_workers.emplace_back(&AsyncLoader::work, this);
+	}
+}
+
+AsyncLoader::~AsyncLoader() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_condition.notify_all();
+	for (std::thread& worker : _workers) {
+		worker.join();
+	}
+}
+
+void AsyncLoader::loadModel(const std::string& path, const ModelOptions& options, ModelCallback onReady) {
+	const std::string key = "model:" + path + getModelVariant(options);
+	auto pending = _jobs.find(key);
+	if (pending != _jobs.end()) {
+		pending->second->modelCallbacks.push_back(std::move(onReady));
+		return;
+	}
+
+	// matching by path never touches the file, content matches are checked once the worker has hashed it
+	if (_assets) {
+		if (std::shared_ptr<Model> model = _assets->findModel(path, options)) {
+			onReady(model);
+			return;
+		}
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->key = key;
+	job->path = path;
+	job->options = options;
+	job->isModel = true;
+	job->modelCallbacks.push_back(std::move(onReady));
+	enqueue(job);
+}
+
+void AsyncLoader::loadTexture(const std::string& path, TextureCallback onReady) {
+	const std::string key = "texture:" + path;
+	auto pending = _jobs.find(key);
+	if (pending != _jobs.end()) {
+		pending->second->textureCallbacks.push_back(std::move(onReady));
+		return;
+	}
+
+	if (_assets) {
+		if (std::shared_ptr<Texture2D> texture = _assets->findTexture(path)) {
+			onReady(texture);
+			return;
+		}
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->key = key;
+	job->path = path;
+	job->textureCallbacks.push_back(std::move(onReady));
+	enqueue(job);
+}
+
+void AsyncLoader::update(double budgetMs) {
+	const auto start = std::chrono::steady_clock::now();
+	auto elapsedMs = [&]() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	do {
+		if (_uploading == nullptr) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_finished.empty()) {
+				break;
+			}
+			_uploading = _finished.front();
+			_finished.pop_front();
+		}
+
+		Job& job = *_uploading;
+		bool ready = false;
+		if (job.error.empty()) {
+			try {
+				ready = upload(job);
+			} catch (const std::exception& e) {
+				job.error = e.what();
+			}
+		}
+
+		if (!job.error.empty()) {
+			std::cerr << job.error << std::endl;
+			++_stats.failed;
+			_jobs.erase(job.key);
+			_uploading.reset();
+		} else if (ready) {
+			finish(job);
+			_jobs.erase(job.key);
+			_uploading.reset();
+		}
+	} while (elapsedMs() < budgetMs);
+
+	_stats.maxUpdateMs = std::max(_stats.maxUpdateMs, elapsedMs());
+}
+
+size_t AsyncLoader::getPendingCount() const {
+	return _jobs.size();
+}
+
+const AsyncLoaderStats& AsyncLoader::getStats() const {
+	return _stats;
+}
+
+void AsyncLoader::enqueue(const std::shared_ptr<Job>& job) {
+	_jobs[job->key] = job;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queued.push_back(job);
+	}
+	_condition.notify_one();
+}
+
+void AsyncLoader::work() {
+	for (;;) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this]() { return _stop || !_queued.empty(); });
+			if (_stop) {
+				return;
+			}
+			job = _queued.front();
+			_queued.pop_front();
+		}
+
+		try {
+			job->hashed = MeshCache::getSourceHash(job->path, &job->hash);
+			if (job->isModel) {
+				ModelOptions options = job->options;
+				options.deferUpload = true;
+				job->model = std::make_shared<Model>(job->path, options);
+			} else {
+				job->image = std::make_shared<const TextureImage>(job->path);
+			}
+		} catch (const std::exception& e) {
+			job->error = e.what();
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_finished.push_back(job);
+	}
+}
+
+bool AsyncLoader::upload(Job& job) {
+	// a copy of the file under another name may have been loaded meanwhile, then this load is dropped
+	const uint64_t* hash = job.hashed ? &job.hash : nullptr;
+	if (!job.cacheChecked) {
+		job.cacheChecked = true;
+		if (_assets && job.isModel) {
+			if (std::shared_ptr<Model> model = _assets->findModel(job.path, job.options, hash)) {
+				job.model = model;
+				return true;
+			}
+		} else if (_assets) {
+			if (std::shared_ptr<Texture2D> texture = _assets->findTexture(job.path, hash)) {
+				job.texture = texture;
+				return true;
+			}
+		}
+	}
+
+	if (job.isModel) {
+		if (!job.model->upload(kUploadChunk)) {
+			return false;
+		}
+		if (_assets) {
+			_assets->addModel(job.path, job.options, job.model, hash);
+		}
+		return true;
+	}
+
+	if (job.texture == nullptr) {
+		job.texture = std::make_shared<Texture2D>(job.image);
+	}
+	if (!job.texture->upload(kUploadChunk)) {
+		return false;
+	}
+	job.image.reset();
+	if (_assets) {
+		_assets->addTexture(job.path, job.texture, hash);
+	}
+	return true;
+}
+
+void AsyncLoader::finish(Job& job) {
+	if (job.isModel) {
+		++_stats.modelsLoaded;
+		for (ModelCallback& callback : job.modelCallbacks) {
+			callback(job.model);
+		}
+	} else {
+		++_stats.texturesLoaded;
+		for (TextureCallback& callback : job.textureCallbacks) {
+			callback(job.texture);
+		}
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "asset_cache.h"
+#include "model.h"
+#include "texture.h"
+
+// counters of an async loader
+struct AsyncLoaderStats {
+	size_t modelsLoaded = 0;
+	size_t texturesLoaded = 0;
+	size_t failed = 0;
+	// longest time one update() took, in milliseconds
+	double maxUpdateMs = 0.0;
+};
+
+// loads models and textures in the background: file reading, obj parsing, mesh processing and image decoding run
+// on worker threads, the gl thread transfers the results in update() within a time budget and hands them out
+// through callbacks; requests and callbacks belong to the gl thread, requests for one asset share one load
+class AsyncLoader {
+public:
+	using ModelCallback = std::function<void(std::shared_ptr<Model>)>;
+
+	using TextureCallback = std::function<void(std::shared_ptr<Texture2D>)>;
+
+	// finished loads are shared through assets when given; threadCount 0 leaves one hardware thread to the gl thread
+	explicit AsyncLoader(AssetCache* assets = nullptr, unsigned threadCount = 0);
+
+	// waits for the loads in progress, the others are dropped without calling back
+	~AsyncLoader();
+
+	AsyncLoader(const AsyncLoader&) = delete;
+
+	AsyncLoader& operator=(const AsyncLoader&) = delete;
+
+	// onReady runs in a later update(), or right away when the cache holds the asset; failed loads never call back
+	void loadModel(const std::string& path, const ModelOptions& options, ModelCallback onReady);
+
+	void loadTexture(const std::string& path, TextureCallback onReady);
+
+	// transfer finished loads to the gpu until budgetMs has passed, at least one piece per call
+	void update(double budgetMs);
+
+	// requested loads not handed out yet
+	size_t getPendingCount() const;
+
+	const AsyncLoaderStats& getStats() const;
+
+private:
+	// bytes transferred between two checks of the time budget
+	static const size_t kUploadChunk = 256 * 1024;
+
+	struct Job {
+		std::string key;
+		std::string path;
+		ModelOptions options;
+		bool isModel = false;
+
+		// filled by the worker
+		std::shared_ptr<Model> model;
+		std::shared_ptr<const TextureImage> image;
+		bool hashed = false;
+		uint64_t hash = 0;
+		std::string error;
+
+		// gl thread only
+		std::shared_ptr<Texture2D> texture;
+		bool cacheChecked = false;
+		std::vector<ModelCallback> modelCallbacks;
+		std::vector<TextureCallback> textureCallbacks;
+	};
+
+	AssetCache* _assets;
+
+	// requested loads by asset key, gl thread only
+	std::unordered_map<std::string, std::shared_ptr<Job>> _jobs;
+
+	// finished load being transferred, possibly over several updates
+	std::shared_ptr<Job> _uploading;
+
+	AsyncLoaderStats _stats;
+
+	// the queues and the stop flag are shared with the workers and guarded by _mutex
+	std::deque<std::shared_ptr<Job>> _queued;
+
+	std::deque<std::shared_ptr<Job>> _finished;
+
+	bool _stop = false;
+
+	mutable std::mutex _mutex;
+
+	std::condition_variable _condition;
+
+	std::vector<std::thread> _workers;
+
+	void enqueue(const std::shared_ptr<Job>& job);
+
+	void work();
+
+	// transfer a piece of the job, true once it is ready to hand out
+	bool upload(Job& job);
+
+	void finish(Job& job);
+};
@@ -1,9 +1,14 @@
+#include "frustum_culler.h"
 #include "camera.h"
 
 glm::mat4 Camera::getViewMatrix() const {
 	return glm::lookAt(position, position + getFront(), getUp());
 }
 
+void Camera::getFrustumPlanes(glm::vec4 planes[6]) const {
+	extractFrustumPlanes(getProjectionMatrix() * getViewMatrix(), planes);
+}
+
 
 PerspectiveCamera::PerspectiveCamera(float fovy, float aspect, float znear, float zfar)
 	: fovy(fovy), aspect(aspect), znear(znear), zfar(zfar) { }
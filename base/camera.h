@@ -7,6 +7,9 @@ public:
 	glm::mat4 getViewMatrix() const;
 
 	virtual glm::mat4 getProjectionMatrix() const = 0;
+
+	// world space planes of the view volume with inward normals, see extractFrustumPlanes
+	void getFrustumPlanes(glm::vec4 planes[6]) const;
 };
 
 
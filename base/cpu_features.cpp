@@ -0,0 +1,61 @@
+#include "cpu_features.h"
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(CPU_X86)
+#include <cpuid.h>
+#endif
+
+#ifdef CPU_X86
+namespace {
+	// eax, ebx, ecx, edx of cpuid for the leaf and subleaf
+	void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+		for (int i = 0; i < 4; ++i) {
+			regs[i] = static_cast<unsigned int>(info[i]);
+		}
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	// the register states the os saves on a context switch
+	unsigned long long xgetbv() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+	}
+}
+#endif
+
+CpuFeatures detectCpuFeatures() {
+	CpuFeatures features;
+#ifdef CPU_X86
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	const unsigned int maxLeaf = regs[0];
+	if (maxLeaf < 1) {
+		return features;
+	}
+
+	cpuid(1, 0, regs);
+	features.sse41 = (regs[2] & (1u << 19)) != 0;
+
+	// avx needs the cpu bit and the os saving the xmm and ymm state, which it reports through xgetbv
+	const bool osxsave = (regs[2] & (1u << 27)) != 0;
+	const bool avx = (regs[2] & (1u << 28)) != 0;
+	features.avx = osxsave && avx && (xgetbv() & 0x6) == 0x6;
+
+	if (features.avx && maxLeaf >= 7) {
+		cpuid(7, 0, regs);
+		features.avx2 = (regs[1] & (1u << 5)) != 0;
+	}
+#endif
+	return features;
+}
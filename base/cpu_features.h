@@ -0,0 +1,30 @@
+#pragma once
+
+// x86 and x86-64 targets, where the simd paths are compiled in
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#endif
+
+// a function compiled for a wider instruction set than the rest of the build, which keeps the baseline;
+// it may only be called after checking the cpu has that set. msvc compiles any intrinsic without /arch
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_TARGET(isa)
+#endif
+
+// instruction sets of the cpu the program runs on, avx also needs the os to save the ymm registers
+struct CpuFeatures {
+	bool sse41 = false;
+	bool avx = false;
+	bool avx2 = false;
+};
+
+// asks the cpu with cpuid, all false on other architectures
+CpuFeatures detectCpuFeatures();
+
+// detected once, on first use
+inline const CpuFeatures& getCpuFeatures() {
+	static const CpuFeatures features = detectCpuFeatures();
+	return features;
+}
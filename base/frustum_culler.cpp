@@ -0,0 +1,200 @@
+#include <cmath>
+
+#include "frustum_culler.h"
+
+#include "cpu_features.h"
+
+// the plane test is compiled for avx and sse2 on x86, avx is used when the cpu has it while the rest of the
+// build keeps the baseline; sse2 is part of every x86-64 target
+#if defined(CPU_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FRUSTUM_CULLER_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+	// the boxes are the separate x, y and z arrays of the culler, size is a multiple of 8
+	struct BoxArrays {
+		const float* centerX;
+		const float* centerY;
+		const float* centerZ;
+		const float* extentX;
+		const float* extentY;
+		const float* extentZ;
+		size_t size;
+	};
+
+#ifdef FRUSTUM_CULLER_SIMD
+	CPU_TARGET("avx")
+	void cullAvx(const BoxArrays& boxes, const glm::vec4 planes[6], uint8_t* visible) {
+		for (size_t i = 0; i < boxes.size; i += 8) {
+			const __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+			const __m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+			const __m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+			const __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+			const __m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+			const __m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+			__m256 outside = _mm256_setzero_ps();
+			for (int p = 0; p < 6; ++p) {
+				const glm::vec4& plane = planes[p];
+				__m256 distance = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)),
+					_mm256_mul_ps(cy, _mm256_set1_ps(plane.y)));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(cz, _mm256_set1_ps(plane.z)));
+				distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+				__m256 reach = _mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::abs(plane.x))),
+					_mm256_mul_ps(ey, _mm256_set1_ps(std::abs(plane.y))));
+				reach = _mm256_add_ps(reach, _mm256_mul_ps(ez, _mm256_set1_ps(std::abs(plane.z))));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+
+			const int mask = _mm256_movemask_ps(outside);
+			for (int lane = 0; lane < 8; ++lane) {
+				visible[i + lane] = ((mask >> lane) & 1) == 0;
+			}
+		}
+	}
+
+	void cullSse(const BoxArrays& boxes, const glm::vec4 planes[6], uint8_t* visible) {
+		for (size_t i = 0; i < boxes.size; i += 4) {
+			const __m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+			const __m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+			const __m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+			const __m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+			const __m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+			const __m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; ++p) {
+				const glm::vec4& plane = planes[p];
+				__m128 distance = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y)));
+				distance = _mm_add_ps(distance, _mm_mul_ps(cz, _mm_set1_ps(plane.z)));
+				distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+				__m128 reach = _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))),
+					_mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y))));
+				reach = _mm_add_ps(reach, _mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+			}
+
+			const int mask = _mm_movemask_ps(outside);
+			for (int lane = 0; lane < 4; ++lane) {
+				visible[i + lane] = ((mask >> lane) & 1) == 0;
+			}
+		}
+	}
+#else
+	void cullScalar(const BoxArrays& boxes, const glm::vec4 planes[6], uint8_t* visible) {
+		for (size_t i = 0; i < boxes.size; ++i) {
+			bool outside = false;
+			for (int p = 0; p < 6 && !outside; ++p) {
+				const glm::vec4& plane = planes[p];
+				const float distance = boxes.centerX[i] * plane.x + boxes.centerY[i] * plane.y +
+					boxes.centerZ[i] * plane.z + plane.w;
+				const float reach = boxes.extentX[i] * std::abs(plane.x) + boxes.extentY[i] * std::abs(plane.y) +
+					boxes.extentZ[i] * std::abs(plane.z);
+				outside = distance + reach < 0.0f;
+			}
+			visible[i] = !outside;
+		}
+	}
+#endif
+}
+
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]) {
+	const glm::vec4 row0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+	const glm::vec4 row1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+	const glm::vec4 row2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+	const glm::vec4 row3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+
+	planes[0] = row3 + row0;
+	planes[1] = row3 - row0;
+	planes[2] = row3 + row1;
+	planes[3] = row3 - row1;
+	planes[4] = row3 + row2;
+	planes[5] = row3 - row2;
+	for (int i = 0; i < 6; ++i) {
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+void transformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	glm::vec3* center, glm::vec3* extent) {
+	// the extent along each world axis is the sum of the absolute projections of the box axes
+	const glm::vec3 localCenter = 0.5f * (boundsMin + boundsMax);
+	const glm::vec3 localExtent = 0.5f * (boundsMax - boundsMin);
+	*center = glm::vec3(transform * glm::vec4(localCenter, 1.0f));
+	const glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])),
+		glm::abs(glm::vec3(transform[2])));
+	*extent = absolute * localExtent;
+}
+
+void FrustumCuller::clear() {
+	_centerX.clear();
+	_centerY.clear();
+	_centerZ.clear();
+	_extentX.clear();
+	_extentY.clear();
+	_extentZ.clear();
+	_count = 0;
+	_visibleCount = 0;
+}
+
+size_t FrustumCuller::add(const glm::vec3& center, const glm::vec3& extent) {
+	if (_count == _centerX.size()) {
+		const size_t size = _count + kPadding;
+		_centerX.resize(size, 0.0f);
+		_centerY.resize(size, 0.0f);
+		_centerZ.resize(size, 0.0f);
+		_extentX.resize(size, 0.0f);
+		_extentY.resize(size, 0.0f);
+		_extentZ.resize(size, 0.0f);
+	}
+
+	_centerX[_count] = center.x;
+	_centerY[_count] = center.y;
+	_centerZ[_count] = center.z;
+	_extentX[_count] = extent.x;
+	_extentY[_count] = extent.y;
+	_extentZ[_count] = extent.z;
+	return _count++;
+}
+
+size_t FrustumCuller::add(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+	glm::vec3 center, extent;
+	transformBounds(transform, boundsMin, boundsMax, &center, &extent);
+	return add(center, extent);
+}
+
+void FrustumCuller::cull(const glm::vec4 planes[6]) {
+	// a box is outside a plane when its center is farther behind it than the box reaches along the normal
+	const size_t size = _centerX.size();
+	_visible.assign(size, 0);
+
+	const BoxArrays boxes = { _centerX.data(), _centerY.data(), _centerZ.data(),
+		_extentX.data(), _extentY.data(), _extentZ.data(), size };
+#ifdef FRUSTUM_CULLER_SIMD
+	if (getCpuFeatures().avx) {
+		cullAvx(boxes, planes, _visible.data());
+	} else {
+		cullSse(boxes, planes, _visible.data());
+	}
+#else
+	cullScalar(boxes, planes, _visible.data());
+#endif
+
+	_visibleCount = 0;
+	for (size_t i = 0; i < _count; ++i) {
+		_visibleCount += _visible[i];
+	}
+}
+
+bool FrustumCuller::isVisible(size_t index) const {
+	return index < _visible.size() && _visible[index] != 0;
+}
+
+size_t FrustumCuller::getCount() const {
+	return _count;
+}
+
+size_t FrustumCuller::getVisibleCount() const {
+	return _visibleCount;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// frustum planes (a, b, c, d) with inward normals of a clip space transform, normalized so that
+// a point's signed distance is dot(plane.xyz, p) + plane.w in the space the transform starts from
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]);
+
+// axis aligned box around the image of the box [boundsMin, boundsMax] under transform, as center and half extent
+void transformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+	glm::vec3* center, glm::vec3* extent);
+
+// world space boxes culled against a frustum several at a time: the centers and extents are kept as
+// separate x, y and z arrays, so one plane test covers 8 boxes with avx, 4 with sse2 and 1 otherwise
+class FrustumCuller {
+public:
+	void clear();
+
+	// index of the new box, for isVisible()
+	size_t add(const glm::vec3& center, const glm::vec3& extent);
+
+	size_t add(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	// a box is culled when it lies completely outside one of the planes
+	void cull(const glm::vec4 planes[6]);
+
+	// result of the last cull
+	bool isVisible(size_t index) const;
+
+	size_t getCount() const;
+
+	size_t getVisibleCount() const;
+
+private:
+	// the arrays are padded to a multiple of 8 boxes with empty boxes at the origin
+	static const size_t kPadding = 8;
+
+	std::vector<float> _centerX, _centerY, _centerZ;
+
+	std::vector<float> _extentX, _extentY, _extentZ;
+
+	std::vector<uint8_t> _visible;
+
+	size_t _count = 0;
+
+	size_t _visibleCount = 0;
+};
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#include "geometry_arena.h"
+#include "gl_state.h"
+
+size_t getVertexSize(VertexFormat format) {
+	return format == VertexFormat::Float ? sizeof(Vertex) : sizeof(PackedVertex);
+}
+
+void setVertexFormat(VertexFormat format) {
+	// specify layout, size of a vertex, data type, normalize, sizeof vertex array, offset of the attribute
+	if (format == VertexFormat::Float) {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+		glEnableVertexAttribArray(2);
+		return;
+	}
+
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+	glEnableVertexAttribArray(1);
+	if (format == VertexFormat::PackedUnorm) {
+		glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoord));
+	} else {
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoord));
+	}
+	glEnableVertexAttribArray(2);
+}
+
+GeometryArena::GeometryArena(size_t vertexBytes, size_t indexBytes)
+	: _initialVertexBytes(vertexBytes), _initialIndexBytes(indexBytes) {
+	for (size_t i = 0; i < static_cast<size_t>(VertexFormat::Count); ++i) {
+		_vertexPools[i].elementSize = getVertexSize(static_cast<VertexFormat>(i));
+	}
+	_indexPool.elementSize = sizeof(uint16_t);
+}
+
+GeometryArena::~GeometryArena() {
+	for (size_t i = 0; i < static_cast<size_t>(VertexFormat::Count); ++i) {
+		if (_vertexArrays[i] != 0) {
+			GLStateCache::instance().forgetVertexArray(_vertexArrays[i]);
+			glDeleteVertexArrays(1, &_vertexArrays[i]);
+		}
+		if (_vertexPools[i].buffer != 0) {
+			glDeleteBuffers(1, &_vertexPools[i].buffer);
+		}
+	}
+
+	if (_indexPool.buffer != 0) {
+		glDeleteBuffers(1, &_indexPool.buffer);
+	}
+}
+
+size_t GeometryArena::allocateVertices(VertexFormat format, size_t count) {
+	Pool& pool = _vertexPools[static_cast<size_t>(format)];
+	GLuint buffer = pool.buffer;
+	size_t first = allocate(pool, count, _initialVertexBytes);
+	if (pool.buffer != buffer) {
+		attachBuffers(format);
+	}
+	return first;
+}
+
+void GeometryArena::freeVertices(VertexFormat format, size_t first, size_t count) {
+	release(_vertexPools[static_cast<size_t>(format)], first, count);
+}
+
+size_t GeometryArena::allocateIndices(size_t count) {
+	GLuint buffer = _indexPool.buffer;
+	size_t first = allocate(_indexPool, count, _initialIndexBytes);
+	if (_indexPool.buffer != buffer) {
+		for (size_t i = 0; i < static_cast<size_t>(VertexFormat::Count); ++i) {
+			if (_vertexArrays[i] != 0) {
+				attachBuffers(static_cast<VertexFormat>(i));
+			}
+		}
+	}
+	return first;
+}
+
+void GeometryArena::freeIndices(size_t first, size_t count) {
+	release(_indexPool, first, count);
+}
+
+void GeometryArena::writeVertices(VertexFormat format, size_t offset, size_t size, const void* data) {
+	// written through the copy target, which no vertex array state depends on
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _vertexPools[static_cast<size_t>(format)].buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryArena::writeIndices(size_t offset, size_t size, const void* data) {
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _indexPool.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GLuint GeometryArena::getVertexArray(VertexFormat format) const {
+	return _vertexArrays[static_cast<size_t>(format)];
+}
+
+GeometryArenaStats GeometryArena::getStats() const {
+	GeometryArenaStats stats;
+	for (const Pool& pool : _vertexPools) {
+		stats.vertexBytes += pool.capacity * pool.elementSize;
+		stats.vertexBytesUsed += pool.used * pool.elementSize;
+	}
+	stats.indexBytes = _indexPool.capacity * _indexPool.elementSize;
+	stats.indexBytesUsed = _indexPool.used * _indexPool.elementSize;
+	stats.allocations = _allocations;
+	stats.grows = _grows;
+	return stats;
+}
+
+size_t GeometryArena::allocate(Pool& pool, size_t count, size_t initialBytes) {
+	if (count == 0) {
+		return 0;
+	}
+
+	// first fit, the free ranges are few as neighbours are always merged
+	auto range = pool.freeRanges.begin();
+	while (range != pool.freeRanges.end() && range->second < count) {
+		++range;
+	}
+	if (range == pool.freeRanges.end()) {
+		grow(pool, count, initialBytes);
+		range = std::prev(pool.freeRanges.end());
+	}
+
+	size_t first = range->first;
+	size_t remaining = range->second - count;
+	pool.freeRanges.erase(range);
+	if (remaining > 0) {
+		pool.freeRanges[first + count] = remaining;
+	}
+
+	pool.used += count;
+	++_allocations;
+	return first;
+}
+
+void GeometryArena::release(Pool& pool, size_t first, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	auto range = pool.freeRanges.emplace(first, count).first;
+	auto next = std::next(range);
+	if (next != pool.freeRanges.end() && range->first + range->second == next->first) {
+		range->second += next->second;
+		pool.freeRanges.erase(next);
+	}
+	if (range != pool.freeRanges.begin()) {
+		auto previous = std::prev(range);
+		if (previous->first + previous->second == range->first) {
+			previous->second += range->second;
+			pool.freeRanges.erase(range);
+		}
+	}
+
+	pool.used -= count;
+	--_allocations;
+}
+
+void GeometryArena::grow(Pool& pool, size_t count, size_t initialBytes) {
+	// the free range at the end, if any, is extended, so the grown buffer holds count after it
+	size_t freeAtEnd = 0;
+	if (!pool.freeRanges.empty()) {
+		auto last = std::prev(pool.freeRanges.end());
+		if (last->first + last->second == pool.capacity) {
+			freeAtEnd = last->second;
+		}
+	}
+
+	size_t capacity = std::max(pool.capacity * 2, initialBytes / pool.elementSize);
+	capacity = std::max(capacity, pool.capacity - freeAtEnd + count);
+
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * pool.elementSize, nullptr, GL_STATIC_DRAW);
+	if (pool.buffer != 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.capacity * pool.elementSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &pool.buffer);
+		++_grows;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (freeAtEnd > 0) {
+		std::prev(pool.freeRanges.end())->second += capacity - pool.capacity;
+	} else {
+		pool.freeRanges[pool.capacity] = capacity - pool.capacity;
+	}
+	pool.buffer = buffer;
+	pool.capacity = capacity;
+}
+
+void GeometryArena::attachBuffers(VertexFormat format) {
+	GLuint& vertexArray = _vertexArrays[static_cast<size_t>(format)];
+	if (vertexArray == 0) {
+		glGenVertexArrays(1, &vertexArray);
+	}
+
+	GLStateCache::instance().bindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, _vertexPools[static_cast<size_t>(format)].buffer);
+	setVertexFormat(format);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexPool.buffer);
+	GLStateCache::instance().bindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+#include <glad/glad.h>
+
+#include "vertex.h"
+
+// vertex layouts of the models, attributes 0/1/2 are position, normal and texcoord
+enum class VertexFormat {
+	// Vertex
+	Float,
+	// PackedVertex with unorm16 texcoords
+	PackedUnorm,
+	// PackedVertex with half float texcoords
+	PackedHalf,
+	Count
+};
+
+size_t getVertexSize(VertexFormat format);
+
+// point attributes 0/1/2 of the bound vertex array at vertices of format in the bound array buffer
+void setVertexFormat(VertexFormat format);
+
+// memory of a geometry arena in bytes
+struct GeometryArenaStats {
+	size_t vertexBytes = 0;
+	size_t vertexBytesUsed = 0;
+	size_t indexBytes = 0;
+	size_t indexBytesUsed = 0;
+	size_t allocations = 0;
+	// times a buffer was reallocated to a larger size
+	size_t grows = 0;
+};
+
+// large shared buffers the models suballocate their vertices and 16-bit indices from: one vertex buffer and one
+// vertex array per format and one element buffer for all of them, so models of the same format draw with the
+// same vertex array through base vertex and index offsets; freed ranges are merged with their neighbours and
+// reused by later allocations, a buffer without a fitting free range is reallocated at twice its size
+class GeometryArena {
+public:
+	// initial sizes in bytes, the buffers are only created by the first allocation
+	explicit GeometryArena(size_t vertexBytes = 4 * 1024 * 1024, size_t indexBytes = 2 * 1024 * 1024);
+
+	~GeometryArena();
+
+	GeometryArena(const GeometryArena&) = delete;
+
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	// first vertex of count consecutive vertices of format
+	size_t allocateVertices(VertexFormat format, size_t count);
+
+	void freeVertices(VertexFormat format, size_t first, size_t count);
+
+	// first index of count consecutive 16-bit indices
+	size_t allocateIndices(size_t count);
+
+	void freeIndices(size_t first, size_t count);
+
+	// offsets are in bytes from the start of the buffer
+	void writeVertices(VertexFormat format, size_t offset, size_t size, const void* data);
+
+	void writeIndices(size_t offset, size_t size, const void* data);
+
+	// vertex array drawing vertices of format with the shared element buffer
+	GLuint getVertexArray(VertexFormat format) const;
+
+	GeometryArenaStats getStats() const;
+
+private:
+	struct Pool {
+		GLuint buffer = 0;
+		size_t elementSize = 0;
+		// in elements
+		size_t capacity = 0;
+		size_t used = 0;
+		// free ranges by first element, with their element count
+		std::map<size_t, size_t> freeRanges;
+	};
+
+	Pool _vertexPools[static_cast<size_t>(VertexFormat::Count)];
+
+	Pool _indexPool;
+
+	GLuint _vertexArrays[static_cast<size_t>(VertexFormat::Count)] = {};
+
+	size_t _initialVertexBytes;
+
+	size_t _initialIndexBytes;
+
+	size_t _allocations = 0;
+
+	size_t _grows = 0;
+
+	size_t allocate(Pool& pool, size_t count, size_t initialBytes);
+
+	void release(Pool& pool, size_t first, size_t count);
+
+	// reallocate the buffer with room for at least count more elements, keeping its content
+	void grow(Pool& pool, size_t count, size_t initialBytes);
+
+	// bind the current buffers to the vertex array of format, creating it on first use
+	void attachBuffers(VertexFormat format);
+};
@@ -0,0 +1,180 @@
+#include <cstring>
+
+#include "gl_state.h"
+
+bool hasGLExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i) {
+		const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		if (extension != nullptr && std::strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t GLStateStats::getIssued() const {
+	return programChanges + vertexArrayChanges + textureChanges + uniformChanges + uniformBufferChanges;
+}
+
+size_t GLStateStats::getSkipped() const {
+	return programsSkipped + vertexArraysSkipped + texturesSkipped + uniformsSkipped + uniformBuffersSkipped;
+}
+
+GLStateCache& GLStateCache::instance() {
+	static GLStateCache cache;
+	return cache;
+}
+
+GLStateCache::GLStateCache() {
+	invalidate();
+}
+
+void GLStateCache::setEnabled(bool enabled) {
+	_enabled = enabled;
+}
+
+bool GLStateCache::isEnabled() const {
+	return _enabled;
+}
+
+void GLStateCache::useProgram(GLuint program) {
+	// the state is tracked either way, a disabled cache only stops skipping
+	if (_enabled && _program == program) {
+		++_stats.programsSkipped;
+		return;
+	}
+
+	glUseProgram(program);
+	_program = program;
+	++_stats.programChanges;
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray) {
+	if (_enabled && _vertexArray == vertexArray) {
+		++_stats.vertexArraysSkipped;
+		return;
+	}
+
+	glBindVertexArray(vertexArray);
+	_vertexArray = vertexArray;
+	++_stats.vertexArrayChanges;
+}
+
+void GLStateCache::activeTexture(GLuint unit) {
+	_unit = unit;
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture) {
+	GLuint& bound = _textures[_unit][target == GL_TEXTURE_CUBE_MAP ? 1 : 0];
+	if (_enabled && bound == texture) {
+		++_stats.texturesSkipped;
+		return;
+	}
+
+	if (!_enabled || _activeUnit != _unit) {
+		glActiveTexture(GL_TEXTURE0 + _unit);
+		_activeUnit = _unit;
+		++_stats.textureChanges;
+	}
+	glBindTexture(target, texture);
+	bound = texture;
+	++_stats.textureChanges;
+}
+
+bool GLStateCache::changeUniform(GLint location, const void* value, size_t size) {
+	if (location < 0) {
+		return false;
+	}
+
+	// values of a program not known to be in use cannot be told apart, so they are always set
+	if (_program == kUnknown || size > kMaxUniformSize) {
+		++_stats.uniformChanges;
+		return true;
+	}
+
+	UniformValue& cached = _uniforms[static_cast<uint64_t>(_program) << 32 | static_cast<uint32_t>(location)];
+	if (_enabled && cached.size == size && std::memcmp(cached.data, value, size) == 0) {
+		++_stats.uniformsSkipped;
+		return false;
+	}
+
+	cached.size = size;
+	std::memcpy(cached.data, value, size);
+	++_stats.uniformChanges;
+	return true;
+}
+
+void GLStateCache::bindUniformBuffer(GLuint binding, GLuint buffer, size_t offset, size_t size) {
+	BufferRange& bound = _uniformBuffers[binding];
+	if (_enabled && bound.buffer == buffer && bound.offset == offset && bound.size == size) {
+		++_stats.uniformBuffersSkipped;
+		return;
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+	bound = { buffer, offset, size };
+	++_stats.uniformBufferChanges;
+}
+
+void GLStateCache::invalidate() {
+	_program = kUnknown;
+	_vertexArray = kUnknown;
+	_activeUnit = kUnknown;
+	for (GLuint unit = 0; unit < kTextureUnits; ++unit) {
+		_textures[unit][0] = _textures[unit][1] = kUnknown;
+	}
+	for (BufferRange& bound : _uniformBuffers) {
+		bound = { kUnknown, 0, 0 };
+	}
+}
+
+void GLStateCache::forgetProgram(GLuint program) {
+	// a deleted program stays in use until another one is, but its name may come back
+	if (_program == program) {
+		_program = kUnknown;
+	}
+
+	for (auto it = _uniforms.begin(); it != _uniforms.end();) {
+		if (it->first >> 32 == program) {
+			it = _uniforms.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void GLStateCache::forgetVertexArray(GLuint vertexArray) {
+	// deleting the bound vertex array reverts the binding to 0
+	if (_vertexArray == vertexArray) {
+		_vertexArray = 0;
+	}
+}
+
+void GLStateCache::forgetTexture(GLuint texture) {
+	// and deleting a texture unbinds it from every unit
+	for (GLuint unit = 0; unit < kTextureUnits; ++unit) {
+		for (GLuint& bound : _textures[unit]) {
+			if (bound == texture) {
+				bound = 0;
+			}
+		}
+	}
+}
+
+void GLStateCache::forgetBuffer(GLuint buffer) {
+	for (BufferRange& bound : _uniformBuffers) {
+		if (bound.buffer == buffer) {
+			bound = { 0, 0, 0 };
+		}
+	}
+}
+
+const GLStateStats& GLStateCache::getStats() const {
+	return _stats;
+}
+
+void GLStateCache::resetStats() {
+	_stats = GLStateStats();
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include <glad/glad.h>
+
+// whether the current context lists the extension, e.g. "GL_ARB_get_program_binary"
+bool hasGLExtension(const char* name);
+
+// gl calls issued through the state cache and those it dropped because the value was already set
+struct GLStateStats {
+	size_t programChanges = 0;
+	size_t programsSkipped = 0;
+	size_t vertexArrayChanges = 0;
+	size_t vertexArraysSkipped = 0;
+	// texture bindings, glActiveTexture is counted with them
+	size_t textureChanges = 0;
+	size_t texturesSkipped = 0;
+	size_t uniformChanges = 0;
+	size_t uniformsSkipped = 0;
+	// uniform buffer ranges bound to block binding points
+	size_t uniformBufferChanges = 0;
+	size_t uniformBuffersSkipped = 0;
+
+	size_t getIssued() const;
+
+	size_t getSkipped() const;
+};
+
+// the program, vertex array, texture and uniform buffer bindings and the uniform values last set through here,
+// so setting them again costs no gl call; it belongs to the one gl context of the application and is only used
+// on its thread. code binding these objects with plain gl calls has to call invalidate() before the cache is
+// used again
+class GLStateCache {
+public:
+	static const GLuint kTextureUnits = 16;
+
+	static const GLuint kUniformBufferBindings = 16;
+
+	static GLStateCache& instance();
+
+	GLStateCache(const GLStateCache&) = delete;
+
+	GLStateCache& operator=(const GLStateCache&) = delete;
+
+	// when disabled every call is issued, to compare against
+	void setEnabled(bool enabled);
+
+	bool isEnabled() const;
+
+	void useProgram(GLuint program);
+
+	void bindVertexArray(GLuint vertexArray);
+
+	// select the unit bindTexture(target, texture) binds to, glActiveTexture waits for a binding that needs it
+	void activeTexture(GLuint unit);
+
+	// target is GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+	void bindTexture(GLenum target, GLuint texture);
+
+	// true when the uniform at location of the program in use has to be set to value, which is then remembered;
+	// false when it already holds it or the location is -1
+	bool changeUniform(GLint location, const void* value, size_t size);
+
+	// bind size bytes of buffer at offset to uniform block binding point binding
+	void bindUniformBuffer(GLuint binding, GLuint buffer, size_t offset, size_t size);
+
+	// forget the bindings, uniform values stay as they are kept by the programs themselves
+	void invalidate();
+
+	// objects about to be deleted, their names may be reused by new ones
+	void forgetProgram(GLuint program);
+
+	void forgetVertexArray(GLuint vertexArray);
+
+	void forgetTexture(GLuint texture);
+
+	void forgetBuffer(GLuint buffer);
+
+	const GLStateStats& getStats() const;
+
+	void resetStats();
+
+private:
+	// binding not known to the cache
+	static const GLuint kUnknown = 0xffffffffu;
+
+	// the largest uniform set through the cache is a mat4
+	static const size_t kMaxUniformSize = 64;
+
+	struct UniformValue {
+		size_t size = 0;
+		unsigned char data[kMaxUniformSize];
+	};
+
+	bool _enabled = true;
+
+	GLuint _program = kUnknown;
+
+	GLuint _vertexArray = kUnknown;
+
+	// unit selected by activeTexture() and the one gl has active
+	GLuint _unit = 0;
+
+	GLuint _activeUnit = kUnknown;
+
+	// per unit, GL_TEXTURE_2D then GL_TEXTURE_CUBE_MAP
+	GLuint _textures[kTextureUnits][2];
+
+	struct BufferRange {
+		GLuint buffer;
+		size_t offset;
+		size_t size;
+	};
+
+	BufferRange _uniformBuffers[kUniformBufferBindings];
+
+	// by program << 32 | location
+	std::unordered_map<uint64_t, UniformValue> _uniforms;
+
+	GLStateStats _stats;
+
+	GLStateCache();
+};
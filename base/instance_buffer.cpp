@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cstddef>
+
+#include "instance_buffer.h"
+
+InstanceBuffer::~InstanceBuffer() {
+	if (_buffer != 0) {
+		glDeleteBuffers(1, &_buffer);
+		_buffer = 0;
+	}
+}
+
+void InstanceBuffer::upload(const std::vector<InstanceData>& instances) {
+	if (_buffer == 0) {
+		glGenBuffers(1, &_buffer);
+	}
+
+	// the storage only grows, so the attributes never point past its end
+	_capacity = std::max(_capacity, instances.size());
+	_count = instances.size();
+	glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+	glBufferData(GL_ARRAY_BUFFER, _capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, _count * sizeof(InstanceData), instances.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+size_t InstanceBuffer::getCount() const {
+	return _count;
+}
+
+void InstanceBuffer::enableAttributes(size_t first) const {
+	const size_t base = first * sizeof(InstanceData);
+	glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+	// a mat4 attribute takes four locations, one column each
+	for (GLuint column = 0; column < 4; ++column) {
+		glVertexAttribPointer(kFirstLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(base + offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+	}
+	glVertexAttribPointer(kFirstLocation + 4, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)(base + offsetof(InstanceData, albedo)));
+	glVertexAttribPointer(kFirstLocation + 5, 2, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)(base + offsetof(InstanceData, material)));
+	for (GLuint column = 0; column < 3; ++column) {
+		glVertexAttribPointer(kFirstLocation + 6 + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(base + offsetof(InstanceData, normal) + column * sizeof(glm::vec3)));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	for (GLuint location = kFirstLocation; location < kFirstLocation + kLocationCount; ++location) {
+		glVertexAttribDivisor(location, 1);
+		glEnableVertexAttribArray(location);
+	}
+}
+
+void InstanceBuffer::disableAttributes() {
+	for (GLuint location = kFirstLocation; location < kFirstLocation + kLocationCount; ++location) {
+		glDisableVertexAttribArray(location);
+	}
+}
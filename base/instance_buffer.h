@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// per-instance attributes of an instanced draw, read by the shaders from locations 5-8 (model matrix),
+// 9 (albedo), 10 (roughness, metallic) and 11-13 (normal matrix)
+struct InstanceData {
+	glm::mat4 model;
+	glm::vec3 albedo;
+	glm::vec2 material;
+	// inverse transpose of the model matrix, computed once here rather than for every vertex
+	glm::mat3 normal;
+};
+
+// the instances of every instanced draw of a frame in one buffer; gl 3.3 has no base instance,
+// so each draw points the instance attributes of its vertex array at its own part of the buffer
+class InstanceBuffer {
+public:
+	InstanceBuffer() = default;
+
+	~InstanceBuffer();
+
+	InstanceBuffer(const InstanceBuffer&) = delete;
+
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+	// replace the content, the previous storage is orphaned so draws still reading it do not stall the upload
+	void upload(const std::vector<InstanceData>& instances);
+
+	size_t getCount() const;
+
+	// point the instance attributes of the bound vertex array at the instances from first on
+	void enableAttributes(size_t first) const;
+
+	// plain draws of the same vertex array take the model matrix from a uniform again
+	static void disableAttributes();
+
+private:
+	static const GLuint kFirstLocation = 5;
+
+	static const GLuint kLocationCount = 9;
+
+	GLuint _buffer = 0;
+
+	// in instances
+	size_t _capacity = 0;
+
+	size_t _count = 0;
+};
@@ -0,0 +1,146 @@
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile(const std::string& path) {
+	open(path);
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		close();
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+		std::swap(_open, other._open);
+#ifdef _WIN32
+		std::swap(_file, other._file);
+		std::swap(_mapping, other._mapping);
+#endif
+	}
+
+	return *this;
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// an empty file cannot be mapped, but it is still a valid (empty) file
+	if (size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			CloseHandle(file);
+			return false;
+		}
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == nullptr) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		_mapping = mapping;
+		_data = static_cast<const char*>(view);
+	}
+
+	_file = file;
+	_size = static_cast<size_t>(size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	if (st.st_size > 0) {
+		void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+		_data = static_cast<const char*>(view);
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	_size = static_cast<size_t>(st.st_size);
+#endif
+
+	_open = true;
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (_data != nullptr) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping != nullptr) {
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+	if (_file != nullptr) {
+		CloseHandle(_file);
+		_file = nullptr;
+	}
+#else
+	if (_data != nullptr) {
+		munmap(const_cast<char*>(_data), _size);
+	}
+#endif
+
+	_data = nullptr;
+	_size = 0;
+	_open = false;
+}
+
+bool MappedFile::isOpen() const {
+	return _open;
+}
+
+const char* MappedFile::data() const {
+	return _data;
+}
+
+size_t MappedFile::size() const {
+	return _size;
+}
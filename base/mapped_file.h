@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	MappedFile(const std::string& path);
+
+	~MappedFile();
+
+	MappedFile(MappedFile&& other) noexcept;
+
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	MappedFile(const MappedFile&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// map the file, returns false if it cannot be opened or mapped
+	bool open(const std::string& path);
+
+	void close();
+
+	bool isOpen() const;
+
+	const char* data() const;
+
+	size_t size() const;
+
+private:
+	const char* _data = nullptr;
+	size_t _size = 0;
+	bool _open = false;
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "mesh_bvh.h"
+
+// the slab test runs on the four lanes of an sse register, which every x64 target has
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_BVH_SIMD 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+	const size_t kBins = 16;
+	const uint32_t kMaxLeafTriangles = 8;
+	// traversal keeps at most one pending node per level
+	const int kMaxDepth = 60;
+	const size_t kStackSize = 64;
+
+	struct Bounds {
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		void grow(const glm::vec3& p) {
+			grow(p, p);
+		}
+
+		void grow(const Bounds& b) {
+			grow(b.min, b.max);
+		}
+
+		void grow(const glm::vec3& lo, const glm::vec3& hi) {
+			min.x = std::min(min.x, lo.x); min.y = std::min(min.y, lo.y); min.z = std::min(min.z, lo.z);
+			max.x = std::max(max.x, hi.x); max.y = std::max(max.y, hi.y); max.z = std::max(max.z, hi.z);
+		}
+
+		// half the surface area, 0 for empty bounds
+		float area() const {
+			if (min.x > max.x) {
+				return 0.0f;
+			}
+			glm::vec3 e = max - min;
+			return e.x * e.y + e.y * e.z + e.z * e.x;
+		}
+	};
+
+	struct BuildNode {
+		Bounds bounds;
+		uint32_t first = 0;
+		uint32_t count = 0;
+	};
+
+	// triangles are moved around by the partition, so every level reads them in order
+	struct BuildTriangle {
+		Bounds bounds;
+		glm::vec3 centroid;
+		uint32_t index;
+	};
+
+	struct Builder {
+		std::vector<BuildTriangle> triangles;
+		std::vector<BuildNode> nodes;
+
+		void subdivide(uint32_t nodeIndex, uint32_t begin, uint32_t end, int depth) {
+			Bounds bounds, centroidBounds;
+			for (uint32_t i = begin; i < end; ++i) {
+				bounds.grow(triangles[i].bounds);
+				centroidBounds.grow(triangles[i].centroid);
+			}
+			nodes[nodeIndex].bounds = bounds;
+			nodes[nodeIndex].first = begin;
+			nodes[nodeIndex].count = end - begin;
+
+			const uint32_t count = end - begin;
+			if (count <= 2 || depth >= kMaxDepth) {
+				return;
+			}
+
+			// bin the centroids along all three axes in one pass, small nodes (most of them) use fewer bins
+			const size_t binCount = std::min<size_t>(kBins, count);
+			const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+			glm::vec3 scale;
+			for (int axis = 0; axis < 3; ++axis) {
+				scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
+			}
+			Bounds bins[3][kBins];
+			uint32_t counts[3][kBins] = {};
+			for (uint32_t i = begin; i < end; ++i) {
+				const glm::vec3 position = (triangles[i].centroid - centroidBounds.min) * scale;
+				for (int axis = 0; axis < 3; ++axis) {
+					size_t bin = std::min(binCount - 1, static_cast<size_t>(position[axis]));
+					++counts[axis][bin];
+					bins[axis][bin].grow(triangles[i].bounds);
+				}
+			}
+
+			// cheapest split between bins, the cost of a side is its triangles times its area
+			float bestCost = FLT_MAX;
+			int bestAxis = -1;
+			size_t bestBin = 0;
+			for (int axis = 0; axis < 3; ++axis) {
+				if (extent[axis] <= 0.0f) {
+					continue;
+				}
+
+				float rightArea[kBins];
+				uint32_t rightCount[kBins];
+				Bounds right;
+				uint32_t rightTotal = 0;
+				for (size_t bin = binCount - 1; bin > 0; --bin) {
+					right.grow(bins[axis][bin]);
+					rightTotal += counts[axis][bin];
+					rightArea[bin] = right.area();
+					rightCount[bin] = rightTotal;
+				}
+
+				Bounds left;
+				uint32_t leftTotal = 0;
+				for (size_t bin = 0; bin + 1 < binCount; ++bin) {
+					left.grow(bins[axis][bin]);
+					leftTotal += counts[axis][bin];
+					if (leftTotal == 0 || rightCount[bin + 1] == 0) {
+						continue;
+					}
+					float cost = leftTotal * left.area() + rightCount[bin + 1] * rightArea[bin + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = bin;
+					}
+				}
+			}
+
+			// with a box test as expensive as a triangle test, splitting pays once it saves more than one test
+			uint32_t mid;
+			if (bestAxis >= 0) {
+				if (bestCost >= (count - 1) * bounds.area() && count <= kMaxLeafTriangles) {
+					return;
+				}
+				const float origin = centroidBounds.min[bestAxis];
+				const float axisScale = scale[bestAxis];
+				BuildTriangle* split = std::partition(triangles.data() + begin, triangles.data() + end, [&](const BuildTriangle& t) {
+					return std::min(binCount - 1, static_cast<size_t>((t.centroid[bestAxis] - origin) * axisScale)) <= bestBin;
+				});
+				mid = static_cast<uint32_t>(split - triangles.data());
+			} else {
+				// every centroid coincides, any split is as good as another
+				if (count <= kMaxLeafTriangles) {
+					return;
+				}
+				mid = begin + count / 2;
+			}
+
+			const uint32_t children = static_cast<uint32_t>(nodes.size());
+			nodes.resize(nodes.size() + 2);
+			nodes[nodeIndex].first = children;
+			nodes[nodeIndex].count = 0;
+			subdivide(children, begin, mid, depth + 1);
+			subdivide(children + 1, mid, end, depth + 1);
+		}
+	};
+
+	// slab test of origin + t * direction against boxes grown by a radius
+	struct BoxQuery {
+#ifdef MESH_BVH_SIMD
+		__m128 origin;
+		__m128 invDirection;
+		__m128 grow;
+		__m128 xyzMask;
+#else
+		glm::vec3 origin;
+		glm::vec3 invDirection;
+		float grow;
+#endif
+
+		BoxQuery(const glm::vec3& o, const glm::vec3& d, float radius) {
+			// axis parallel directions get a huge but finite inverse, so that 0 * inverse stays 0
+			glm::vec3 inv;
+			for (int k = 0; k < 3; ++k) {
+				inv[k] = 1.0f / (std::abs(d[k]) > 1e-30f ? d[k] : std::copysign(1e-30f, d[k]));
+			}
+#ifdef MESH_BVH_SIMD
+			origin = _mm_setr_ps(o.x, o.y, o.z, 0.0f);
+			invDirection = _mm_setr_ps(inv.x, inv.y, inv.z, 0.0f);
+			grow = _mm_setr_ps(radius, radius, radius, 0.0f);
+			xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+#else
+			origin = o;
+			invDirection = inv;
+			grow = radius;
+#endif
+		}
+
+		// entry parameter of the box given as min xyz, _, max xyz, _, infinity when it is missed in [0, maxDistance]
+		float enter(const float* box, float maxDistance) const {
+#ifdef MESH_BVH_SIMD
+			const __m128 lo = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(box), grow), origin), invDirection);
+			const __m128 hi = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(box + 4), grow), origin), invDirection);
+			// the fourth lane carries node data, it becomes the query interval [0, maxDistance]
+			__m128 tNear = _mm_and_ps(_mm_min_ps(lo, hi), xyzMask);
+			__m128 tFar = _mm_or_ps(_mm_and_ps(_mm_max_ps(lo, hi), xyzMask), _mm_andnot_ps(xyzMask, _mm_set1_ps(maxDistance)));
+			tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+			tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+			tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+			tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+			const float tEnter = _mm_cvtss_f32(tNear);
+			return tEnter <= _mm_cvtss_f32(tFar) ? tEnter : INFINITY;
+#else
+			float tEnter = 0.0f, tExit = maxDistance;
+			for (int k = 0; k < 3; ++k) {
+				float lo = (box[k] - grow - origin[k]) * invDirection[k];
+				float hi = (box[k + 4] + grow - origin[k]) * invDirection[k];
+				tEnter = std::max(tEnter, std::min(lo, hi));
+				tExit = std::min(tExit, std::max(lo, hi));
+			}
+			return tEnter <= tExit ? tEnter : INFINITY;
+#endif
+		}
+	};
+
+	// moller-trumbore, both sides
+	bool rayTriangle(const glm::vec3& origin, const glm::vec3& direction,
+		const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, float* t) {
+		const glm::vec3 p = glm::cross(direction, e2);
+		const float det = glm::dot(e1, p);
+		if (det == 0.0f) {
+			return false;
+		}
+		const float invDet = 1.0f / det;
+		const glm::vec3 s = origin - v0;
+		const float u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f) {
+			return false;
+		}
+		const glm::vec3 q = glm::cross(s, e1);
+		const float v = glm::dot(direction, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+		*t = glm::dot(e2, q) * invDet;
+		return true;
+	}
+
+	// closest point of the triangle to p by its voronoi regions (Ericson, Real-Time Collision Detection 5.1.5)
+	glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+		const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+		const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) {
+			return a;
+		}
+
+		const glm::vec3 bp = p - b;
+		const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) {
+			return b;
+		}
+
+		const float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+			return a + ab * (d1 / (d1 - d3));
+		}
+
+		const glm::vec3 cp = p - c;
+		const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) {
+			return c;
+		}
+
+		const float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+			return a + ac * (d2 / (d2 - d6));
+		}
+
+		const float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		}
+
+		const float denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+
+	// first time a sphere moving along d touches the point p, for a sphere that does not touch it yet
+	bool sweepPoint(const glm::vec3& c, float r, const glm::vec3& d, const glm::vec3& p, float* t) {
+		const glm::vec3 m = c - p;
+		const float a = glm::dot(d, d);
+		const float b = glm::dot(m, d);
+		if (a == 0.0f || b >= 0.0f) {
+			return false;
+		}
+		const float disc = b * b - a * (glm::dot(m, m) - r * r);
+		if (disc < 0.0f) {
+			return false;
+		}
+		*t = (-b - std::sqrt(disc)) / a;
+		return true;
+	}
+
+	// first time a sphere moving along d touches the segment ab away from its ends, s receives the contact on ab
+	bool sweepEdge(const glm::vec3& c, float r, const glm::vec3& d, const glm::vec3& a, const glm::vec3& b, float* t, float* s) {
+		const glm::vec3 e = b - a, m = c - a;
+		const float ee = glm::dot(e, e), md = glm::dot(m, e), nd = glm::dot(d, e);
+		const float qa = ee * glm::dot(d, d) - nd * nd;
+		// moving along the edge, the ends are hit first
+		if (qa <= 1e-12f * ee * glm::dot(d, d)) {
+			return false;
+		}
+		const float qb = ee * glm::dot(m, d) - nd * md;
+		const float qc = ee * (glm::dot(m, m) - r * r) - md * md;
+		const float disc = qb * qb - qa * qc;
+		if (disc < 0.0f) {
+			return false;
+		}
+		const float tt = (-qb - std::sqrt(disc)) / qa;
+		const float ss = (md + tt * nd) / ee;
+		if (tt < 0.0f || ss < 0.0f || ss > 1.0f) {
+			return false;
+		}
+		*t = tt;
+		*s = ss;
+		return true;
+	}
+
+	// first contact in [0, tMax] of a sphere moving along d with the triangle v0, v0 + e1, v0 + e2
+	bool sweepTriangle(const glm::vec3& c, float r, const glm::vec3& d,
+		const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, float tMax, float* t, glm::vec3* normal) {
+		const glm::vec3 corners[3] = { v0, v0 + e1, v0 + e2 };
+		glm::vec3 n = glm::cross(e1, e2);
+		const float length = glm::length(n);
+		n = length > 0.0f ? n / length : n;
+
+		// already touching, only a move towards the triangle is blocked
+		glm::vec3 away = c - closestPointOnTriangle(c, corners[0], corners[1], corners[2]);
+		const float distance2 = glm::dot(away, away);
+		if (distance2 < r * r) {
+			if (distance2 == 0.0f) {
+				away = glm::dot(n, d) > 0.0f ? -n : n;
+			}
+			if (glm::dot(away, d) >= 0.0f) {
+				return false;
+			}
+			*t = 0.0f;
+			*normal = glm::normalize(away);
+			return true;
+		}
+
+		// the face is touched first whenever the contact point lands inside the triangle
+		if (length > 0.0f) {
+			float distance = glm::dot(c - v0, n);
+			glm::vec3 side = distance < 0.0f ? -n : n;
+			distance = std::abs(distance);
+			// a sphere already cutting the plane can only reach the triangle over an edge
+			const float speed = glm::dot(d, side);
+			if (speed < 0.0f && distance >= r) {
+				const float tFace = (distance - r) / -speed;
+				const glm::vec3 p = c + tFace * d - r * side - v0;
+				const float d00 = glm::dot(e1, e1), d01 = glm::dot(e1, e2), d11 = glm::dot(e2, e2);
+				const float d20 = glm::dot(p, e1), d21 = glm::dot(p, e2);
+				const float denom = d00 * d11 - d01 * d01;
+				const float v = (d11 * d20 - d01 * d21) / denom;
+				const float w = (d00 * d21 - d01 * d20) / denom;
+				if (v >= 0.0f && w >= 0.0f && v + w <= 1.0f) {
+					if (tFace > tMax) {
+						return false;
+					}
+					*t = tFace;
+					*normal = side;
+					return true;
+				}
+			}
+		}
+
+		// otherwise an edge or a corner is
+		bool found = false;
+		float best = tMax;
+		for (int k = 0; k < 3; ++k) {
+			const glm::vec3& a = corners[k];
+			const glm::vec3& b = corners[(k + 1) % 3];
+			float tEdge, s;
+			if (sweepEdge(c, r, d, a, b, &tEdge, &s) && tEdge <= best) {
+				best = tEdge;
+				*normal = glm::normalize(c + tEdge * d - (a + s * (b - a)));
+				found = true;
+			}
+			float tCorner;
+			if (sweepPoint(c, r, d, a, &tCorner) && tCorner <= best) {
+				best = tCorner;
+				*normal = glm::normalize(c + tCorner * d - a);
+				found = true;
+			}
+		}
+		*t = best;
+		return found;
+	}
+}
+
+void MeshBvh::build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+	_nodes.clear();
+	_triangles.clear();
+	const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+	if (triangleCount == 0) {
+		return;
+	}
+
+	Builder builder;
+	builder.triangles.resize(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; ++t) {
+		BuildTriangle& triangle = builder.triangles[t];
+		for (int k = 0; k < 3; ++k) {
+			triangle.bounds.grow(vertices[indices[3 * t + k]].position);
+		}
+		triangle.centroid = 0.5f * (triangle.bounds.min + triangle.bounds.max);
+		triangle.index = t;
+	}
+
+	builder.nodes.reserve(2 * triangleCount);
+	builder.nodes.resize(1);
+	builder.subdivide(0, 0, triangleCount, 0);
+
+	_nodes.resize(builder.nodes.size());
+	for (size_t i = 0; i < _nodes.size(); ++i) {
+		const BuildNode& source = builder.nodes[i];
+		Node& node = _nodes[i];
+		for (int k = 0; k < 3; ++k) {
+			node.min[k] = source.bounds.min[k];
+			node.max[k] = source.bounds.max[k];
+		}
+		node.first = source.first;
+		node.count = source.count;
+	}
+
+	_triangles.resize(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; ++i) {
+		const uint32_t t = builder.triangles[i].index;
+		const glm::vec3& p0 = vertices[indices[3 * t + 0]].position;
+		_triangles[i].v0 = p0;
+		_triangles[i].e1 = vertices[indices[3 * t + 1]].position - p0;
+		_triangles[i].e2 = vertices[indices[3 * t + 2]].position - p0;
+		_triangles[i].index = t;
+	}
+}
+
+bool MeshBvh::empty() const {
+	return _nodes.empty();
+}
+
+size_t MeshBvh::getNodeCount() const {
+	return _nodes.size();
+}
+
+template <typename Visit>
+void MeshBvh::traverse(const glm::vec3& origin, const glm::vec3& direction, float radius, const float* maxDistance,
+	Visit visit) const {
+	if (_nodes.empty()) {
+		return;
+	}
+
+	const BoxQuery query(origin, direction, radius);
+	if (query.enter(_nodes[0].min, *maxDistance) == INFINITY) {
+		return;
+	}
+
+	// pending far children with their entry parameter, skipped once a closer hit is known
+	struct Entry {
+		uint32_t node;
+		float t;
+	};
+	Entry stack[kStackSize];
+	size_t size = 0;
+	uint32_t nodeIndex = 0;
+	for (;;) {
+		const Node& node = _nodes[nodeIndex];
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				visit(_triangles[i]);
+			}
+		} else {
+			uint32_t nearChild = node.first, farChild = node.first + 1;
+			float tNear = query.enter(_nodes[nearChild].min, *maxDistance);
+			float tFar = query.enter(_nodes[farChild].min, *maxDistance);
+			if (tFar < tNear) {
+				std::swap(tNear, tFar);
+				std::swap(nearChild, farChild);
+			}
+			if (tNear != INFINITY) {
+				if (tFar != INFINITY) {
+					stack[size++] = Entry{ farChild, tFar };
+				}
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		while (size > 0 && stack[size - 1].t > *maxDistance) {
+			--size;
+		}
+		if (size == 0) {
+			return;
+		}
+		nodeIndex = stack[--size].node;
+	}
+}
+
+bool MeshBvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, MeshHit* hit) const {
+	float best = maxDistance;
+	const Triangle* closest = nullptr;
+	traverse(origin, direction, 0.0f, &best, [&](const Triangle& triangle) {
+		float t;
+		if (rayTriangle(origin, direction, triangle.v0, triangle.e1, triangle.e2, &t) && t >= 0.0f && t <= best) {
+			best = t;
+			closest = &triangle;
+		}
+	});
+	if (closest == nullptr) {
+		return false;
+	}
+
+	glm::vec3 normal = glm::normalize(glm::cross(closest->e1, closest->e2));
+	hit->t = best;
+	hit->triangle = closest->index;
+	hit->normal = glm::dot(normal, direction) > 0.0f ? -normal : normal;
+	return true;
+}
+
+bool MeshBvh::contains(const glm::vec3& point) const {
+	// skewed off the axes so that the ray rarely runs through the shared edges of axis aligned faces
+	const glm::vec3 direction = glm::normalize(glm::vec3(0.5377f, 0.6237f, 0.5671f));
+	const float maxDistance = INFINITY;
+	size_t crossings = 0;
+	traverse(point, direction, 0.0f, &maxDistance, [&](const Triangle& triangle) {
+		float t;
+		if (rayTriangle(point, direction, triangle.v0, triangle.e1, triangle.e2, &t) && t > 0.0f) {
+			++crossings;
+		}
+	});
+	return crossings % 2 == 1;
+}
+
+bool MeshBvh::sweepSphere(const glm::vec3& center, float radius, const glm::vec3& displacement, MeshHit* hit) const {
+	float best = 1.0f;
+	bool found = false;
+	traverse(center, displacement, radius, &best, [&](const Triangle& triangle) {
+		float t;
+		glm::vec3 normal;
+		if (sweepTriangle(center, radius, displacement, triangle.v0, triangle.e1, triangle.e2, best, &t, &normal) &&
+			(!found || t < best)) {
+			best = t;
+			found = true;
+			hit->t = t;
+			hit->triangle = triangle.index;
+			hit->normal = normal;
+		}
+	});
+	return found;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex.h"
+
+// first contact of a ray or a swept sphere with a mesh
+struct MeshHit {
+	// parameter along the query direction, a distance for unit ray directions and a fraction of the displacement for sweeps
+	float t = 0.0f;
+	// position of the triangle in the index list divided by 3
+	uint32_t triangle = 0;
+	// unit normal of the contact, facing the query
+	glm::vec3 normal = glm::vec3(0.0f);
+};
+
+// bounding volume hierarchy over the triangles of a mesh, built with the binned surface area heuristic
+class MeshBvh {
+public:
+	void build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	bool empty() const;
+
+	size_t getNodeCount() const;
+
+	// closest triangle hit by origin + t * direction for t in [0, maxDistance], both sides of a triangle count
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, MeshHit* hit) const;
+
+	// whether the point is inside the surface by the parity of the crossings of a ray, needs a closed mesh
+	bool contains(const glm::vec3& point) const;
+
+	// first contact of a sphere moving from center to center + displacement, a sphere that starts out touching
+	// triangles only hits those it moves towards (t = 0), so that it can always move away from a contact
+	bool sweepSphere(const glm::vec3& center, float radius, const glm::vec3& displacement, MeshHit* hit) const;
+
+private:
+	// 32 bytes: an inner node has count 0 and its two children at first and first + 1,
+	// a leaf holds the triangles [first, first + count)
+	struct Node {
+		float min[3];
+		uint32_t first;
+		float max[3];
+		uint32_t count;
+	};
+
+	// the corners of a triangle as v0 + edge, in leaf order
+	struct Triangle {
+		glm::vec3 v0;
+		glm::vec3 e1;
+		glm::vec3 e2;
+		uint32_t index;
+	};
+
+	std::vector<Node> _nodes;
+
+	std::vector<Triangle> _triangles;
+
+	// visit the triangles of the leaves entered by origin + t * direction, t in [0, *maxDistance], with boxes grown
+	// by radius; leaves are visited nearest first and the visitor may lower *maxDistance to prune the rest
+	template <typename Visit>
+	void traverse(const glm::vec3& origin, const glm::vec3& direction, float radius, const float* maxDistance,
+		Visit visit) const;
+};
@@ -0,0 +1,255 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "mesh_cache.h"
+
+namespace {
+	const uint32_t kMagic = MESH_CACHE_TAG('M', 'B', 'I', 'N');
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceMtime;
+		uint64_t sourceHash;
+		uint32_t chunkCount;
+		uint32_t reserved;
+		uint64_t fileSize;
+	};
+
+	size_t alignUp(size_t n) {
+		return (n + 15) & ~(size_t)15;
+	}
+
+	bool readHeader(const std::string& path, Header* header) {
+		FILE* fp = std::fopen(path.c_str(), "rb");
+		if (fp == nullptr) {
+			return false;
+		}
+
+		const bool ok = std::fread(header, sizeof(Header), 1, fp) == 1 && header->magic == kMagic &&
+			header->version == MESH_CACHE_VERSION;
+		std::fclose(fp);
+		return ok;
+	}
+
+	// patch the source time in place, failing only means the next open hashes the source again
+	void writeSourceMtime(const std::string& path, int64_t mtime) {
+		FILE* fp = std::fopen(path.c_str(), "r+b");
+		if (fp == nullptr) {
+			return;
+		}
+
+		if (std::fseek(fp, (long)offsetof(Header, sourceMtime), SEEK_SET) == 0) {
+			std::fwrite(&mtime, sizeof(mtime), 1, fp);
+		}
+		std::fclose(fp);
+	}
+}
+
+bool MeshCache::open(const std::string& sourcePath) {
+	close();
+
+	MeshCacheSource source;
+	if (!statSource(sourcePath, &source)) {
+		return false;
+	}
+
+	if (!_file.open(cachePath(sourcePath)) || _file.size() < sizeof(Header)) {
+		_file.close();
+		return false;
+	}
+
+	Header header;
+	std::memcpy(&header, _file.data(), sizeof(Header));
+	if (header.magic != kMagic || header.version != MESH_CACHE_VERSION ||
+		header.fileSize != _file.size() || header.sourceSize != source.size) {
+		_file.close();
+		return false;
+	}
+
+	// a touched but unchanged source (e.g. after a checkout) only costs one hash pass, the new time is stored
+	// so later opens skip it; the mapping is read only, so the header is patched with the file unmapped
+	if (header.sourceMtime != source.mtime) {
+		uint64_t hash;
+		if (!hashSource(sourcePath, &hash) || hash != header.sourceHash) {
+			_file.close();
+			return false;
+		}
+
+		_file.close();
+		writeSourceMtime(cachePath(sourcePath), source.mtime);
+		if (!_file.open(cachePath(sourcePath)) || _file.size() != header.fileSize) {
+			_file.close();
+			return false;
+		}
+	}
+
+	size_t tableEnd = sizeof(Header) + (size_t)header.chunkCount * sizeof(ChunkEntry);
+	if (tableEnd > _file.size()) {
+		_file.close();
+		return false;
+	}
+
+	_chunks = reinterpret_cast<const ChunkEntry*>(_file.data() + sizeof(Header));
+	_chunkCount = header.chunkCount;
+	for (uint32_t i = 0; i < _chunkCount; ++i) {
+		if (_chunks[i].offset < tableEnd || _chunks[i].offset > _file.size() ||
+			_chunks[i].size > _file.size() - _chunks[i].offset) {
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void MeshCache::close() {
+	_file.close();
+	_chunks = nullptr;
+	_chunkCount = 0;
+}
+
+const void* MeshCache::chunk(uint32_t tag, size_t* size) const {
+	for (uint32_t i = 0; i < _chunkCount; ++i) {
+		if (_chunks[i].tag == tag) {
+			*size = static_cast<size_t>(_chunks[i].size);
+			return _file.data() + _chunks[i].offset;
+		}
+	}
+
+	*size = 0;
+	return nullptr;
+}
+
+bool MeshCache::write(const std::string& sourcePath, const std::vector<MeshCacheChunk>& chunks) {
+	MeshCacheSource source;
+	if (!statSource(sourcePath, &source) || !hashSource(sourcePath, &source.hash)) {
+		return false;
+	}
+
+	std::vector<ChunkEntry> table(chunks.size());
+	size_t offset = alignUp(sizeof(Header) + chunks.size() * sizeof(ChunkEntry));
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		table[i].tag = chunks[i].tag;
+		table[i].reserved = 0;
+		table[i].offset = offset;
+		table[i].size = chunks[i].size;
+		offset = alignUp(offset + chunks[i].size);
+	}
+
+	Header header{};
+	header.magic = kMagic;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = source.size;
+	header.sourceMtime = source.mtime;
+	header.sourceHash = source.hash;
+	header.chunkCount = static_cast<uint32_t>(chunks.size());
+	header.fileSize = offset;
+
+	// write to a temporary file first so a concurrent reader never maps a partial cache
+	std::string path = cachePath(sourcePath);
+	std::string tmpPath = path + ".tmp";
+	FILE* fp = std::fopen(tmpPath.c_str(), "wb");
+	if (fp == nullptr) {
+		return false;
+	}
+
+	static const char zeros[16] = {};
+	bool ok = std::fwrite(&header, sizeof(Header), 1, fp) == 1;
+	if (!table.empty()) {
+		ok = ok && std::fwrite(table.data(), sizeof(ChunkEntry), table.size(), fp) == table.size();
+	}
+
+	size_t written = sizeof(Header) + table.size() * sizeof(ChunkEntry);
+	for (size_t i = 0; i < chunks.size() && ok; ++i) {
+		size_t padding = (size_t)table[i].offset - written;
+		ok = std::fwrite(zeros, 1, padding, fp) == padding;
+		if (chunks[i].size > 0) {
+			ok = ok && std::fwrite(chunks[i].data, 1, chunks[i].size, fp) == chunks[i].size;
+		}
+		written = (size_t)table[i].offset + chunks[i].size;
+	}
+	ok = ok && std::fwrite(zeros, 1, offset - written, fp) == offset - written;
+	ok = (std::fclose(fp) == 0) && ok;
+
+	// rename does not replace an existing file on windows
+	std::remove(path.c_str());
+	if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+std::string MeshCache::cachePath(const std::string& sourcePath) {
+	return sourcePath + ".meshbin";
+}
+
+bool MeshCache::statSource(const std::string& sourcePath, MeshCacheSource* source) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(sourcePath.c_str(), GetFileExInfoStandard, &attributes)) {
+		return false;
+	}
+
+	source->size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	source->mtime = (int64_t)(((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+		attributes.ftLastWriteTime.dwLowDateTime);
+#else
+	struct stat st;
+	if (stat(sourcePath.c_str(), &st) != 0) {
+		return false;
+	}
+
+	// full resolution, a rewrite within the same second must not look unchanged
+	source->size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+	source->mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	source->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+	return true;
+}
+
+bool MeshCache::hashSource(const std::string& sourcePath, uint64_t* hash) {
+	MappedFile file;
+	if (!file.open(sourcePath)) {
+		return false;
+	}
+
+	uint64_t h = 14695981039346656037ull;
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(file.data());
+	for (size_t i = 0; i < file.size(); ++i) {
+		h = (h ^ p[i]) * 1099511628211ull;
+	}
+
+	*hash = h;
+	return true;
+}
+
+bool MeshCache::getSourceHash(const std::string& sourcePath, uint64_t* hash) {
+	MeshCacheSource source;
+	Header header;
+	if (statSource(sourcePath, &source) && readHeader(cachePath(sourcePath), &header) &&
+		header.sourceSize == source.size && header.sourceMtime == source.mtime) {
+		*hash = header.sourceHash;
+		return true;
+	}
+
+	return hashSource(sourcePath, hash);
+}
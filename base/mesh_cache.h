@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// fourcc tag of a chunk in a .meshbin file
+#define MESH_CACHE_TAG(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+// bump whenever the layout of an existing chunk changes
+#define MESH_CACHE_VERSION 1
+
+// identity of the source file a cache was built from
+struct MeshCacheSource {
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	uint64_t hash = 0;
+};
+
+// a chunk to be written, the data must stay alive until write() returns
+struct MeshCacheChunk {
+	uint32_t tag;
+	const void* data;
+	size_t size;
+};
+
+// binary cache of processed mesh data stored next to its source as <source>.meshbin
+// file layout: header, chunk table, then every chunk 16-byte aligned
+class MeshCache {
+public:
+	// map the cache of the source file, returns false if it is missing, corrupt or stale
+	bool open(const std::string& sourcePath);
+
+	void close();
+
+	// returns the chunk with the tag or nullptr, size receives the chunk size in bytes
+	const void* chunk(uint32_t tag, size_t* size) const;
+
+	// write the cache for the source file, returns false if it cannot be written
+	static bool write(const std::string& sourcePath, const std::vector<MeshCacheChunk>& chunks);
+
+	static std::string cachePath(const std::string& sourcePath);
+
+	// size and full resolution modification time of the file, returns false if it does not exist
+	static bool statSource(const std::string& sourcePath, MeshCacheSource* source);
+
+	// 64-bit FNV-1a hash of the file content
+	static bool hashSource(const std::string& sourcePath, uint64_t* hash);
+
+	// hash of the file content, taken from the header of its cache when the size and modification time still
+	// match, so a warm start does not read the source; hashes the file when there is no such cache
+	static bool getSourceHash(const std::string& sourcePath, uint64_t* hash);
+
+private:
+	MappedFile _file;
+
+	struct ChunkEntry {
+		uint32_t tag;
+		uint32_t reserved;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	const ChunkEntry* _chunks = nullptr;
+	uint32_t _chunkCount = 0;
+};
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+
+#include "mesh_clusters.h"
+
+namespace {
+	void finishCluster(const std::vector<Vertex>& vertices, const uint32_t* indices, MeshCluster* cluster,
+		const std::vector<uint32_t>& clusterVertices) {
+		// ritter's bounding sphere: span the two points farthest apart along a first sweep, then grow
+		glm::vec3 a = vertices[clusterVertices[0]].position;
+		glm::vec3 b = a;
+		float best = -1.0f;
+		for (uint32_t v : clusterVertices) {
+			float d = glm::dot(vertices[v].position - a, vertices[v].position - a);
+			if (d > best) {
+				best = d;
+				b = vertices[v].position;
+			}
+		}
+		best = -1.0f;
+		for (uint32_t v : clusterVertices) {
+			float d = glm::dot(vertices[v].position - b, vertices[v].position - b);
+			if (d > best) {
+				best = d;
+				a = vertices[v].position;
+			}
+		}
+
+		glm::vec3 center = 0.5f * (a + b);
+		float radius = 0.5f * glm::length(a - b);
+		for (uint32_t v : clusterVertices) {
+			float d = glm::length(vertices[v].position - center);
+			if (d > radius) {
+				float grown = 0.5f * (radius + d);
+				center += (vertices[v].position - center) * ((grown - radius) / d);
+				radius = grown;
+			}
+		}
+		cluster->center = center;
+		cluster->radius = radius;
+
+		// normal cone of the triangle normals
+		std::vector<glm::vec3> normals;
+		glm::vec3 axis(0.0f);
+		for (uint32_t i = cluster->firstIndex; i < cluster->firstIndex + cluster->indexCount; i += 3) {
+			const glm::vec3& p0 = vertices[indices[i + 0]].position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].position;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(n);
+			if (length > 0.0f) {
+				normals.push_back(n / length);
+				axis += n / length;
+			}
+		}
+
+		float axisLength = glm::length(axis);
+		if (normals.empty() || axisLength <= 0.0f) {
+			return;
+		}
+		axis /= axisLength;
+
+		float minDot = 1.0f;
+		for (const glm::vec3& n : normals) {
+			minDot = std::min(minDot, glm::dot(n, axis));
+		}
+		cluster->coneAxis = axis;
+		cluster->coneCutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+	}
+}
+
+void buildClusters(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t begin, size_t end,
+	std::vector<MeshCluster>* clusters, size_t maxVertices, size_t maxTriangles) {
+	const uint32_t unused = 0xffffffffu;
+	std::vector<uint32_t> owner(vertices.size(), unused);
+	std::vector<uint32_t> clusterVertices;
+
+	MeshCluster cluster;
+	cluster.firstIndex = static_cast<uint32_t>(begin);
+	size_t t = begin;
+	while (t + 2 < end) {
+		const uint32_t id = static_cast<uint32_t>(clusters->size());
+		size_t added = 0;
+		for (size_t c = 0; c < 3; ++c) {
+			added += owner[indices[t + c]] != id;
+		}
+
+		// a full cluster is closed and the triangle starts the next one
+		if (clusterVertices.size() + added > maxVertices || cluster.indexCount / 3 >= maxTriangles) {
+			finishCluster(vertices, indices, &cluster, clusterVertices);
+			clusters->push_back(cluster);
+			cluster = MeshCluster();
+			cluster.firstIndex = static_cast<uint32_t>(t);
+			clusterVertices.clear();
+			continue;
+		}
+
+		for (size_t c = 0; c < 3; ++c) {
+			uint32_t v = indices[t + c];
+			if (owner[v] != id) {
+				owner[v] = id;
+				clusterVertices.push_back(v);
+			}
+		}
+		cluster.indexCount += 3;
+		t += 3;
+	}
+
+	if (cluster.indexCount > 0) {
+		finishCluster(vertices, indices, &cluster, clusterVertices);
+		clusters->push_back(cluster);
+	}
+}
+
+bool clusterOutsideFrustum(const MeshCluster& cluster, const glm::vec4 planes[6]) {
+	for (int i = 0; i < 6; ++i) {
+		if (glm::dot(glm::vec3(planes[i]), cluster.center) + planes[i].w < -cluster.radius) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool clusterBackfacing(const MeshCluster& cluster, const glm::vec3& cameraPosition) {
+	glm::vec3 toCluster = cluster.center - cameraPosition;
+	return glm::dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * glm::length(toCluster) + cluster.radius;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex.h"
+#include "frustum_culler.h"
+
+// a run of consecutive triangles small enough to be culled as a whole
+struct MeshCluster {
+	// position of the first index and number of indices in the triangle list
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	// base vertex of the draw range the cluster belongs to
+	int32_t baseVertex = 0;
+
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+
+	// every triangle normal is within the cone around axis, cutoff is the sine of its half angle
+	// (1 when the cone is wider than a hemisphere, such a cluster is never back-facing)
+	glm::vec3 coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	float coneCutoff = 1.0f;
+};
+
+// counters of one cluster culled draw
+struct ClusterCullStats {
+	size_t clusters = 0;
+	size_t frustumCulled = 0;
+	size_t backfaceCulled = 0;
+	size_t trianglesSubmitted = 0;
+	size_t trianglesTotal = 0;
+
+	void add(const ClusterCullStats& stats) {
+		clusters += stats.clusters;
+		frustumCulled += stats.frustumCulled;
+		backfaceCulled += stats.backfaceCulled;
+		trianglesSubmitted += stats.trianglesSubmitted;
+		trianglesTotal += stats.trianglesTotal;
+	}
+};
+
+// cut the triangles indices[begin, end) in order into clusters of at most maxVertices distinct vertices
+// and maxTriangles triangles, a cache optimized order keeps them spatially compact
+void buildClusters(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t begin, size_t end,
+	std::vector<MeshCluster>* clusters, size_t maxVertices = 64, size_t maxTriangles = 124);
+
+// true when the cluster is completely outside the frustum
+bool clusterOutsideFrustum(const MeshCluster& cluster, const glm::vec4 planes[6]);
+
+// true when every triangle of the cluster faces away from the camera
+bool clusterBackfacing(const MeshCluster& cluster, const glm::vec3& cameraPosition);
@@ -0,0 +1,269 @@
+#include <algorithm>
+
+#include "mesh_optimizer.h"
+
+namespace {
+	// fifo post-transform cache, an entry is resident while less than cacheSize misses happened since it was loaded
+	class VertexCacheSim {
+	public:
+		VertexCacheSim(size_t vertexCount, unsigned cacheSize)
+			: _stamps(vertexCount, 0), _cacheSize(cacheSize), _time(cacheSize + 1) {}
+
+		bool access(uint32_t v) {
+			if (_time - _stamps[v] <= _cacheSize) {
+				return false;
+			}
+			_stamps[v] = _time++;
+			return true;
+		}
+
+		void reset() {
+			_time += _cacheSize + 1;
+		}
+
+	private:
+		std::vector<uint64_t> _stamps;
+		uint64_t _cacheSize;
+		uint64_t _time;
+	};
+
+	// triangles around every vertex in compressed form
+	struct TriangleAdjacency {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		TriangleAdjacency(const std::vector<uint32_t>& indices, size_t vertexCount)
+			: offsets(vertexCount + 1, 0), triangles(indices.size()) {
+			for (uint32_t v : indices) {
+				++offsets[v + 1];
+			}
+			for (size_t v = 0; v < vertexCount; ++v) {
+				offsets[v + 1] += offsets[v];
+			}
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); ++i) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize) {
+	VertexCacheStats stats;
+	if (indices.empty()) {
+		return stats;
+	}
+
+	VertexCacheSim cache(vertexCount, cacheSize);
+	std::vector<bool> referenced(vertexCount, false);
+	size_t misses = 0, referencedCount = 0;
+	for (uint32_t v : indices) {
+		misses += cache.access(v);
+		if (!referenced[v]) {
+			referenced[v] = true;
+			++referencedCount;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(referencedCount);
+	return stats;
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize) {
+	const size_t faceCount = indices.size() / 3;
+	if (faceCount == 0) {
+		return;
+	}
+
+	TriangleAdjacency adjacency(indices, vertexCount);
+
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+	}
+
+	std::vector<uint64_t> stamps(vertexCount, 0);
+	uint64_t time = cacheSize + 1;
+	std::vector<bool> emitted(faceCount, false);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+
+	std::vector<uint32_t> result;
+	result.reserve(faceCount * 3);
+
+	size_t cursor = 0;
+	int64_t fanning = 0;
+	while (fanning >= 0) {
+		// emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		const uint32_t f = static_cast<uint32_t>(fanning);
+		for (uint32_t k = adjacency.offsets[f]; k < adjacency.offsets[f + 1]; ++k) {
+			uint32_t t = adjacency.triangles[k];
+			if (emitted[t]) {
+				continue;
+			}
+
+			for (int c = 0; c < 3; ++c) {
+				uint32_t v = indices[3 * t + c];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				--liveTriangles[v];
+				if (time - stamps[v] > cacheSize) {
+					stamps[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// prefer the candidate that is still cached after emitting its remaining triangles, oldest first
+		int64_t best = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) {
+				continue;
+			}
+
+			int64_t priority = 0;
+			if (time - stamps[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = static_cast<int64_t>(time - stamps[v]);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+
+		// dead end: fall back to recently touched vertices, then to the next unfinished one in input order
+		while (best < 0 && !deadEnds.empty()) {
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0) {
+				best = v;
+			}
+		}
+		while (best < 0 && cursor < vertexCount) {
+			if (liveTriangles[cursor] > 0) {
+				best = static_cast<int64_t>(cursor);
+			}
+			++cursor;
+		}
+
+		fanning = best;
+	}
+
+	indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold, unsigned cacheSize) {
+	const size_t faceCount = indices.size() / 3;
+	if (faceCount == 0) {
+		return;
+	}
+
+	VertexCacheSim cache(vertices.size(), cacheSize);
+	auto triangleMisses = [&](size_t t) {
+		return (int)cache.access(indices[3 * t + 0]) + (int)cache.access(indices[3 * t + 1]) + (int)cache.access(indices[3 * t + 2]);
+	};
+
+	// hard boundaries: triangles missing all three vertices start over anyway
+	std::vector<size_t> hardBoundaries;
+	for (size_t t = 0; t < faceCount; ++t) {
+		if (triangleMisses(t) == 3) {
+			hardBoundaries.push_back(t);
+		}
+	}
+	hardBoundaries.push_back(faceCount);
+
+	// soft boundaries: split a cluster where its prefix already reaches the miss rate of the whole cluster
+	std::vector<size_t> clusters;
+	for (size_t c = 0; c + 1 < hardBoundaries.size(); ++c) {
+		const size_t begin = hardBoundaries[c], end = hardBoundaries[c + 1];
+
+		cache.reset();
+		size_t clusterMisses = 0;
+		for (size_t t = begin; t < end; ++t) {
+			clusterMisses += triangleMisses(t);
+		}
+		const float clusterAcmr = static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+		cache.reset();
+		clusters.push_back(begin);
+		size_t start = begin, misses = 0;
+		for (size_t t = begin; t + 1 < end; ++t) {
+			misses += triangleMisses(t);
+			if (static_cast<float>(misses) <= threshold * clusterAcmr * static_cast<float>(t + 1 - start)) {
+				start = t + 1;
+				misses = 0;
+				clusters.push_back(start);
+				cache.reset();
+			}
+		}
+	}
+	clusters.push_back(faceCount);
+
+	// area weighted centroid and normal of every cluster, from the vertex normals when the face is degenerate
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> centroids(clusters.size() - 1), normals(clusters.size() - 1);
+	for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+			const Vertex& a = vertices[indices[3 * t + 0]];
+			const Vertex& b = vertices[indices[3 * t + 1]];
+			const Vertex& d = vertices[indices[3 * t + 2]];
+			glm::vec3 n = glm::cross(b.position - a.position, d.position - a.position);
+			float twiceArea = glm::length(n);
+			if (twiceArea <= 0.0f) {
+				n = a.normal + b.normal + d.normal;
+			}
+			normal += n;
+			centroid += (a.position + b.position + d.position) * (twiceArea / 3.0f);
+			area += twiceArea;
+		}
+
+		meshCentroid += centroid;
+		meshArea += area;
+		centroids[c] = area > 0.0f ? centroid / area : vertices[indices[3 * clusters[c]]].position;
+		float length = glm::length(normal);
+		normals[c] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	std::vector<float> keys(clusters.size() - 1);
+	std::vector<size_t> order(clusters.size() - 1);
+	for (size_t c = 0; c < order.size(); ++c) {
+		keys[c] = glm::dot(centroids[c] - meshCentroid, normals[c]);
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (size_t c : order) {
+		result.insert(result.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+	}
+	indices.swap(result);
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	const uint32_t unused = 0xffffffffu;
+	std::vector<uint32_t> remap(vertices.size(), unused);
+	std::vector<Vertex> result;
+	result.reserve(vertices.size());
+
+	for (uint32_t& v : indices) {
+		if (remap[v] == unused) {
+			remap[v] = static_cast<uint32_t>(result.size());
+			result.push_back(vertices[v]);
+		}
+		v = remap[v];
+	}
+
+	vertices.swap(result);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// post-transform vertex cache efficiency of an index buffer
+struct VertexCacheStats {
+	// average cache misses per triangle, 0.5 is the optimum for regular meshes, 3 the worst case
+	float acmr = 0.0f;
+	// average cache misses per referenced vertex, 1 is the optimum
+	float atvr = 0.0f;
+};
+
+// simulate a fifo post-transform cache of cacheSize entries over the triangle list
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize = 16);
+
+// reorder triangles for vertex cache locality (tipsify, Sander et al. 2007)
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize = 16);
+
+// reorder clusters of a cache optimized triangle list so that outward facing clusters are drawn first,
+// a cluster is only split where its miss rate stays within threshold times that of the whole cluster
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+	float threshold = 1.05f, unsigned cacheSize = 16);
+
+// reorder vertices by first use in the index buffer and drop unreferenced ones
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
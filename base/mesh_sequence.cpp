@@ -0,0 +1,559 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "gl_state.h"
+#include "mesh_optimizer.h"
+#include "model.h"
+#include "mesh_sequence.h"
+
+namespace {
+	const size_t kComponents = 5;
+
+	// the position and normal components of a quantized vertex, in encoding order
+	void getComponents(const uint16_t position[4], const int16_t normal[2], int32_t values[kComponents]) {
+		values[0] = position[0];
+		values[1] = position[1];
+		values[2] = position[2];
+		values[3] = normal[0];
+		values[4] = normal[1];
+	}
+
+	void appendVarint(uint32_t value, std::vector<uint8_t>* data) {
+		while (value >= 0x80) {
+			data->push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		data->push_back(static_cast<uint8_t>(value));
+	}
+
+	uint32_t readVarint(const uint8_t** data) {
+		uint32_t value = 0;
+		for (int shift = 0;; shift += 7) {
+			uint8_t byte = *(*data)++;
+			value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+			if (byte < 0x80) {
+				return value;
+			}
+		}
+	}
+
+	// small differences of either sign map to small unsigned values
+	uint32_t zigzag(int32_t value) {
+		return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+	}
+
+	int32_t unzigzag(uint32_t value) {
+		return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+	}
+}
+
+MeshSequence::MeshSequence(const std::string& pathPrefix, int frameCount, const MeshSequenceOptions& options)
+	: _quantized(options.quantize && !options.stream),
+	_deltaEncoded(options.quantize && options.deltaEncode && !options.stream),
+	_streamed(options.stream), _pathPrefix(pathPrefix) {
+	if (frameCount <= 0) {
+		throw std::runtime_error("load " + pathPrefix + " failure: empty sequence");
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	loadObjMesh(pathPrefix + "0.obj", &vertices, &indices);
+	_frameCount = frameCount;
+	_vertexCount = vertices.size();
+	_indexCount = indices.size();
+
+	std::vector<glm::vec2> texCoords(_vertexCount);
+	for (size_t i = 0; i < _vertexCount; ++i) {
+		texCoords[i] = vertices[i].texCoord;
+	}
+
+	_boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	_boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	if (_streamed) {
+		// the first frame is already here, the loader thread starts with the next one
+		_sourceIndices = indices;
+		_streamSlots.resize(std::min(std::max(options.streamSlots, size_t(2)), _frameCount));
+		StreamSlot& first = _streamSlots[0];
+		first.vertices.resize(_vertexCount);
+		for (size_t i = 0; i < _vertexCount; ++i) {
+			first.vertices[i].position = vertices[i].position;
+			first.vertices[i].normal = vertices[i].normal;
+			_boundsMin = glm::min(_boundsMin, vertices[i].position);
+			_boundsMax = glm::max(_boundsMax, vertices[i].position);
+		}
+		first.frame = 0;
+		first.state = StreamSlot::State::Ready;
+	} else {
+		loadFrames(vertices, indices);
+	}
+
+	// the triangle order is shared by every frame, so only the cache reordering applies
+	optimizeVertexCache(indices, _vertexCount);
+
+	// opengl objects
+	_indexType = _vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	_slotFrames.assign(_streamed ? _streamSlots.size() : 2, SIZE_MAX);
+
+	glGenVertexArrays(1, &_vao);
+	glGenBuffers(1, &_texCoordBuffer);
+	glGenBuffers(1, &_frameBuffer);
+	glGenBuffers(1, &_ebo);
+
+	GLStateCache::instance().bindVertexArray(_vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _texCoordBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * texCoords.size(), texCoords.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+	glEnableVertexAttribArray(2);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _frameBuffer);
+	glBufferData(GL_ARRAY_BUFFER, _slotFrames.size() * _vertexCount * getGpuVertexSize(), nullptr, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+	if (_indexType == GL_UNSIGNED_SHORT) {
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+	} else {
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+	}
+
+	GLStateCache::instance().bindVertexArray(0);
+
+	if (_streamed) {
+		_streamThread = std::thread(&MeshSequence::streamFrames, this);
+	}
+
+	std::cout << "loaded sequence " << pathPrefix << ": " << frameCount << " frames, " << _vertexCount
+		<< " vertices, " << getByteSize() / 1024 << " KB" << (_streamed ? " streamed" : "") << std::endl;
+}
+
+void MeshSequence::loadFrames(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+	// float frames until the bounds of the whole sequence are known
+	std::vector<std::vector<FloatVertex>> frames(_frameCount);
+	for (size_t f = 0; f < _frameCount; ++f) {
+		if (f > 0) {
+			std::string path = _pathPrefix + std::to_string(f) + ".obj";
+			std::vector<uint32_t> frameIndices;
+			loadObjMesh(path, &vertices, &frameIndices);
+			if (vertices.size() != _vertexCount || frameIndices != indices) {
+				throw std::runtime_error("load " + path + " failure: faces differ from the first frame");
+			}
+		}
+
+		frames[f].resize(_vertexCount);
+		for (size_t i = 0; i < _vertexCount; ++i) {
+			frames[f][i].position = vertices[i].position;
+			frames[f][i].normal = vertices[i].normal;
+			_boundsMin = glm::min(_boundsMin, vertices[i].position);
+			_boundsMax = glm::max(_boundsMax, vertices[i].position);
+		}
+	}
+
+	const glm::vec3 extent = _boundsMax - _boundsMin;
+	const glm::vec3 invScale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+		extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+	std::vector<QuantizedVertex> previous(_vertexCount), current(_vertexCount);
+	_frames.resize(_frameCount);
+	for (size_t f = 0; f < _frameCount; ++f) {
+		std::vector<uint8_t>& data = _frames[f];
+		if (!_quantized) {
+			data.resize(_vertexCount * sizeof(FloatVertex));
+			std::memcpy(data.data(), frames[f].data(), data.size());
+			std::vector<FloatVertex>().swap(frames[f]);
+			continue;
+		}
+
+		for (size_t i = 0; i < _vertexCount; ++i) {
+			glm::vec3 position = glm::clamp((frames[f][i].position - _boundsMin) * invScale, 0.0f, 1.0f);
+			glm::vec2 normal = octEncode(frames[f][i].normal);
+			QuantizedVertex& vertex = current[i];
+			vertex.position[0] = static_cast<uint16_t>(std::lround(position.x * 65535.0f));
+			vertex.position[1] = static_cast<uint16_t>(std::lround(position.y * 65535.0f));
+			vertex.position[2] = static_cast<uint16_t>(std::lround(position.z * 65535.0f));
+			vertex.position[3] = 0;
+			vertex.normal[0] = static_cast<int16_t>(std::lround(normal.x * 32767.0f));
+			vertex.normal[1] = static_cast<int16_t>(std::lround(normal.y * 32767.0f));
+		}
+		std::vector<FloatVertex>().swap(frames[f]);
+
+		if (!_deltaEncoded) {
+			data.resize(_vertexCount * sizeof(QuantizedVertex));
+			std::memcpy(data.data(), current.data(), data.size());
+			continue;
+		}
+
+		// keyframes are differences to zero, so that decoding can start at any of them
+		const bool keyframe = f % kKeyframeInterval == 0;
+		for (size_t i = 0; i < _vertexCount; ++i) {
+			int32_t values[kComponents], base[kComponents] = {};
+			getComponents(current[i].position, current[i].normal, values);
+			if (!keyframe) {
+				getComponents(previous[i].position, previous[i].normal, base);
+			}
+			for (size_t c = 0; c < kComponents; ++c) {
+				appendVarint(zigzag(values[c] - base[c]), &data);
+			}
+		}
+		data.shrink_to_fit();
+		previous.swap(current);
+	}
+}
+
+MeshSequence::~MeshSequence() {
+	if (_streamThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_streamMutex);
+			_stopStream = true;
+		}
+		_streamCondition.notify_one();
+		_streamThread.join();
+	}
+
+	if (_ebo != 0) {
+		glDeleteBuffers(1, &_ebo);
+		_ebo = 0;
+	}
+
+	if (_frameBuffer != 0) {
+		glDeleteBuffers(1, &_frameBuffer);
+		_frameBuffer = 0;
+	}
+
+	if (_texCoordBuffer != 0) {
+		glDeleteBuffers(1, &_texCoordBuffer);
+		_texCoordBuffer = 0;
+	}
+
+	if (_vao != 0) {
+		GLStateCache::instance().forgetVertexArray(_vao);
+		glDeleteVertexArrays(1, &_vao);
+		_vao = 0;
+	}
+}
+
+size_t MeshSequence::getFrameCount() const {
+	return _frameCount;
+}
+
+size_t MeshSequence::getVertexCount() const {
+	return _vertexCount;
+}
+
+size_t MeshSequence::getFaceCount() const {
+	return _indexCount / 3;
+}
+
+bool MeshSequence::isQuantized() const {
+	return _quantized;
+}
+
+bool MeshSequence::isStreamed() const {
+	return _streamed;
+}
+
+MeshSequenceStreamStats MeshSequence::getStreamStats() const {
+	std::lock_guard<std::mutex> lock(_streamMutex);
+	return _streamStats;
+}
+
+glm::vec3 MeshSequence::getPositionOffset() const {
+	return _quantized ? _boundsMin : glm::vec3(0.0f);
+}
+
+glm::vec3 MeshSequence::getPositionScale() const {
+	return _quantized ? _boundsMax - _boundsMin : glm::vec3(1.0f);
+}
+
+size_t MeshSequence::getByteSize() const {
+	size_t bytes = _decoded.size() * sizeof(QuantizedVertex);
+	for (const std::vector<uint8_t>& frame : _frames) {
+		bytes += frame.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_streamMutex);
+		for (const StreamSlot& slot : _streamSlots) {
+			bytes += slot.vertices.capacity() * sizeof(FloatVertex);
+		}
+	}
+
+	bytes += _vertexCount * (sizeof(glm::vec2) + _slotFrames.size() * getGpuVertexSize());
+	bytes += _indexCount * (_indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+	return bytes;
+}
+
+void MeshSequence::draw(size_t frameA, size_t frameB) {
+	frameA %= _frameCount;
+	frameB %= _frameCount;
+
+	int slotA, slotB;
+	if (_streamed) {
+		bool moved;
+		{
+			std::lock_guard<std::mutex> lock(_streamMutex);
+			moved = _playhead != frameA;
+			_playhead = frameA;
+		}
+		if (moved) {
+			_streamCondition.notify_one();
+		}
+
+		uploadStreamedFrames();
+		slotA = findSlot(frameA);
+		slotB = findSlot(frameB);
+		if (slotA < 0) {
+			// the loader fell behind, keep drawing what the bound slots hold
+			{
+				std::lock_guard<std::mutex> lock(_streamMutex);
+				++_streamStats.underruns;
+			}
+			if (_boundSlots[0] < 0) {
+				return;
+			}
+			slotA = slotB = _boundSlots[0];
+		} else if (slotB < 0) {
+			slotB = slotA;
+		}
+	} else {
+		// keep a slot that already holds one of the frames, playback then uploads one frame per step
+		slotA = _slotFrames[0] == frameA ? 0 : _slotFrames[1] == frameA ? 1 : _slotFrames[0] == frameB ? 1 : 0;
+		if (_slotFrames[slotA] != frameA) {
+			upload(frameA, slotA);
+		}
+
+		slotB = slotA;
+		if (frameB != frameA) {
+			slotB = 1 - slotA;
+			if (_slotFrames[slotB] != frameB) {
+				upload(frameB, slotB);
+			}
+		}
+	}
+
+	bindSlots(slotA, slotB);
+
+	GLStateCache::instance().bindVertexArray(_vao);
+	glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(_indexCount), _indexType, (void*)0);
+}
+
+size_t MeshSequence::getGpuVertexSize() const {
+	return _quantized ? sizeof(QuantizedVertex) : sizeof(FloatVertex);
+}
+
+void MeshSequence::decode(size_t frame) {
+	if (_decodedFrame == frame) {
+		return;
+	}
+
+	_decoded.resize(_vertexCount);
+	if (!_deltaEncoded) {
+		std::memcpy(_decoded.data(), _frames[frame].data(), _frames[frame].size());
+		_decodedFrame = frame;
+		return;
+	}
+
+	// continue from the last decoded frame when it lies between the keyframe and this frame
+	const size_t keyframe = frame - frame % kKeyframeInterval;
+	size_t first = keyframe;
+	if (_decodedFrame != SIZE_MAX && _decodedFrame >= keyframe && _decodedFrame < frame) {
+		first = _decodedFrame + 1;
+	}
+
+	for (size_t f = first; f <= frame; ++f) {
+		const bool isKeyframe = f == keyframe;
+		const uint8_t* data = _frames[f].data();
+		for (QuantizedVertex& vertex : _decoded) {
+			int32_t values[kComponents] = {};
+			if (!isKeyframe) {
+				getComponents(vertex.position, vertex.normal, values);
+			}
+			for (size_t c = 0; c < kComponents; ++c) {
+				values[c] += unzigzag(readVarint(&data));
+			}
+			vertex.position[0] = static_cast<uint16_t>(values[0]);
+			vertex.position[1] = static_cast<uint16_t>(values[1]);
+			vertex.position[2] = static_cast<uint16_t>(values[2]);
+			vertex.position[3] = 0;
+			vertex.normal[0] = static_cast<int16_t>(values[3]);
+			vertex.normal[1] = static_cast<int16_t>(values[4]);
+		}
+	}
+	_decodedFrame = frame;
+}
+
+void MeshSequence::upload(size_t frame, int slot) {
+	const void* data = _frames[frame].data();
+	if (_quantized) {
+		decode(frame);
+		data = _decoded.data();
+	}
+
+	const size_t size = _vertexCount * getGpuVertexSize();
+	glBindBuffer(GL_ARRAY_BUFFER, _frameBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, slot * size, size, data);
+	_slotFrames[slot] = frame;
+}
+
+void MeshSequence::bindSlots(int slotA, int slotB) {
+	if (_boundSlots[0] == slotA && _boundSlots[1] == slotB) {
+		return;
+	}
+
+	GLStateCache::instance().bindVertexArray(_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, _frameBuffer);
+	const size_t stride = getGpuVertexSize();
+	const int slots[2] = { slotA, slotB };
+	for (int i = 0; i < 2; ++i) {
+		const size_t base = slots[i] * _vertexCount * stride;
+		const GLuint location = i == 0 ? 0 : 3;
+		if (_quantized) {
+			glVertexAttribPointer(location, 3, GL_UNSIGNED_SHORT, GL_TRUE, (GLsizei)stride,
+				(void*)(base + offsetof(QuantizedVertex, position)));
+			glVertexAttribPointer(location + 1, 2, GL_SHORT, GL_FALSE, (GLsizei)stride,
+				(void*)(base + offsetof(QuantizedVertex, normal)));
+		} else {
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, (GLsizei)stride,
+				(void*)(base + offsetof(FloatVertex, position)));
+			glVertexAttribPointer(location + 1, 3, GL_FLOAT, GL_FALSE, (GLsizei)stride,
+				(void*)(base + offsetof(FloatVertex, normal)));
+		}
+	}
+	_boundSlots[0] = slotA;
+	_boundSlots[1] = slotB;
+}
+
+void MeshSequence::uploadStreamedFrames() {
+	// take the finished frames out of their slots under the lock and transfer them after releasing it, so the
+	// loader thread never waits on the driver; it leaves Uploading slots alone
+	struct ReadyFrame {
+		size_t slot;
+		size_t frame;
+		std::vector<FloatVertex> vertices;
+	};
+	std::vector<ReadyFrame> ready;
+	{
+		std::lock_guard<std::mutex> lock(_streamMutex);
+		for (size_t i = 0; i < _streamSlots.size(); ++i) {
+			StreamSlot& slot = _streamSlots[i];
+			if (slot.state != StreamSlot::State::Ready) {
+				continue;
+			}
+
+			slot.state = StreamSlot::State::Uploading;
+			ready.push_back({ i, slot.frame, std::move(slot.vertices) });
+		}
+	}
+
+	if (ready.empty()) {
+		return;
+	}
+
+	const size_t size = _vertexCount * sizeof(FloatVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, _frameBuffer);
+	for (const ReadyFrame& frame : ready) {
+		glBufferSubData(GL_ARRAY_BUFFER, frame.slot * size, size, frame.vertices.data());
+		_slotFrames[frame.slot] = frame.frame;
+	}
+
+	// the vectors go back to their slots, the loader reuses their memory
+	std::lock_guard<std::mutex> lock(_streamMutex);
+	for (ReadyFrame& frame : ready) {
+		StreamSlot& slot = _streamSlots[frame.slot];
+		slot.vertices = std::move(frame.vertices);
+		slot.state = StreamSlot::State::Resident;
+	}
+}
+
+int MeshSequence::findSlot(size_t frame) const {
+	for (size_t i = 0; i < _slotFrames.size(); ++i) {
+		if (_slotFrames[i] == frame) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+void MeshSequence::streamFrames() {
+	std::unique_lock<std::mutex> lock(_streamMutex);
+	while (!_stopStream) {
+		// the window is the frames from the playhead on, one per slot; load the first one that has no slot
+		// into a slot whose frame has left the window
+		const size_t window = _streamSlots.size();
+		auto inWindow = [&](size_t frame) {
+			return frame != SIZE_MAX && (frame + _frameCount - _playhead) % _frameCount < window;
+		};
+
+		size_t frame = SIZE_MAX;
+		for (size_t k = 0; k < window && frame == SIZE_MAX; ++k) {
+			frame = (_playhead + k) % _frameCount;
+			for (const StreamSlot& slot : _streamSlots) {
+				if (slot.frame == frame) {
+					frame = SIZE_MAX;
+					break;
+				}
+			}
+		}
+
+		StreamSlot* target = nullptr;
+		if (frame != SIZE_MAX) {
+			for (StreamSlot& slot : _streamSlots) {
+				if (slot.state != StreamSlot::State::Loading && slot.state != StreamSlot::State::Uploading &&
+					!inWindow(slot.frame)) {
+					target = &slot;
+					break;
+				}
+			}
+		}
+
+		if (target == nullptr) {
+			_streamCondition.wait(lock);
+			continue;
+		}
+
+		target->state = StreamSlot::State::Loading;
+		target->frame = frame;
+		std::vector<FloatVertex> frameVertices;
+		frameVertices.swap(target->vertices);
+		lock.unlock();
+
+		std::string path = _pathPrefix + std::to_string(frame) + ".obj";
+		std::string error;
+		try {
+			std::vector<Vertex> vertices;
+			std::vector<uint32_t> indices;
+			loadObjMesh(path, &vertices, &indices);
+			if (vertices.size() != _vertexCount || indices != _sourceIndices) {
+				error = "load " + path + " failure: faces differ from the first frame";
+			} else {
+				frameVertices.resize(_vertexCount);
+				for (size_t i = 0; i < _vertexCount; ++i) {
+					frameVertices[i].position = vertices[i].position;
+					frameVertices[i].normal = vertices[i].normal;
+				}
+			}
+		} catch (const std::exception& e) {
+			error = e.what();
+		}
+
+		lock.lock();
+		target->vertices.swap(frameVertices);
+		if (!error.empty()) {
+			// the missing frame would stall playback at every loop, stop streaming
+			std::cerr << error << std::endl;
+			target->state = StreamSlot::State::Empty;
+			target->frame = SIZE_MAX;
+			break;
+		}
+		target->state = StreamSlot::State::Ready;
+		++_streamStats.framesLoaded;
+	}
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "vertex.h"
+
+// storage of the frames of a mesh sequence
+struct MeshSequenceOptions {
+	// positions as unorm16 inside the aabb of the whole sequence, normals as octahedral int16
+	bool quantize = true;
+
+	// quantized frames as varint differences to the previous frame, with a full frame every
+	// kKeyframeInterval frames; ignored without quantize
+	bool deltaEncode = true;
+
+	// keep only streamSlots frames around the playhead, loaded by a background thread; streamed frames are
+	// float, as quantizing needs the bounds of every frame, so quantize and deltaEncode are ignored
+	bool stream = false;
+
+	size_t streamSlots = 8;
+};
+
+// counters of a streamed sequence
+struct MeshSequenceStreamStats {
+	size_t framesLoaded = 0;
+	// draws whose frame was not loaded yet, they show the last frame drawn instead
+	size_t underruns = 0;
+};
+
+// an animation given as one obj file per frame, all with the same faces: the indices and texcoords are
+// stored once and every frame only keeps its positions and normals; two frames at a time live on the gpu,
+// in attributes 0/1 and 3/4, and the vertex shader blends them by the frameBlend uniform
+class MeshSequence {
+public:
+	// loads <pathPrefix>0.obj to <pathPrefix><frameCount - 1>.obj, a streamed sequence only loads the first
+	// one here and the others while it plays
+	MeshSequence(const std::string& pathPrefix, int frameCount,
+		const MeshSequenceOptions& options = MeshSequenceOptions());
+
+	~MeshSequence();
+
+	MeshSequence(const MeshSequence&) = delete;
+
+	MeshSequence& operator=(const MeshSequence&) = delete;
+
+	size_t getFrameCount() const;
+
+	size_t getVertexCount() const;
+
+	size_t getFaceCount() const;
+
+	bool isQuantized() const;
+
+	bool isStreamed() const;
+
+	MeshSequenceStreamStats getStreamStats() const;
+
+	// a quantized position p in [0, 1]^3 decodes to offset + p * scale, (0, 1) for float frames
+	glm::vec3 getPositionOffset() const;
+
+	glm::vec3 getPositionScale() const;
+
+	// cpu and gpu memory held by the sequence in bytes
+	size_t getByteSize() const;
+
+	// draw frame a in attributes 0/1 and frame b in 3/4, a frame is only decoded and uploaded
+	// when no gpu slot holds it already; a streamed sequence also moves its playhead to frame a
+	void draw(size_t frameA, size_t frameB);
+
+private:
+	static const size_t kKeyframeInterval = 16;
+
+	// one vertex of a quantized frame on the gpu
+	struct QuantizedVertex {
+		uint16_t position[4];
+		int16_t normal[2];
+	};
+
+	// one vertex of a float frame on the gpu
+	struct FloatVertex {
+		glm::vec3 position;
+		glm::vec3 normal;
+	};
+
+	bool _quantized = false;
+
+	bool _deltaEncoded = false;
+
+	size_t _frameCount = 0;
+
+	size_t _vertexCount = 0;
+
+	size_t _indexCount = 0;
+
+	GLenum _indexType = GL_UNSIGNED_INT;
+
+	glm::vec3 _boundsMin = glm::vec3(0.0f);
+
+	glm::vec3 _boundsMax = glm::vec3(0.0f);
+
+	// encoded positions and normals of every frame
+	std::vector<std::vector<uint8_t>> _frames;
+
+	// last frame decoded on the cpu, delta frames decode from it when they follow it
+	std::vector<QuantizedVertex> _decoded;
+
+	size_t _decodedFrame = SIZE_MAX;
+
+	// opengl objects, the frame buffer holds two slots of _vertexCount vertices
+	GLuint _vao = 0;
+	GLuint _texCoordBuffer = 0;
+	GLuint _frameBuffer = 0;
+	GLuint _ebo = 0;
+
+	// frame held by each gpu slot, two of them unless streamed
+	std::vector<size_t> _slotFrames;
+
+	// slots bound to attributes 0/1 and 3/4
+	int _boundSlots[2] = { -1, -1 };
+
+	// a streamed frame on its way from the loader thread to a gpu slot
+	struct StreamSlot {
+		// Uploading while the render thread transfers the vertices it took out of the slot
+		enum class State { Empty, Loading, Ready, Uploading, Resident };
+		State state = State::Empty;
+		size_t frame = SIZE_MAX;
+		std::vector<FloatVertex> vertices;
+	};
+
+	bool _streamed = false;
+
+	std::string _pathPrefix;
+
+	// indices of the first frame as loaded, before the cache reordering; the other frames must match them
+	std::vector<uint32_t> _sourceIndices;
+
+	// the slots and counters below are shared with the loader thread and guarded by _streamMutex
+	std::vector<StreamSlot> _streamSlots;
+
+	size_t _playhead = 0;
+
+	bool _stopStream = false;
+
+	MeshSequenceStreamStats _streamStats;
+
+	mutable std::mutex _streamMutex;
+
+	std::condition_variable _streamCondition;
+
+	std::thread _streamThread;
+
+	// load, quantize and encode every frame, vertices and indices hold the first one
+	void loadFrames(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	size_t getGpuVertexSize() const;
+
+	void decode(size_t frame);
+
+	void upload(size_t frame, int slot);
+
+	void bindSlots(int slotA, int slotB);
+
+	// upload the frames the loader thread finished to their gpu slots
+	void uploadStreamedFrames();
+
+	// gpu slot holding frame, or -1
+	int findSlot(size_t frame) const;
+
+	void streamFrames();
+};
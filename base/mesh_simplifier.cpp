@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+
+#include "mesh_simplifier.h"
+
+namespace {
+	// symmetric 4x4 error quadric of a set of weighted planes
+	struct Quadric {
+		double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+		double weight = 0;
+
+		void addPlane(const glm::dvec3& n, double d, double w) {
+			a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+			a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+			b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q) {
+			a00 += q.a00; a01 += q.a01; a02 += q.a02;
+			a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			weight += q.weight;
+		}
+
+		// weighted mean of the squared distances to the planes
+		double evaluate(const glm::vec3& p) const {
+			double x = p.x, y = p.y, z = p.z;
+			double e = a00 * x * x + a11 * y * y + a22 * z * z
+				+ 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+				+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+			return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+		}
+	};
+
+	struct Collapse {
+		double cost;
+		uint32_t from;
+		uint32_t to;
+	};
+
+	bool flips(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& moved) {
+		glm::vec3 before = glm::cross(b - a, c - a);
+		glm::vec3 after = glm::cross(b - moved, c - moved);
+		return glm::dot(before, after) <= 0.0f;
+	}
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* error) {
+	std::vector<uint32_t> result(indices);
+	const size_t vertexCount = vertices.size();
+
+	// quadrics of the planes around every vertex, weighted by triangle area
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i + 2 < result.size(); i += 3) {
+		const glm::dvec3 a(vertices[result[i + 0]].position);
+		const glm::dvec3 b(vertices[result[i + 1]].position);
+		const glm::dvec3 c(vertices[result[i + 2]].position);
+		glm::dvec3 n = glm::cross(b - a, c - a);
+		double length = glm::length(n);
+		if (length <= 0.0) {
+			continue;
+		}
+		n /= length;
+		double d = -glm::dot(n, a);
+		for (int k = 0; k < 3; ++k) {
+			quadrics[result[i + k]].addPlane(n, d, 0.5 * length);
+		}
+	}
+
+	double maxError = 0.0;
+	std::vector<uint32_t> offsets(vertexCount + 1), triangles, fill;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> locked(vertexCount), touched(vertexCount);
+	std::vector<uint32_t> mark(vertexCount, 0xffffffffu);
+	std::vector<uint32_t> ring;
+	std::vector<Collapse> collapses;
+
+	while (result.size() > targetIndexCount) {
+		// triangles around every vertex
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint32_t v : result) {
+			++offsets[v + 1];
+		}
+		for (size_t v = 0; v < vertexCount; ++v) {
+			offsets[v + 1] += offsets[v];
+		}
+		triangles.resize(result.size());
+		fill.assign(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); ++i) {
+			triangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// a ring is closed when every neighbor is shared by exactly two of the triangles around the vertex
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			ring.clear();
+			for (uint32_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				for (int c = 0; c < 3; ++c) {
+					if (t[c] != v) {
+						ring.push_back(t[c]);
+					}
+				}
+			}
+			std::sort(ring.begin(), ring.end());
+			bool closed = !ring.empty() && ring.size() % 2 == 0;
+			for (size_t i = 0; closed && i < ring.size(); i += 2) {
+				closed = ring[i] == ring[i + 1] && (i + 2 >= ring.size() || ring[i + 2] != ring[i]);
+			}
+			locked[v] = !closed;
+		}
+
+		// cheapest collapse of every free vertex onto one of its neighbors
+		collapses.clear();
+		for (uint32_t u = 0; u < vertexCount; ++u) {
+			if (locked[u] || offsets[u] == offsets[u + 1]) {
+				continue;
+			}
+
+			Collapse best = { -1.0, u, u };
+			for (uint32_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				for (int c = 0; c < 3; ++c) {
+					uint32_t v = t[c];
+					if (v == u) {
+						continue;
+					}
+					Quadric q = quadrics[u];
+					q.add(quadrics[v]);
+					double cost = q.evaluate(vertices[v].position);
+					if (best.cost < 0.0 || cost < best.cost) {
+						best = { cost, u, v };
+					}
+				}
+			}
+			if (best.to != u) {
+				collapses.push_back(best);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// apply the cheapest collapses whose neighborhoods do not overlap
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removed = 0;
+		const size_t budget = (result.size() - targetIndexCount) / 3;
+		for (const Collapse& collapse : collapses) {
+			if (removed >= budget) {
+				break;
+			}
+			const uint32_t u = collapse.from, v = collapse.to;
+			if (touched[u] || touched[v]) {
+				continue;
+			}
+
+			// link condition: an interior edge has exactly two common neighbors, more would pinch the surface
+			bool valid = true;
+			for (uint32_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				for (int c = 0; c < 3; ++c) {
+					valid = valid && !touched[t[c]];
+					mark[t[c]] = u;
+				}
+			}
+			size_t common = 0;
+			for (uint32_t k = offsets[v]; k < offsets[v + 1] && valid; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				for (int c = 0; c < 3; ++c) {
+					if (t[c] != u && t[c] != v && mark[t[c]] == u) {
+						mark[t[c]] = 0xfffffffeu;
+						++common;
+					}
+				}
+			}
+			if (!valid || common != 2) {
+				for (uint32_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+					const uint32_t* t = &result[3 * triangles[k]];
+					mark[t[0]] = mark[t[1]] = mark[t[2]] = 0xffffffffu;
+				}
+				continue;
+			}
+
+			// the triangles that survive must not turn over
+			for (uint32_t k = offsets[u]; k < offsets[u + 1] && valid; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				if (t[0] == v || t[1] == v || t[2] == v) {
+					continue;
+				}
+				int c = t[0] == u ? 0 : (t[1] == u ? 1 : 2);
+				valid = !flips(vertices[t[c]].position, vertices[t[(c + 1) % 3]].position,
+					vertices[t[(c + 2) % 3]].position, vertices[v].position);
+			}
+
+			for (uint32_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+				const uint32_t* t = &result[3 * triangles[k]];
+				mark[t[0]] = mark[t[1]] = mark[t[2]] = 0xffffffffu;
+				if (valid) {
+					touched[t[0]] = touched[t[1]] = touched[t[2]] = true;
+				}
+			}
+			if (!valid) {
+				continue;
+			}
+
+			remap[u] = v;
+			quadrics[v].add(quadrics[u]);
+			maxError = std::max(maxError, collapse.cost);
+			removed += 2;
+		}
+
+		if (removed == 0) {
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i + 2 < result.size(); i += 3) {
+			uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a != b && b != c && a != c) {
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	*error = static_cast<float>(std::sqrt(maxError));
+	return result;
+}
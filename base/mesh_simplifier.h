@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// simplify a triangle list towards targetIndexCount indices with quadric error metric edge collapses
+// (Garland and Heckbert 1997), the result indexes the same vertex array; a vertex whose triangle ring
+// is open in index space (mesh borders, uv and normal seams where vertices are split) is never moved,
+// so seams and borders keep their exact shape; error receives the largest collapse error as a distance
+// in model units
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* error);
@@ -1,11 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
-#include <unordered_map>
+
+#include <glm/gtc/packing.hpp>
 
 //#include <tiny_obj_loader.h>
 #include "my_obj_loader.h"
+#include "gl_state.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
 
 #include "model.h"
 
+namespace {
+	const uint32_t kVertexChunk = MESH_CACHE_TAG('V', 'T', 'X', '0');
+	const uint32_t kIndexChunk = MESH_CACHE_TAG('I', 'D', 'X', '0');
+	const uint32_t kBoundsChunk = MESH_CACHE_TAG('A', 'A', 'B', 'B');
+	const uint32_t kFlagsChunk = MESH_CACHE_TAG('F', 'L', 'G', '0');
+	// level count, then error and index count of every level, then the indices of all levels
+	const uint32_t kLodChunk = MESH_CACHE_TAG('L', 'O', 'D', '0');
+
+	// bits of the flags chunk
+	const uint32_t kOptimizedFlag = 1u << 0;
+	const uint32_t kLodsBuiltFlag = 1u << 1;
+
+	// every level halves the triangles of the previous one
+	const size_t kMaxLods = 6;
+	const size_t kMinLodTriangles = 64;
+
+	bool indicesInRange(const uint32_t* indices, size_t count, size_t vertexCount) {
+		for (size_t i = 0; i < count; ++i) {
+			if (indices[i] >= vertexCount) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	PackedVertex packVertex(const Vertex& vertex, const glm::vec3& offset, const glm::vec3& invScale, bool unormTexCoord) {
+		PackedVertex packed;
+		glm::vec3 position = glm::clamp((vertex.position - offset) * invScale, 0.0f, 1.0f);
+		packed.position[0] = static_cast<uint16_t>(std::lround(position.x * 65535.0f));
+		packed.position[1] = static_cast<uint16_t>(std::lround(position.y * 65535.0f));
+		packed.position[2] = static_cast<uint16_t>(std::lround(position.z * 65535.0f));
+		packed.position[3] = 0;
+
+		glm::vec2 normal = octEncode(vertex.normal);
+		packed.normal[0] = static_cast<int16_t>(std::lround(normal.x * 32767.0f));
+		packed.normal[1] = static_cast<int16_t>(std::lround(normal.y * 32767.0f));
+
+		if (unormTexCoord) {
+			packed.texCoord[0] = static_cast<uint16_t>(std::lround(vertex.texCoord.x * 65535.0f));
+			packed.texCoord[1] = static_cast<uint16_t>(std::lround(vertex.texCoord.y * 65535.0f));
+		} else {
+			packed.texCoord[0] = static_cast<uint16_t>(glm::packHalf1x16(vertex.texCoord.x));
+			packed.texCoord[1] = static_cast<uint16_t>(glm::packHalf1x16(vertex.texCoord.y));
+		}
+		return packed;
+	}
+
+	// append a triangle list to the gpu element buffer as 16-bit indices: when the mesh has up to 65536
+	// vertices they index the vertex buffer directly, otherwise the list is cut in draw order into ranges of
+	// at most 65536 distinct vertices, each drawing from its own contiguous block appended to gpuVertices,
+	// which lists the source vertex of every gpu vertex (vertices shared by two ranges are duplicated)
+	void appendIndexBuffer(const uint32_t* indices, size_t count, size_t vertexCount,
+		std::vector<uint16_t>* data, std::vector<IndexRange>* ranges, std::vector<uint32_t>* gpuVertices) {
+		const size_t first = data->size();
+		data->resize(first + count);
+
+		IndexRange range;
+		range.offset = first * sizeof(uint16_t);
+		if (vertexCount <= 0x10000) {
+			for (size_t i = 0; i < count; ++i) {
+				(*data)[first + i] = static_cast<uint16_t>(indices[i]);
+			}
+			range.count = static_cast<GLsizei>(count);
+			ranges->push_back(range);
+			return;
+		}
+
+		// local index of every source vertex inside the current range
+		const uint32_t unused = 0xffffffffu;
+		std::vector<uint32_t> local(vertexCount, unused);
+		range.baseVertex = static_cast<GLint>(gpuVertices->size());
+		size_t rangeBegin = 0;
+		for (size_t t = 0; t < count; t += 3) {
+			size_t added = 0;
+			for (size_t c = 0; c < 3; ++c) {
+				added += local[indices[t + c]] == unused;
+			}
+
+			if (gpuVertices->size() - range.baseVertex + added > 0x10000) {
+				range.count = static_cast<GLsizei>(t - rangeBegin);
+				ranges->push_back(range);
+				for (size_t i = range.baseVertex; i < gpuVertices->size(); ++i) {
+					local[(*gpuVertices)[i]] = unused;
+				}
+				rangeBegin = t;
+				range.offset = (first + t) * sizeof(uint16_t);
+				range.baseVertex = static_cast<GLint>(gpuVertices->size());
+			}
+
+			for (size_t c = 0; c < 3; ++c) {
+				uint32_t v = indices[t + c];
+				if (local[v] == unused) {
+					local[v] = static_cast<uint32_t>(gpuVertices->size() - range.baseVertex);
+					gpuVertices->push_back(v);
+				}
+				(*data)[first + t + c] = static_cast<uint16_t>(local[v]);
+			}
+		}
+		range.count = static_cast<GLsizei>(count - rangeBegin);
+		ranges->push_back(range);
+	}
+
+	// open addressing map from an obj (position, normal, texcoord) index triple to its vertex,
+	// slots live in one flat array so a lookup touches a single cache line
+	class IndexTripleMap {
+	public:
+		explicit IndexTripleMap(size_t expectedCount) {
+			size_t capacity = 16;
+			while (capacity < expectedCount * 2) {
+				capacity <<= 1;
+			}
+			_slots.assign(capacity, Slot{ 0, 0, 0, kEmpty });
+		}
+
+		// returns the vertex of the triple, or stores value for it and returns value
+		uint32_t findOrInsert(const index_t& index, uint32_t value) {
+			if ((_count + 1) * 2 > _slots.size()) {
+				grow();
+			}
+
+			size_t mask = _slots.size() - 1;
+			for (size_t i = hash(index) & mask;; i = (i + 1) & mask) {
+				Slot& slot = _slots[i];
+				if (slot.value == kEmpty) {
+					slot = Slot{ index.vertex_index, index.normal_index, index.texcoord_index, value };
+					++_count;
+					return value;
+				}
+				if (slot.v == index.vertex_index && slot.n == index.normal_index && slot.t == index.texcoord_index) {
+					return slot.value;
+				}
+			}
+		}
+
+	private:
+		static const uint32_t kEmpty = 0xffffffffu;
+
+		struct Slot {
+			int v, n, t;
+			uint32_t value;
+		};
+
+		std::vector<Slot> _slots;
+		size_t _count = 0;
+
+		static size_t hash(const index_t& index) {
+			uint64_t h = (uint64_t)(uint32_t)index.vertex_index * 0x9e3779b97f4a7c15ull;
+			h ^= (uint64_t)(uint32_t)index.normal_index * 0xc2b2ae3d27d4eb4full;
+			h ^= (uint64_t)(uint32_t)index.texcoord_index * 0x165667b19e3779f9ull;
+			h ^= h >> 29;
+			h *= 0xbf58476d1ce4e5b9ull;
+			return (size_t)(h ^ (h >> 32));
+		}
+
+		void grow() {
+			std::vector<Slot> slots(_slots.size() * 2, Slot{ 0, 0, 0, kEmpty });
+			size_t mask = slots.size() - 1;
+			for (const Slot& slot : _slots) {
+				if (slot.value == kEmpty) {
+					continue;
+				}
+				size_t i = hash(index_t{ slot.v, slot.n, slot.t }) & mask;
+				while (slots[i].value != kEmpty) {
+					i = (i + 1) & mask;
+				}
+				slots[i] = slot;
+			}
+			_slots.swap(slots);
+		}
+	};
+}
+
+void loadObjMesh(const std::string& filepath, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices) {
+	//tinyobj::attrib_t attrib;
+	attrib_t attrib;
+	//std::vector<tinyobj::shape_t> shapes;
+	std::vector<shape_t> shapes;
+	//std::vector<tinyobj::material_t> materials;
+
+	std::string err;
+	//std::string::size_type index = filepath.find_last_of("/");
+	//std::string mtlBaseDir = filepath.substr(0, index + 1);
+
+	//if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), mtlBaseDir.c_str())) {
+	//	throw std::runtime_error("load " + filepath + " failure: " + err);
+	//}
+	if (!LoadObjParallel(&attrib, &shapes, &err, filepath.c_str())) {
+		throw std::runtime_error("load " + filepath + " failure: " + err);
+	}
+
+	if (!err.empty()) {
+		std::cerr << err << std::endl;
+	}
+
+	size_t cornerCount = 0;
+	for (const auto& shape : shapes) {
+		cornerCount += shape.mesh.indices.size();
+	}
+
+	// corners sharing an index triple share a vertex, closed meshes have about
+	// half as many vertices as faces, i.e. one per six corners
+	IndexTripleMap uniqueVertices(std::max(attrib.vertices.size() / 3, cornerCount / 6));
+	vertices->clear();
+	indices->clear();
+	indices->reserve(cornerCount);
+
+	for (const auto& shape : shapes) {
+		for (const auto& index : shape.mesh.indices) {
+			uint32_t nextVertex = static_cast<uint32_t>(vertices->size());
+			uint32_t vertexIndex = uniqueVertices.findOrInsert(index, nextVertex);
+			indices->push_back(vertexIndex);
+
+			if (vertexIndex != nextVertex) {
+				continue;
+			}
+
+			Vertex vertex{};
+
+			vertex.position.x = attrib.vertices[3 * index.vertex_index + 0];
+			vertex.position.y = attrib.vertices[3 * index.vertex_index + 1];
+			vertex.position.z = attrib.vertices[3 * index.vertex_index + 2];
+
+			if (index.normal_index >= 0) {
+				vertex.normal.x = attrib.normals[3 * index.normal_index + 0];
+				vertex.normal.y = attrib.normals[3 * index.normal_index + 1];
+				vertex.normal.z = attrib.normals[3 * index.normal_index + 2];
+			}
+
+			if (index.texcoord_index >= 0) {
+				vertex.texCoord.x = attrib.texcoords[2 * index.texcoord_index + 0];
+				vertex.texCoord.y = attrib.texcoords[2 * index.texcoord_index + 1];
+			}
+
+			vertices->push_back(vertex);
+		}
+	}
+}
+
 void Model::addFace(std::vector<Vertex> & vertices,int pd)
 {
 	Vertex vertex{};
@@ -36,7 +282,14 @@ void Model::addFace(std::vector<Vertex> & vertices,int pd)
 
 }
 
-Model::Model(const std::string& filepath) {
+Model::Model(const std::string& filepath, const ModelOptions& options)
+	: _deferUpload(options.deferUpload), _arena(options.arena), _packed(options.packVertices), _buildClusters(options.buildClusters) {
+	// a valid .meshbin next to the obj file skips parsing and deduplication
+	if (loadCache(filepath, options)) {
+		_bvh.build(_vertices, _indices);
+		return;
+	}
+
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 
@@ -89,84 +342,51 @@ Model::Model(const std::string& filepath) {
 	}
 	else
 	{
-		//tinyobj::attrib_t attrib;
-		attrib_t attrib;
-		//std::vector<tinyobj::shape_t> shapes;
-		std::vector<shape_t> shapes;
-		//std::vector<tinyobj::material_t> materials;
-
-		std::string err;
-		std::string::size_type index = filepath.find_last_of("/");
-		//std::string mtlBaseDir = filepath.substr(0, index + 1);
-
-		//if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), mtlBaseDir.c_str())) {
-		//	throw std::runtime_error("load " + filepath + " failure: " + err);
-		//}
-		if (!LoadObj(&attrib, &shapes, &err, filepath.c_str())) {
-			throw std::runtime_error("load " + filepath + " failure: " + err);
-		}
-
-		if (!err.empty()) {
-			std::cerr << err << std::endl;
+		loadObjMesh(filepath, &vertices, &indices);
+		for (const Vertex& vertex : vertices) {
+			if (vertex.position.x > maxx) maxx = vertex.position.x;
+			if (vertex.position.x < minx) minx = vertex.position.x;
+			if (vertex.position.y > maxy) maxy = vertex.position.y;
+			if (vertex.position.y < miny) miny = vertex.position.y;
+			if (vertex.position.z > maxz) maxz = vertex.position.z;
+			if (vertex.position.z < minz) minz = vertex.position.z;
 		}
+	}
 
+	_vertices = std::move(vertices);
+	_indices = std::move(indices);
 
-		std::unordered_map<Vertex, uint32_t> uniqueVertices;
-
-		for (const auto& shape : shapes) {
-			//std::vector< std::vector< int > > curFaceIndices;
-			for (const auto& index : shape.mesh.indices) {
-
-				Vertex vertex{};
-
-				vertex.position.x = attrib.vertices[3 * index.vertex_index + 0];
-				vertex.position.y = attrib.vertices[3 * index.vertex_index + 1];
-				vertex.position.z = attrib.vertices[3 * index.vertex_index + 2];
-				if (vertex.position.x > maxx) maxx = vertex.position.x;
-				if (vertex.position.x < minx) minx = vertex.position.x;
-				if (vertex.position.y > maxy) maxy = vertex.position.y;
-				if (vertex.position.y < miny) miny = vertex.position.y;
-				if (vertex.position.z > maxz) maxz = vertex.position.z;
-				if (vertex.position.z < minz) minz = vertex.position.z;
-
-				if (index.normal_index >= 0) {
-					vertex.normal.x = attrib.normals[3 * index.normal_index + 0];
-					vertex.normal.y = attrib.normals[3 * index.normal_index + 1];
-					vertex.normal.z = attrib.normals[3 * index.normal_index + 2];
-				}
-
-				if (index.texcoord_index >= 0) {
-					vertex.texCoord.x = attrib.texcoords[2 * index.texcoord_index + 0];
-					vertex.texCoord.y = attrib.texcoords[2 * index.texcoord_index + 1];
-				}
+	if (options.optimizeMesh) {
+		optimize(filepath);
+	}
 
-				// check if the vertex appeared before to reduce redundant data
-				if (uniqueVertices.count(vertex) == 0) {
-					uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-					vertices.push_back(vertex);
-				}
+	if (options.generateLods) {
+		buildLods();
+	}
 
-				indices.push_back(uniqueVertices[vertex]);
-				//std::vector< int > curIndex = { index.vertex_index, index.texcoord_index, index.normal_index };
-				//curFaceIndices.push_back(curIndex);
+	initGLResources();
 
-			}
-			//_faceIndices.push_back(curFaceIndices);
-		}
+	if (filepath != "Sphere_built" && filepath != "Cube_built") {
+		saveCache(filepath);
 	}
 
-	_vertices = vertices;
-	_indices = indices;
-	
-	initGLResources();
+	// built with the mesh, on the loader's worker for asynchronous loads, so no query waits for it
+	_bvh.build(_vertices, _indices);
 }
 
 Model::Model(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
 	: _vertices(vertices), _indices(indices) {
 	initGLResources();
+	_bvh.build(_vertices, _indices);
 }
 
 Model::~Model() {
+	if (_inArena) {
+		_arena->freeVertices(getVertexFormat(), _firstVertex, _gpuVertexCount);
+		_arena->freeIndices(_firstIndex, _arenaIndexCount);
+		_inArena = false;
+	}
+
 	if (_ebo != 0) {
 		glDeleteBuffers(1, &_ebo);
 		_ebo = 0;
@@ -178,19 +398,99 @@ Model::~Model() {
 	}
 
 	if (_vao != 0) {
+		GLStateCache::instance().forgetVertexArray(_vao);
 		glDeleteVertexArrays(1, &_vao);
 		_vao = 0;
 	}
 }
 
-void Model::draw() const {
-	glBindVertexArray(_vao);
-	glDrawElements(GL_TRIANGLES, (GLsizei)_indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+void Model::draw(size_t lod) const {
+	lod = std::min(lod, getLodCount() - 1);
+
+	// the vertex array stays bound, the next model of the arena draws without binding it again
+	GLStateCache::instance().bindVertexArray(getVertexArrayObject());
+	for (size_t i = _lodRanges[lod]; i < _lodRanges[lod + 1]; ++i) {
+		const IndexRange& range = _indexRanges[i];
+		const size_t offset = _firstIndex * sizeof(uint16_t) + range.offset;
+		const GLint baseVertex = static_cast<GLint>(_firstVertex) + range.baseVertex;
+		if (baseVertex == 0) {
+			glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_SHORT, (void*)offset);
+		} else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_SHORT, (void*)offset, baseVertex);
+		}
+	}
+}
+
+void Model::drawInstanced(size_t lod, const InstanceBuffer& instances, size_t first, size_t count) const {
+	lod = std::min(lod, getLodCount() - 1);
+
+	GLStateCache::instance().bindVertexArray(getVertexArrayObject());
+	instances.enableAttributes(first);
+	for (size_t i = _lodRanges[lod]; i < _lodRanges[lod + 1]; ++i) {
+		const IndexRange& range = _indexRanges[i];
+		const size_t offset = _firstIndex * sizeof(uint16_t) + range.offset;
+		const GLint baseVertex = static_cast<GLint>(_firstVertex) + range.baseVertex;
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_SHORT, (void*)offset,
+			static_cast<GLsizei>(count), baseVertex);
+	}
+	InstanceBuffer::disableAttributes();
+}
+
+bool Model::hasClusters() const {
+	return _clusters.size() > 1;
+}
+
+void Model::drawClusters(const Object3D& transform, const glm::mat4& viewProjection, const glm::vec3& cameraPosition,
+	ClusterCullStats* stats) const {
+	if (_clusters.empty()) {
+		draw(0);
+		return;
+	}
+
+	// cull in model space, the frustum planes and the camera are brought there instead
+	const glm::mat4 modelMatrix = transform.getModelMatrix();
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection * modelMatrix, planes);
+	const glm::vec3 localCamera = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+
+	// neighbouring visible clusters are merged into one draw
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	std::vector<GLint> baseVertices;
+	size_t runEnd = 0;
+	stats->clusters += _clusters.size();
+	stats->trianglesTotal += _indices.size() / 3;
+	for (const MeshCluster& cluster : _clusters) {
+		if (clusterOutsideFrustum(cluster, planes)) {
+			++stats->frustumCulled;
+			continue;
+		}
+		if (clusterBackfacing(cluster, localCamera)) {
+			++stats->backfaceCulled;
+			continue;
+		}
+
+		stats->trianglesSubmitted += cluster.indexCount / 3;
+		if (!counts.empty() && runEnd == cluster.firstIndex &&
+			baseVertices.back() == static_cast<GLint>(_firstVertex) + cluster.baseVertex) {
+			counts.back() += static_cast<GLsizei>(cluster.indexCount);
+		} else {
+			counts.push_back(static_cast<GLsizei>(cluster.indexCount));
+			offsets.push_back((const void*)((_firstIndex + cluster.firstIndex) * sizeof(uint16_t)));
+			baseVertices.push_back(static_cast<GLint>(_firstVertex) + cluster.baseVertex);
+		}
+		runEnd = cluster.firstIndex + cluster.indexCount;
+	}
+
+	if (!counts.empty()) {
+		GLStateCache::instance().bindVertexArray(getVertexArrayObject());
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_SHORT, offsets.data(),
+			static_cast<GLsizei>(counts.size()), baseVertices.data());
+	}
 }
 
 GLuint Model::getVertexArrayObject() const {
-	return _vao;
+	return _inArena ? _arena->getVertexArray(getVertexFormat()) : _vao;
 }
 
 size_t Model::getVertexCount() const {
@@ -201,44 +501,435 @@ size_t Model::getFaceCount() const {
 	return _indices.size() / 3;
 }
 
+bool Model::isPacked() const {
+	return _packed;
+}
+
+glm::vec3 Model::getPositionOffset() const {
+	return _packed ? glm::vec3(minx, miny, minz) : glm::vec3(0.0f);
+}
+
+glm::vec3 Model::getPositionScale() const {
+	return _packed ? glm::vec3(maxx - minx, maxy - miny, maxz - minz) : glm::vec3(1.0f);
+}
+
+size_t Model::getLodCount() const {
+	return _lods.size() + 1;
+}
+
+const std::vector<uint32_t>& Model::getLodIndices(size_t lod) const {
+	lod = std::min(lod, getLodCount() - 1);
+	return lod == 0 ? _indices : _lods[lod - 1].indices;
+}
+
+size_t Model::selectLod(const Object3D& transform, const glm::vec3& cameraPosition, float pixelsPerUnit,
+	float maxPixels) const {
+	if (_lods.empty()) {
+		return 0;
+	}
+
+	// distance to the bounding sphere of the transformed aabb
+	const glm::vec3 lo(minx, miny, minz), hi(maxx, maxy, maxz);
+	const glm::vec3 center = glm::vec3(transform.getModelMatrix() * glm::vec4(0.5f * (lo + hi), 1.0f));
+	const glm::vec3& scale = transform.scale;
+	const float maxScale = std::max(std::abs(scale.x), std::max(std::abs(scale.y), std::abs(scale.z)));
+	const float radius = 0.5f * glm::length(hi - lo) * maxScale;
+	const float distance = glm::length(cameraPosition - center) - radius;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	size_t lod = 0;
+	while (lod < _lods.size() && _lods[lod].error * maxScale * pixelsPerUnit <= maxPixels * distance) {
+		++lod;
+	}
+	return lod;
+}
+
+size_t Model::getGpuVertexCount() const {
+	return _gpuVertexCount;
+}
+
+size_t Model::getByteSize() const {
+	size_t bytes = _vertices.size() * sizeof(Vertex) + _indices.size() * sizeof(uint32_t);
+	for (const ModelLod& lod : _lods) {
+		bytes += lod.indices.size() * sizeof(uint32_t);
+	}
+
+	bytes += _gpuVertexCount * (_packed ? sizeof(PackedVertex) : sizeof(Vertex));
+	for (const IndexRange& range : _indexRanges) {
+		bytes += range.count * sizeof(uint16_t);
+	}
+	return bytes;
+}
+
+bool Model::loadCache(const std::string& filepath, const ModelOptions& options) {
+	MeshCache cache;
+	if (!cache.open(filepath)) {
+		return false;
+	}
+
+	size_t vertexBytes, indexBytes, boundsBytes;
+	const void* vertexData = cache.chunk(kVertexChunk, &vertexBytes);
+	const void* indexData = cache.chunk(kIndexChunk, &indexBytes);
+	const void* boundsData = cache.chunk(kBoundsChunk, &boundsBytes);
+	if (vertexData == nullptr || indexData == nullptr || boundsData == nullptr ||
+		vertexBytes % sizeof(Vertex) != 0 || indexBytes % (3 * sizeof(uint32_t)) != 0 ||
+		boundsBytes != 6 * sizeof(float)) {
+		return false;
+	}
+
+	// a damaged file must not make the draws read past the vertex buffer
+	const Vertex* vertexBegin = static_cast<const Vertex*>(vertexData);
+	const uint32_t* indexBegin = static_cast<const uint32_t*>(indexData);
+	const size_t vertexCount = vertexBytes / sizeof(Vertex);
+	const size_t indexCount = indexBytes / sizeof(uint32_t);
+	if (!indicesInRange(indexBegin, indexCount, vertexCount)) {
+		return false;
+	}
+
+	_vertices.assign(vertexBegin, vertexBegin + vertexCount);
+	_indices.assign(indexBegin, indexBegin + indexCount);
+
+	const float* bounds = static_cast<const float*>(boundsData);
+	minx = bounds[0]; miny = bounds[1]; minz = bounds[2];
+	maxx = bounds[3]; maxy = bounds[4]; maxz = bounds[5];
+
+	size_t flagsBytes;
+	const void* flagsData = cache.chunk(kFlagsChunk, &flagsBytes);
+	uint32_t flags = 0;
+	if (flagsData != nullptr && flagsBytes == sizeof(uint32_t)) {
+		std::memcpy(&flags, flagsData, sizeof(uint32_t));
+	}
+	_optimized = (flags & kOptimizedFlag) != 0;
+
+	// cached levels of detail are left in the file when they are turned off, so -nolod draws the full mesh
+	_lodsBuilt = options.generateLods && (flags & kLodsBuiltFlag) != 0;
+
+	size_t lodBytes;
+	const uint8_t* lodData = static_cast<const uint8_t*>(cache.chunk(kLodChunk, &lodBytes));
+	if (_lodsBuilt && lodData != nullptr && lodBytes >= sizeof(uint32_t)) {
+		uint32_t lodCount;
+		std::memcpy(&lodCount, lodData, sizeof(uint32_t));
+		size_t offset = sizeof(uint32_t) + lodCount * (sizeof(float) + sizeof(uint32_t));
+		for (uint32_t i = 0; i < lodCount && offset <= lodBytes; ++i) {
+			const uint8_t* entry = lodData + sizeof(uint32_t) + i * (sizeof(float) + sizeof(uint32_t));
+			ModelLod lod;
+			uint32_t indexCount;
+			std::memcpy(&lod.error, entry, sizeof(float));
+			std::memcpy(&indexCount, entry + sizeof(float), sizeof(uint32_t));
+			if (offset + indexCount * sizeof(uint32_t) > lodBytes) {
+				break;
+			}
+			lod.indices.resize(indexCount);
+			std::memcpy(lod.indices.data(), lodData + offset, indexCount * sizeof(uint32_t));
+			offset += indexCount * sizeof(uint32_t);
+			if (!indicesInRange(lod.indices.data(), indexCount, vertexCount)) {
+				break;
+			}
+			_lods.push_back(std::move(lod));
+		}
+		_lodsBuilt = _lods.size() == lodCount;
+	}
+
+	// missing processing is done once on the cached mesh and written back, present processing serves both cases
+	bool rewrite = false;
+	if (options.optimizeMesh && !_optimized) {
+		// renumbers the vertices, the levels of detail have to follow
+		optimize(filepath);
+		_lods.clear();
+		_lodsBuilt = false;
+		rewrite = true;
+	}
+	if (options.generateLods && !_lodsBuilt) {
+		buildLods();
+		rewrite = true;
+	}
+	if (rewrite) {
+		cache.close();
+		initGLResources();
+		saveCache(filepath);
+		return true;
+	}
+
+	// upload straight from the mapping, the copies above are only kept for cpu side use
+	initGLResources(vertexData, indexData);
+
+	return true;
+}
+
+void Model::optimize(const std::string& filepath) {
+	VertexCacheStats before = analyzeVertexCache(_indices, _vertices.size());
+
+	optimizeVertexCache(_indices, _vertices.size());
+	optimizeOverdraw(_indices, _vertices);
+	optimizeVertexFetch(_vertices, _indices);
+	_optimized = true;
+
+	VertexCacheStats after = analyzeVertexCache(_indices, _vertices.size());
+	std::cout << "optimized " << filepath << ": ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+void Model::buildLods() {
+	_lods.clear();
+	_lodsBuilt = true;
+
+	float error = 0.0f;
+	while (_lods.size() < kMaxLods) {
+		const std::vector<uint32_t>& source = _lods.empty() ? _indices : _lods.back().indices;
+		size_t target = source.size() / 6 * 3;
+		if (target < 3 * kMinLodTriangles) {
+			break;
+		}
+
+		float levelError;
+		std::vector<uint32_t> indices = simplifyMesh(_vertices, source, target, &levelError);
+		// seams and borders never collapse, stop once they are all that is left
+		if (indices.size() > source.size() * 4 / 5) {
+			break;
+		}
+
+		if (_optimized) {
+			optimizeVertexCache(indices, _vertices.size());
+		}
+
+		// each level is simplified from the previous one, their errors add up at worst
+		error += levelError;
+		_lods.push_back(ModelLod{ std::move(indices), error });
+	}
+}
+
+void Model::saveCache(const std::string& filepath) const {
+	const float bounds[6] = { minx, miny, minz, maxx, maxy, maxz };
+	const uint32_t flags = (_optimized ? kOptimizedFlag : 0) | (_lodsBuilt ? kLodsBuiltFlag : 0);
+
+	std::vector<uint8_t> lodData(sizeof(uint32_t) + _lods.size() * (sizeof(float) + sizeof(uint32_t)));
+	const uint32_t lodCount = static_cast<uint32_t>(_lods.size());
+	std::memcpy(lodData.data(), &lodCount, sizeof(uint32_t));
+	for (size_t i = 0; i < _lods.size(); ++i) {
+		uint8_t* entry = lodData.data() + sizeof(uint32_t) + i * (sizeof(float) + sizeof(uint32_t));
+		const uint32_t indexCount = static_cast<uint32_t>(_lods[i].indices.size());
+		std::memcpy(entry, &_lods[i].error, sizeof(float));
+		std::memcpy(entry + sizeof(float), &indexCount, sizeof(uint32_t));
+		const uint8_t* indices = reinterpret_cast<const uint8_t*>(_lods[i].indices.data());
+		lodData.insert(lodData.end(), indices, indices + indexCount * sizeof(uint32_t));
+	}
+
+	std::vector<MeshCacheChunk> chunks = {
+		{ kVertexChunk, _vertices.data(), _vertices.size() * sizeof(Vertex) },
+		{ kIndexChunk, _indices.data(), _indices.size() * sizeof(uint32_t) },
+		{ kBoundsChunk, bounds, sizeof(bounds) },
+		{ kFlagsChunk, &flags, sizeof(flags) },
+		{ kLodChunk, lodData.data(), lodData.size() },
+	};
+
+	if (!MeshCache::write(filepath, chunks)) {
+		std::cerr << "cannot write mesh cache " << MeshCache::cachePath(filepath) << std::endl;
+	}
+}
+
 void Model::initGLResources() {
-	// create a vertex array object
-	glGenVertexArrays(1, &_vao);
-	// create a vertex buffer object
-	glGenBuffers(1, &_vbo);
-	// create a element array buffer
-	glGenBuffers(1, &_ebo);
+	initGLResources(_vertices.data(), _indices.data());
+}
+
+void Model::initGLResources(const void* vertexData, const void* indexData) {
+	// a deferred upload outlives the mapped cache file, the cpu copies hold the same data
+	if (_deferUpload) {
+		vertexData = _vertices.data();
+		indexData = _indices.data();
+	}
 
-	glBindVertexArray(_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * _vertices.size(), _vertices.data(), GL_STATIC_DRAW);
+	_pending.reset(new PendingUpload);
+
+	// every level of detail shares the vertex buffer, their index lists follow each other in one element buffer
+	std::vector<uint16_t>& indexBuffer = _pending->indices;
+	std::vector<uint32_t> gpuVertices;
+	_indexRanges.clear();
+	_lodRanges.assign(1, 0);
+	for (size_t lod = 0; lod < getLodCount(); ++lod) {
+		const uint32_t* indices = lod == 0 ? static_cast<const uint32_t*>(indexData) : _lods[lod - 1].indices.data();
+		size_t count = lod == 0 ? _indices.size() : _lods[lod - 1].indices.size();
+		appendIndexBuffer(indices, count, _vertices.size(), &indexBuffer, &_indexRanges, &gpuVertices);
+		_lodRanges.push_back(_indexRanges.size());
+	}
+
+	// clusters never straddle two ranges of the full mesh, which comes first in the element buffer
+	_clusters.clear();
+	for (size_t i = _lodRanges[0]; _buildClusters && i < _lodRanges[1]; ++i) {
+		const IndexRange& range = _indexRanges[i];
+		size_t begin = range.offset / sizeof(uint16_t);
+		size_t clusterBegin = _clusters.size();
+		buildClusters(_vertices, static_cast<const uint32_t*>(indexData), begin, begin + range.count, &_clusters);
+		for (size_t c = clusterBegin; c < _clusters.size(); ++c) {
+			_clusters[c].baseVertex = range.baseVertex;
+		}
+	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(uint32_t), _indices.data(), GL_STATIC_DRAW);
+	// meshes split into several ranges duplicate the vertices shared between ranges
+	const Vertex* vertices = static_cast<const Vertex*>(vertexData);
+	std::vector<Vertex> gathered;
+	if (!gpuVertices.empty()) {
+		gathered.resize(gpuVertices.size());
+		for (size_t i = 0; i < gpuVertices.size(); ++i) {
+			gathered[i] = vertices[gpuVertices[i]];
+		}
+		vertices = gathered.data();
+	}
+	_gpuVertexCount = gpuVertices.empty() ? _vertices.size() : gpuVertices.size();
+
+	if (_packed) {
+		const glm::vec3 offset = getPositionOffset();
+		const glm::vec3 scale = getPositionScale();
+		const glm::vec3 invScale(
+			scale.x > 0.0f ? 1.0f / scale.x : 0.0f,
+			scale.y > 0.0f ? 1.0f / scale.y : 0.0f,
+			scale.z > 0.0f ? 1.0f / scale.z : 0.0f);
+
+		_unormTexCoord = true;
+		for (size_t i = 0; i < _gpuVertexCount && _unormTexCoord; ++i) {
+			const glm::vec2& uv = vertices[i].texCoord;
+			_unormTexCoord = uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+		}
 
-	// specify layout, size of a vertex, data type, normalize, sizeof vertex array, offset of the attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-	glEnableVertexAttribArray(2);
+		_pending->vertexBytes.resize(sizeof(PackedVertex) * _gpuVertexCount);
+		PackedVertex* packed = reinterpret_cast<PackedVertex*>(_pending->vertexBytes.data());
+		for (size_t i = 0; i < _gpuVertexCount; ++i) {
+			packed[i] = packVertex(vertices[i], offset, invScale, _unormTexCoord);
+		}
+	} else if (!gathered.empty()) {
+		_pending->vertexBytes.resize(sizeof(Vertex) * _gpuVertexCount);
+		std::memcpy(_pending->vertexBytes.data(), gathered.data(), _pending->vertexBytes.size());
+	} else {
+		// uploaded straight from the source, e.g. the mapped cache file
+		_pending->vertexData = vertexData;
+	}
+	_pending->vertexDataSize = (_packed ? sizeof(PackedVertex) : sizeof(Vertex)) * _gpuVertexCount;
 
-	glBindVertexArray(0);
+	if (!_deferUpload) {
+		upload();
+	}
 }
 
-bool Model::inside(glm::vec3 pos)
-{
-	float t1;
-	glm::vec3 t2;
-	t2 = ((pos - position) * getRight());
-	t1 = t2.x + t2.y + t2.z;
-	if (t1<minx * scale.x - 0.05f || t1>maxx * scale.x + 0.05f) return false;
-	t2 = ((pos - position) * getUp());
-	t1 = t2.x + t2.y + t2.z;
-	if (t1<miny * scale.y - 0.05f || t1>maxy * scale.y + 0.05f) return false;
-	t2 = -((pos - position) * getFront());
-	t1 = t2.x + t2.y + t2.z;
-	if (t1<minz * scale.z - 0.05f || t1>maxz * scale.z + 0.05f) return false;
+bool Model::upload(size_t maxBytes) {
+	if (_pending == nullptr) {
+		return true;
+	}
+
+	const uint8_t* vertexData = _pending->vertexData != nullptr ?
+		static_cast<const uint8_t*>(_pending->vertexData) : _pending->vertexBytes.data();
+	const size_t vertexSize = _pending->vertexDataSize;
+	const size_t indexSize = _pending->indices.size() * sizeof(uint16_t);
+
+	if (_arena != nullptr && !_inArena) {
+		_firstVertex = _arena->allocateVertices(getVertexFormat(), _gpuVertexCount);
+		_firstIndex = _arena->allocateIndices(_pending->indices.size());
+		_arenaIndexCount = _pending->indices.size();
+		_inArena = true;
+	} else if (_arena == nullptr && _vao == 0) {
+		// create a vertex array object
+		glGenVertexArrays(1, &_vao);
+		// create a vertex buffer object
+		glGenBuffers(1, &_vbo);
+		// create a element array buffer
+		glGenBuffers(1, &_ebo);
+
+		// a whole upload goes in with the allocation, a partial one follows in pieces
+		const bool whole = maxBytes >= vertexSize + indexSize;
+
+		GLStateCache::instance().bindVertexArray(_vao);
+		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertexSize, whole ? vertexData : nullptr, GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, whole ? _pending->indices.data() : nullptr, GL_STATIC_DRAW);
+
+		setVertexFormat(getVertexFormat());
+
+		GLStateCache::instance().bindVertexArray(0);
+
+		if (whole) {
+			_pending.reset();
+			return true;
+		}
+	}
+
+	// vertices first, then indices, both continue where the previous call stopped
+	size_t budget = std::max<size_t>(maxBytes, 1);
+	if (_pending->uploadedBytes < vertexSize) {
+		size_t size = std::min(budget, vertexSize - _pending->uploadedBytes);
+		if (_inArena) {
+			_arena->writeVertices(getVertexFormat(), _firstVertex * getVertexSize(getVertexFormat()) + _pending->uploadedBytes,
+				size, vertexData + _pending->uploadedBytes);
+		} else {
+			glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+			glBufferSubData(GL_ARRAY_BUFFER, _pending->uploadedBytes, size, vertexData + _pending->uploadedBytes);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		_pending->uploadedBytes += size;
+		budget -= size;
+	}
+	if (budget > 0 && _pending->uploadedBytes >= vertexSize) {
+		size_t done = _pending->uploadedBytes - vertexSize;
+		size_t size = std::min(budget, indexSize - done);
+		const uint8_t* indexData = reinterpret_cast<const uint8_t*>(_pending->indices.data()) + done;
+		if (_inArena) {
+			_arena->writeIndices(_firstIndex * sizeof(uint16_t) + done, size, indexData);
+		} else {
+			// the element buffer binding belongs to the vertex array
+			GLStateCache::instance().bindVertexArray(_vao);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, done, size, indexData);
+			GLStateCache::instance().bindVertexArray(0);
+		}
+		_pending->uploadedBytes += size;
+	}
+
+	if (_pending->uploadedBytes < vertexSize + indexSize) {
+		return false;
+	}
+	_pending.reset();
+	return true;
+}
+
+bool Model::isUploaded() const {
+	return (_vao != 0 || _inArena) && _pending == nullptr;
+}
+
+VertexFormat Model::getVertexFormat() const {
+	if (!_packed) {
+		return VertexFormat::Float;
+	}
+	return _unormTexCoord ? VertexFormat::PackedUnorm : VertexFormat::PackedHalf;
+}
+
+bool Model::raycast(const Object3D& transform, const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+	MeshHit* hit) const {
+	// an affine map keeps the ray parameter, so t and maxDistance carry over to model space unchanged
+	const glm::mat4 invModel = glm::inverse(transform.getModelMatrix());
+	const glm::vec3 localOrigin = glm::vec3(invModel * glm::vec4(origin, 1.0f));
+	const glm::vec3 localDirection = glm::vec3(invModel * glm::vec4(direction, 0.0f));
+	if (!_bvh.raycast(localOrigin, localDirection, maxDistance, hit)) {
+		return false;
+	}
+	hit->normal = glm::normalize(glm::transpose(glm::mat3(invModel)) * hit->normal);
+	return true;
+}
+
+bool Model::contains(const Object3D& transform, const glm::vec3& point) const {
+	const glm::vec3 localPoint = glm::vec3(glm::inverse(transform.getModelMatrix()) * glm::vec4(point, 1.0f));
+	return _bvh.contains(localPoint);
+}
+
+bool Model::sweepSphere(const Object3D& transform, const glm::vec3& center, float radius, const glm::vec3& displacement,
+	MeshHit* hit) const {
+	const glm::mat4 invModel = glm::inverse(transform.getModelMatrix());
+	const glm::vec3& scale = transform.scale;
+	const float minScale = std::min(std::abs(scale.x), std::min(std::abs(scale.y), std::abs(scale.z)));
+	const glm::vec3 localCenter = glm::vec3(invModel * glm::vec4(center, 1.0f));
+	const glm::vec3 localDisplacement = glm::vec3(invModel * glm::vec4(displacement, 0.0f));
+	if (minScale <= 0.0f || !_bvh.sweepSphere(localCenter, radius / minScale, localDisplacement, hit)) {
+		return false;
+	}
+	hit->normal = glm::normalize(glm::transpose(glm::mat3(invModel)) * hit->normal);
 	return true;
 }
\ No newline at end of file
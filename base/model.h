@@ -1,32 +1,125 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <glad/glad.h>
 
 #include "vertex.h"
+#include "geometry_arena.h"
+#include "instance_buffer.h"
 #include "object3d.h"
-
-class Model : public Object3D {
+#include "mesh_bvh.h"
+#include "mesh_clusters.h"
+
+// per model processing applied after loading, results are stored in the mesh cache
+struct ModelOptions {
+	// reorder triangles for vertex cache locality and overdraw, then vertices for fetch locality
+	bool optimizeMesh = false;
+
+	// upload PackedVertex instead of Vertex, the cpu side copy keeps full precision
+	bool packVertices = false;
+
+	// build simplified levels of detail for distant rendering
+	bool generateLods = false;
+
+	// partition the full mesh into clusters that drawClusters culls individually
+	bool buildClusters = false;
+
+	// leave the gpu upload to upload(), so the model can be loaded on a thread without a gl context;
+	// not part of the processing, the mesh cache and the asset cache ignore it
+	bool deferUpload = false;
+
+	// suballocate the gpu buffers from a shared arena instead of creating them per model, models of one vertex
+	// format then draw from the same vertex array; not part of the processing, the caches ignore it
+	std::shared_ptr<GeometryArena> arena;
+};
+
+// a simplified index list of a model, sharing the model's vertices
+struct ModelLod {
+	std::vector<uint32_t> indices;
+	// bound on the distance of the simplified surface from the full one, in model units
+	float error = 0.0f;
+};
+
+// a run of triangles drawn with one call, its 16-bit indices are relative to baseVertex
+struct IndexRange {
+	GLsizei count = 0;
+	// byte offset into the element buffer
+	size_t offset = 0;
+	GLint baseVertex = 0;
+};
+
+// vertices and triangle list of an obj file, corners with the same position, normal and texcoord
+// indices share a vertex, so files with the same faces give the same indices
+void loadObjMesh(const std::string& filepath, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices);
+
+// mesh data shared by every object drawing it, the placement comes with each query as an Object3D
+class Model {
 public:
-	Model(const std::string& filepath);
+	Model(const std::string& filepath, const ModelOptions& options = ModelOptions());
 
 	Model(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
 
 	~Model();
 
-	Model(Model&& model) noexcept = default;
+	// the gl objects and arena blocks are freed by the destructor, models are shared through shared_ptr instead
+	Model(Model&& model) = delete;
+
+	Model& operator=(Model&& model) = delete;
 
+	// the arena's vertex array for models in an arena
 	GLuint getVertexArrayObject() const;
 
+	// transfer up to maxBytes of a deferred upload on the gl thread, true once the model can be drawn
+	bool upload(size_t maxBytes = SIZE_MAX);
+
+	bool isUploaded() const;
+
 	size_t getVertexCount() const;
 
 	size_t getFaceCount() const;
 
+	bool isPacked() const;
+
+	// a packed position p in [0, 1]^3 decodes to offset + p * scale, (0, 1) for unpacked models
+	glm::vec3 getPositionOffset() const;
+
+	glm::vec3 getPositionScale() const;
+
+	// vertices in the gpu vertex buffer, more than getVertexCount() when the mesh needs several index ranges
+	size_t getGpuVertexCount() const;
+
+	// cpu and gpu memory held by the mesh in bytes
+	size_t getByteSize() const;
+
 	void addFace(std::vector<Vertex>& vertices, int pd);
 
-	void draw() const;
+	// number of levels of detail including the full mesh at level 0
+	size_t getLodCount() const;
+
+	// triangle list of a level, level 0 is the full mesh
+	const std::vector<uint32_t>& getLodIndices(size_t lod) const;
+
+	// coarsest level whose error projects to at most maxPixels on screen,
+	// pixelsPerUnit is the projected size in pixels of one unit at distance 1
+	size_t selectLod(const Object3D& transform, const glm::vec3& cameraPosition, float pixelsPerUnit,
+		float maxPixels = 1.0f) const;
+
+	void draw(size_t lod = 0) const;
+
+	// draw count copies of a level with the instances from first on in instances
+	void drawInstanced(size_t lod, const InstanceBuffer& instances, size_t first, size_t count) const;
+
+	// whether drawClusters can skip parts of the mesh, a single cluster is culled with the whole object
+	bool hasClusters() const;
+
+	// draw the full mesh without the clusters that are outside the frustum or face away from the camera,
+	// back-facing clusters are only invisible on closed meshes; draws everything when there are no clusters
+	void drawClusters(const Object3D& transform, const glm::mat4& viewProjection, const glm::vec3& cameraPosition,
+		ClusterCullStats* stats) const;
 
 	// vertices of the table represented in model's own coordinate
 	std::vector<Vertex> _vertices;
@@ -34,7 +127,16 @@ public:
 	//std::vector< std::vector< std::vector< int > > > _faceIndices;
 	//std::vector<Vertex> _verticesWithIndex;
 	float minx=10000.0f, miny= 10000.0f, minz= 10000.0f, maxx=-10000.0f, maxy=-10000.0f, maxz=-10000.0f;
-	bool inside(glm::vec3 pos);
+
+	// exact queries against the transformed triangles in world space, the bvh is built with the model
+	bool raycast(const Object3D& transform, const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+		MeshHit* hit) const;
+
+	bool contains(const Object3D& transform, const glm::vec3& point) const;
+
+	// under a non-uniform scale the sphere is grown to enclose its image in model space
+	bool sweepSphere(const Object3D& transform, const glm::vec3& center, float radius, const glm::vec3& displacement,
+		MeshHit* hit) const;
 
 private:
 
@@ -43,5 +145,62 @@ private:
 	GLuint _vbo = 0;
 	GLuint _ebo = 0;
 
+	// gpu buffers prepared by initGLResources until upload() has transferred them
+	struct PendingUpload {
+		std::vector<uint16_t> indices;
+		std::vector<uint8_t> vertexBytes;
+		// vertices uploaded from their source instead of vertexBytes
+		const void* vertexData = nullptr;
+		size_t vertexDataSize = 0;
+		// vertex bytes then index bytes already transferred
+		size_t uploadedBytes = 0;
+	};
+
+	std::unique_ptr<PendingUpload> _pending;
+
+	bool _deferUpload = false;
+
+	// vertices and indices of the model inside the arena, _firstVertex and _firstIndex are added to every draw
+	std::shared_ptr<GeometryArena> _arena;
+	bool _inArena = false;
+	size_t _firstVertex = 0;
+	size_t _firstIndex = 0;
+	size_t _arenaIndexCount = 0;
+
+	bool _optimized = false;
+
+	bool _packed = false;
+
+	bool _unormTexCoord = false;
+
+	std::vector<IndexRange> _indexRanges;
+
+	size_t _gpuVertexCount = 0;
+
+	std::vector<ModelLod> _lods;
+
+	bool _lodsBuilt = false;
+
+	// first index range of every level, followed by the end of the last one
+	std::vector<size_t> _lodRanges;
+
+	bool _buildClusters = false;
+
+	std::vector<MeshCluster> _clusters;
+
+	MeshBvh _bvh;
+
+	VertexFormat getVertexFormat() const;
+
 	void initGLResources();
+
+	void initGLResources(const void* vertexData, const void* indexData);
+
+	bool loadCache(const std::string& filepath, const ModelOptions& options);
+
+	void optimize(const std::string& filepath);
+
+	void buildLods();
+
+	void saveCache(const std::string& filepath) const;
 };
\ No newline at end of file
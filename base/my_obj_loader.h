@@ -1,5 +1,9 @@
 #pragma once
+#include <algorithm>
+#include <thread>
+
 #include "my_obj_loader_misc.h"
+#include "mapped_file.h"
 
 static bool exportFaceGroupToShape(
     shape_t* shape, const std::vector<std::vector<vertex_index> >& faceGroup,
@@ -65,8 +69,149 @@ static bool exportFaceGroupToShape(
     return true;
 }
 
-bool LoadObj(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err, const char* filename) {
+// Parser state shared by every line of one OBJ file.
+struct obj_parse_state {
+    std::vector<float> v;
+    std::vector<float> vn;
+    std::vector<float> vt;
+    std::vector<tag_t> tags;
+    std::vector<std::vector<vertex_index> > faceGroup;
+    std::string name;
+
+    shape_t shape;
+
+    int material = -1;
     bool triangulate = true;
+};
+
+// Parse a single line. `token` must end with '\0', '\n' or "\r\n"; none of the
+// tokenizers read past the line terminator, so the line can live inside a
+// larger buffer. The vectorized scanners may look ahead up to buffer_end.
+static void parseObjLine(const char* token, const char* buffer_end, obj_parse_state* state,
+    std::vector<shape_t>* shapes) {
+    // Skip leading space.
+    token += strspn(token, " \t");
+
+    assert(token);
+    if (IS_NEW_LINE(token[0])) return;  // empty line
+
+    if (token[0] == '#') return;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+        token += 2;
+        float x, y, z;
+        parseReal3Fast(&x, &y, &z, &token, buffer_end);
+        state->v.push_back(x);
+        state->v.push_back(y);
+        state->v.push_back(z);
+        return;
+    }
+
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+        token += 3;
+        float x, y, z;
+        parseReal3Fast(&x, &y, &z, &token, buffer_end);
+        state->vn.push_back(x);
+        state->vn.push_back(y);
+        state->vn.push_back(z);
+        return;
+    }
+
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+        token += 3;
+        float x, y;
+        parseReal2Fast(&x, &y, &token, buffer_end);
+        state->vt.push_back(x);
+        state->vt.push_back(y);
+        return;
+    }
+
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+        token += 2;
+        token += strspn(token, " \t");
+
+        std::vector<vertex_index> face;
+        face.reserve(3);
+
+        while (!IS_NEW_LINE(token[0])) {
+            vertex_index vi = parseTripleFast(&token, buffer_end, static_cast<int>(state->v.size() / 3),
+                static_cast<int>(state->vn.size() / 3),
+                static_cast<int>(state->vt.size() / 2));
+            face.push_back(vi);
+            size_t n = strspn(token, " \t\r");
+            token += n;
+        }
+
+        // replace with emplace_back + std::move on C++11
+        state->faceGroup.push_back(std::vector<vertex_index>());
+        state->faceGroup[state->faceGroup.size() - 1].swap(face);
+
+        return;
+    }
+
+    // group name
+    if (token[0] == 'g' && IS_SPACE((token[1]))) {
+        // flush previous face group.
+        bool ret = exportFaceGroupToShape(&state->shape, state->faceGroup, state->tags,
+            state->material, state->name, state->triangulate);
+        if (ret) {
+            shapes->push_back(state->shape);
+        }
+
+        state->shape = shape_t();
+
+        // material = -1;
+        state->faceGroup.clear();
+
+        std::vector<std::string> names;
+        names.reserve(2);
+
+        while (!IS_NEW_LINE(token[0])) {
+            std::string str = parseString(&token);
+            names.push_back(str);
+            token += strspn(token, " \t\r");  // skip tag
+        }
+
+        assert(names.size() > 0);
+
+        // names[0] must be 'g', so skip the 0th element.
+        if (names.size() > 1) {
+            state->name = names[1];
+        }
+        else {
+            state->name = "";
+        }
+
+        return;
+    }
+
+    // Ignore unknown command.
+}
+
+// Flush the last face group and hand the attribute arrays to the caller.
+static void finishObjParse(obj_parse_state* state, attrib_t* attrib,
+    std::vector<shape_t>* shapes) {
+    bool ret = exportFaceGroupToShape(&state->shape, state->faceGroup, state->tags,
+        state->material, state->name, state->triangulate);
+    // exportFaceGroupToShape return false when `usemtl` is called in the last
+    // line.
+    // we also add `shape` to `shapes` when `shape.mesh` has already some
+    // faces(indices)
+    if (ret || state->shape.mesh.indices.size()) {
+        shapes->push_back(state->shape);
+    }
+    state->faceGroup.clear();  // for safety
+
+    attrib->vertices.swap(state->v);
+    attrib->normals.swap(state->vn);
+    attrib->texcoords.swap(state->vt);
+}
+
+bool LoadObj(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err, const char* filename) {
     std::stringstream errss;
 
     std::ifstream ifs(filename);
@@ -79,16 +224,7 @@ bool LoadObj(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err, c
     }
     std::istream* inStream = &ifs;
 
-    std::vector<float> v;
-    std::vector<float> vn;
-    std::vector<float> vt;
-    std::vector<tag_t> tags;
-    std::vector<std::vector<vertex_index> > faceGroup;
-    std::string name;
-
-    shape_t shape;
-
-    int material = -1;
+    obj_parse_state state;
 
     std::string linebuf;
     while (inStream->peek() != -1) {
@@ -109,128 +245,361 @@ bool LoadObj(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err, c
             continue;
         }
 
-        // Skip leading space.
-        const char* token = linebuf.c_str();
-        token += strspn(token, " \t");
+        parseObjLine(linebuf.c_str(), linebuf.c_str() + linebuf.size(), &state, shapes);
+    }
 
-        assert(token);
-        if (token[0] == '\0') continue;  // empty line
+    finishObjParse(&state, attrib, shapes);
 
-        if (token[0] == '#') continue;  // comment line
+    if (err) {
+        (*err) += errss.str();
+    }
 
-        // vertex
-        if (token[0] == 'v' && IS_SPACE((token[1]))) {
-            token += 2;
-            float x, y, z;
-            parseReal3(&x, &y, &z, &token);
-            v.push_back(x);
-            v.push_back(y);
-            v.push_back(z);
-            continue;
-        }
+    return true;
+}
 
-        // normal
-        if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-            token += 3;
-            float x, y, z;
-            parseReal3(&x, &y, &z, &token);
-            vn.push_back(x);
-            vn.push_back(y);
-            vn.push_back(z);
-            continue;
+// Same output as LoadObj, but the file is memory mapped and every line is
+// tokenized in place: no istream, no per-line std::string.
+static bool LoadObjMapped(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err,
+    const char* filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        if (err) {
+            (*err) = std::string("Cannot open file [") + filename + "]\n";
         }
+        return false;
+    }
 
-        // texcoord
-        if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-            token += 3;
-            float x, y;
-            parseReal2(&x, &y, &token);
-            vt.push_back(x);
-            vt.push_back(y);
-            continue;
+    const char* p = file.data();
+    const char* end = p + file.size();
+
+    // Old Mac files separate lines with a lone '\r', which the in-place
+    // tokenizers do not treat as a line break; let the stream loader do those.
+    if (p != end && memchr(p, '\n', file.size()) == nullptr && memchr(p, '\r', file.size()) != nullptr) {
+        file.close();
+        return LoadObj(attrib, shapes, err, filename);
+    }
+
+    obj_parse_state state;
+
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            // the last line has no line ending, so nothing terminates it inside
+            // the mapping: this is the only line that gets copied.
+            std::string tail(p, end);
+            parseObjLine(tail.c_str(), tail.c_str() + tail.size(), &state, shapes);
+            break;
         }
 
-        // face
-        if (token[0] == 'f' && IS_SPACE((token[1]))) {
-            token += 2;
-            token += strspn(token, " \t");
+        parseObjLine(p, end, &state, shapes);
+        p = eol + 1;
+    }
 
-            std::vector<vertex_index> face;
-            face.reserve(3);
+    finishObjParse(&state, attrib, shapes);
 
-            while (!IS_NEW_LINE(token[0])) {
-                vertex_index vi = parseTriple(&token, static_cast<int>(v.size() / 3),
-                    static_cast<int>(vn.size() / 3),
-                    static_cast<int>(vt.size() / 2));
-                face.push_back(vi);
-                size_t n = strspn(token, " \t\r");
-                token += n;
-            }
+    return true;
+}
+
+// Below this many bytes per worker the parallel loader does not split a file.
+#ifndef OBJ_PARALLEL_MIN_CHUNK
+#define OBJ_PARALLEL_MIN_CHUNK (1 << 20)
+#endif
+
+// A 'g' line or the start of a chunk, followed by a run of faces.
+struct obj_chunk_segment {
+    bool newGroup = false;  // the segment starts with a 'g' line
+    std::string name;       // group name set by that line
+    size_t firstIndex = 0;  // first corner in obj_chunk::indices
+    size_t faceCount = 0;   // faces (not triangles) parsed in this segment
+};
+
+// Everything one worker parsed from its byte range of the file. Indices are
+// fixed up like parseTriple does, except the relative (negative) ones, which
+// are still relative to the first element of the chunk.
+struct obj_chunk {
+    std::vector<float> v;
+    std::vector<float> vn;
+    std::vector<float> vt;
+    std::vector<index_t> indices;         // triangulated face corners
+    std::vector<unsigned char> relative;  // RELATIVE_*_IDX bits per corner
+    std::vector<obj_chunk_segment> segments;
+
+    std::vector<vertex_index> face;       // scratch for the current face
+    std::vector<unsigned char> faceRelative;
+};
+
+static void parseObjChunkLine(const char* token, const char* buffer_end, obj_chunk* chunk) {
+    token += strspn(token, " \t");
+
+    if (IS_NEW_LINE(token[0])) return;  // empty line
+
+    if (token[0] == '#') return;  // comment line
+
+    // vertex
+    if (token[0] == 'v' && IS_SPACE((token[1]))) {
+        token += 2;
+        float x, y, z;
+        parseReal3Fast(&x, &y, &z, &token, buffer_end);
+        chunk->v.push_back(x);
+        chunk->v.push_back(y);
+        chunk->v.push_back(z);
+        return;
+    }
 
-            // replace with emplace_back + std::move on C++11
-            faceGroup.push_back(std::vector<vertex_index>());
-            faceGroup[faceGroup.size() - 1].swap(face);
+    // normal
+    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+        token += 3;
+        float x, y, z;
+        parseReal3Fast(&x, &y, &z, &token, buffer_end);
+        chunk->vn.push_back(x);
+        chunk->vn.push_back(y);
+        chunk->vn.push_back(z);
+        return;
+    }
 
-            continue;
+    // texcoord
+    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+        token += 3;
+        float x, y;
+        parseReal2Fast(&x, &y, &token, buffer_end);
+        chunk->vt.push_back(x);
+        chunk->vt.push_back(y);
+        return;
+    }
+
+    // face, triangulated right away as a fan like exportFaceGroupToShape does
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+        token += 2;
+        token += strspn(token, " \t");
+
+        chunk->face.clear();
+        chunk->faceRelative.clear();
+
+        while (!IS_NEW_LINE(token[0])) {
+            unsigned char relative = 0;
+            vertex_index vi = parseTripleFast(&token, buffer_end, static_cast<int>(chunk->v.size() / 3),
+                static_cast<int>(chunk->vn.size() / 3),
+                static_cast<int>(chunk->vt.size() / 2), &relative);
+            chunk->face.push_back(vi);
+            chunk->faceRelative.push_back(relative);
+            token += strspn(token, " \t\r");
         }
 
-        // group name
-        if (token[0] == 'g' && IS_SPACE((token[1]))) {
-            // flush previous face group.
-            bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material, name,
-                triangulate);
-            if (ret) {
-                shapes->push_back(shape);
+        for (size_t k = 2; k < chunk->face.size(); k++) {
+            const size_t corners[3] = { 0, k - 1, k };
+            for (size_t c = 0; c < 3; c++) {
+                const vertex_index& vi = chunk->face[corners[c]];
+                index_t idx;
+                idx.vertex_index = vi.v_idx;
+                idx.normal_index = vi.vn_idx;
+                idx.texcoord_index = vi.vt_idx;
+                chunk->indices.push_back(idx);
+                chunk->relative.push_back(chunk->faceRelative[corners[c]]);
             }
+        }
+
+        chunk->segments.back().faceCount++;
+        return;
+    }
 
-            shape = shape_t();
+    // group name
+    if (token[0] == 'g' && IS_SPACE((token[1]))) {
+        obj_chunk_segment segment;
+        segment.newGroup = true;
+        segment.firstIndex = chunk->indices.size();
+
+        // the first name is 'g' itself, the second one names the group
+        int count = 0;
+        while (!IS_NEW_LINE(token[0])) {
+            std::string str = parseString(&token);
+            if (count++ == 1) {
+                segment.name = str;
+            }
+            token += strspn(token, " \t\r");  // skip tag
+        }
 
-            // material = -1;
-            faceGroup.clear();
+        chunk->segments.push_back(segment);
+        return;
+    }
 
-            std::vector<std::string> names;
-            names.reserve(2);
+    // Ignore unknown command.
+}
 
-            while (!IS_NEW_LINE(token[0])) {
-                std::string str = parseString(&token);
-                names.push_back(str);
-                token += strspn(token, " \t\r");  // skip tag
-            }
+// Parse the lines in [p, end); the rest of the mapping, up to buffer_end, is
+// readable too.
+static void parseObjChunk(const char* p, const char* end, const char* buffer_end,
+    obj_chunk* chunk) {
+    chunk->segments.push_back(obj_chunk_segment());
+
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            std::string tail(p, end);
+            parseObjChunkLine(tail.c_str(), tail.c_str() + tail.size(), chunk);
+            break;
+        }
 
-            assert(names.size() > 0);
+        parseObjChunkLine(p, buffer_end, chunk);
+        p = eol + 1;
+    }
+}
 
-            // names[0] must be 'g', so skip the 0th element.
-            if (names.size() > 1) {
-                name = names[1];
-            }
-            else {
-                name = "";
-            }
+// Run task(0) .. task(count - 1), each on its own thread; task(0) runs on the
+// calling thread.
+template <typename Task>
+static void runObjTasks(size_t count, const Task& task) {
+    std::vector<std::thread> workers;
+    workers.reserve(count > 0 ? count - 1 : 0);
+    for (size_t i = 1; i < count; i++) {
+        workers.emplace_back(task, i);
+    }
+    if (count > 0) {
+        task(0);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
 
-            continue;
+// Same output as LoadObj, parsed by `num_threads` workers (0: one per
+// hardware thread). The mapped file is split at line boundaries, every chunk
+// is parsed independently, then the chunks are stitched: relative indices are
+// rebased onto the element counts of the preceding chunks and faces are
+// regrouped into shapes exactly where the serial loader would flush them.
+static bool LoadObjParallel(attrib_t* attrib, std::vector<shape_t>* shapes, std::string* err,
+    const char* filename, unsigned int num_threads = 0) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        if (err) {
+            (*err) = std::string("Cannot open file [") + filename + "]\n";
         }
+        return false;
+    }
 
-        // Ignore unknown command.
+    const char* data = file.data();
+    const size_t size = file.size();
+
+    if (size != 0 && memchr(data, '\n', size) == nullptr && memchr(data, '\r', size) != nullptr) {
+        file.close();
+        return LoadObj(attrib, shapes, err, filename);
     }
 
-    bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material, name,
-        triangulate);
-    // exportFaceGroupToShape return false when `usemtl` is called in the last
-    // line.
-    // we also add `shape` to `shapes` when `shape.mesh` has already some
-    // faces(indices)
-    if (ret || shape.mesh.indices.size()) {
-        shapes->push_back(shape);
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    size_t numChunks = size / OBJ_PARALLEL_MIN_CHUNK;
+    if (numChunks > num_threads) numChunks = num_threads;
+    if (numChunks < 1) numChunks = 1;
+
+    // chunk i covers [bounds[i], bounds[i + 1]), every bound but the last one
+    // sits right after a '\n'
+    std::vector<size_t> bounds(numChunks + 1, size);
+    bounds[0] = 0;
+    for (size_t i = 1; i < numChunks; i++) {
+        size_t pos = size / numChunks * i;
+        if (pos < bounds[i - 1]) pos = bounds[i - 1];
+        const char* eol = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        bounds[i] = eol ? static_cast<size_t>(eol - data) + 1 : size;
     }
-    faceGroup.clear();  // for safety
 
-    if (err) {
-        (*err) += errss.str();
+    std::vector<obj_chunk> chunks(numChunks);
+    runObjTasks(numChunks, [&](size_t i) {
+        parseObjChunk(data + bounds[i], data + bounds[i + 1], data + size, &chunks[i]);
+    });
+
+    // element offsets of every chunk
+    std::vector<size_t> vBase(numChunks), vnBase(numChunks), vtBase(numChunks);
+    size_t vCount = 0, vnCount = 0, vtCount = 0;
+    for (size_t i = 0; i < numChunks; i++) {
+        vBase[i] = vCount;
+        vnBase[i] = vnCount;
+        vtBase[i] = vtCount;
+        vCount += chunks[i].v.size() / 3;
+        vnCount += chunks[i].vn.size() / 3;
+        vtCount += chunks[i].vt.size() / 2;
     }
 
-    attrib->vertices.swap(v);
-    attrib->normals.swap(vn);
-    attrib->texcoords.swap(vt);
+    // replay the group changes in file order to find which shape, and where
+    // in it, every segment ends up
+    struct placement {
+        size_t shape;
+        size_t offset;
+        size_t count;
+    };
+    struct planned_shape {
+        std::string name;
+        size_t corners;
+    };
+    std::vector<std::vector<placement> > placements(numChunks);
+    std::vector<planned_shape> planned;
+    std::string name;
+    size_t faces = 0, corners = 0;
+
+    for (size_t i = 0; i < numChunks; i++) {
+        const obj_chunk& chunk = chunks[i];
+        for (size_t s = 0; s < chunk.segments.size(); s++) {
+            const obj_chunk_segment& segment = chunk.segments[s];
+            if (segment.newGroup) {
+                // exportFaceGroupToShape only emits non-empty face groups
+                if (faces > 0) {
+                    planned.push_back({ name, corners });
+                }
+                faces = corners = 0;
+                name = segment.name;
+            }
+
+            size_t last = s + 1 < chunk.segments.size() ?
+                chunk.segments[s + 1].firstIndex : chunk.indices.size();
+            placement place = { planned.size(), corners, last - segment.firstIndex };
+            placements[i].push_back(place);
+
+            faces += segment.faceCount;
+            corners += place.count;
+        }
+    }
+    if (faces > 0 || corners > 0) {
+        planned.push_back({ name, corners });
+    }
+
+    const size_t firstShape = shapes->size();
+    shapes->resize(firstShape + planned.size());
+    for (size_t i = 0; i < planned.size(); i++) {
+        shape_t& shape = (*shapes)[firstShape + i];
+        shape.name = planned[i].name;
+        shape.mesh.indices.resize(planned[i].corners);
+        shape.mesh.num_face_vertices.assign(planned[i].corners / 3, 3);
+    }
+
+    attrib->vertices.resize(vCount * 3);
+    attrib->normals.resize(vnCount * 3);
+    attrib->texcoords.resize(vtCount * 2);
+
+    runObjTasks(numChunks, [&](size_t i) {
+        obj_chunk& chunk = chunks[i];
+
+        std::copy(chunk.v.begin(), chunk.v.end(), attrib->vertices.begin() + vBase[i] * 3);
+        std::copy(chunk.vn.begin(), chunk.vn.end(), attrib->normals.begin() + vnBase[i] * 3);
+        std::copy(chunk.vt.begin(), chunk.vt.end(), attrib->texcoords.begin() + vtBase[i] * 2);
+        std::vector<float>().swap(chunk.v);
+        std::vector<float>().swap(chunk.vn);
+        std::vector<float>().swap(chunk.vt);
+
+        for (size_t s = 0; s < chunk.segments.size(); s++) {
+            const placement& place = placements[i][s];
+            if (place.count == 0) continue;
+
+            index_t* dst = &(*shapes)[firstShape + place.shape].mesh.indices[place.offset];
+            const size_t first = chunk.segments[s].firstIndex;
+            for (size_t k = 0; k < place.count; k++) {
+                index_t idx = chunk.indices[first + k];
+                const unsigned char relative = chunk.relative[first + k];
+                if (relative & RELATIVE_V_IDX) idx.vertex_index += static_cast<int>(vBase[i]);
+                if (relative & RELATIVE_VN_IDX) idx.normal_index += static_cast<int>(vnBase[i]);
+                if (relative & RELATIVE_VT_IDX) idx.texcoord_index += static_cast<int>(vtBase[i]);
+                dst[k] = idx;
+            }
+        }
+    });
 
     return true;
-}
\ No newline at end of file
+}
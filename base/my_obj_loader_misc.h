@@ -8,10 +8,24 @@
 #include <cctype>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <utility>
 
+#include "cpu_features.h"
+
+// The vectorized number scanner needs SSE4.1 (pshufb, pmaddubsw, packusdw).
+// It is compiled for SSE4.1 on every x86 target while the rest of the build
+// keeps the baseline, and only used when the cpu has SSE4.1.
+#ifdef CPU_X86
+#define OBJ_LOADER_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 #include <fstream>
 #include <sstream>
 
@@ -226,7 +240,7 @@ fail:
 
 static inline real_t parseReal(const char** token, double default_value = 0.0) {
     (*token) += strspn((*token), " \t");
-    const char* end = (*token) + strcspn((*token), " \t\r");
+    const char* end = (*token) + strcspn((*token), " \t\r\n");
     double val = default_value;
     tryParseDouble((*token), end, &val);
     real_t f = static_cast<real_t>(val);
@@ -263,7 +277,7 @@ static inline void parseV(real_t* x, real_t* y, real_t* z, real_t* w,
 
 static inline bool parseOnOff(const char** token, bool default_value = true) {
     (*token) += strspn((*token), " \t");
-    const char* end = (*token) + strcspn((*token), " \t\r");
+    const char* end = (*token) + strcspn((*token), " \t\r\n");
 
     bool ret = default_value;
     if ((0 == strncmp((*token), "on", 2))) {
@@ -280,7 +294,7 @@ static inline bool parseOnOff(const char** token, bool default_value = true) {
 static inline std::string parseString(const char** token) {
     std::string s;
     (*token) += strspn((*token), " \t");
-    size_t e = strcspn((*token), " \t\r");
+    size_t e = strcspn((*token), " \t\r\n");
     s = std::string((*token), &(*token)[e]);
     (*token) += e;
     return s;
@@ -289,7 +303,7 @@ static inline std::string parseString(const char** token) {
 static inline int parseInt(const char** token) {
     (*token) += strspn((*token), " \t");
     int i = atoi((*token));
-    (*token) += strcspn((*token), " \t\r");
+    (*token) += strcspn((*token), " \t\r\n");
     return i;
 }
 
@@ -299,12 +313,41 @@ static inline int fixIndex(int idx, int n) {
     return n + idx;  // negative value = relative
 }
 
+// Like atoi, but never skips leading whitespace: a token may sit right before
+// the '\n' of a line that is not NUL terminated (memory mapped input).
+static inline int parseIndex(const char* token) {
+    bool negative = false;
+    if (*token == '+' || *token == '-') {
+        negative = (*token == '-');
+        token++;
+    }
+
+    int value = 0;
+    while (IS_DIGIT(*token)) {
+        value = value * 10 + (*token - '0');
+        token++;
+    }
+
+    return negative ? -value : value;
+}
+
+// Bits set in parseTriple's `relative` mask for indices that were negative,
+// i.e. relative to the number of elements read so far.
+#define RELATIVE_V_IDX 1
+#define RELATIVE_VN_IDX 2
+#define RELATIVE_VT_IDX 4
+
+static inline int fixIndex(int idx, int n, unsigned char* relative, unsigned char bit) {
+    if (idx < 0 && relative) (*relative) |= bit;
+    return fixIndex(idx, n);
+}
+
 static vertex_index parseTriple(const char** token, int vsize, int vnsize,
-    int vtsize) {
+    int vtsize, unsigned char* relative = nullptr) {
     vertex_index vi(-1);
 
-    vi.v_idx = fixIndex(atoi((*token)), vsize);
-    (*token) += strcspn((*token), "/ \t\r");
+    vi.v_idx = fixIndex(parseIndex((*token)), vsize, relative, RELATIVE_V_IDX);
+    (*token) += strcspn((*token), "/ \t\r\n");
     if ((*token)[0] != '/') {
         return vi;
     }
@@ -313,21 +356,284 @@ static vertex_index parseTriple(const char** token, int vsize, int vnsize,
     // i//k
     if ((*token)[0] == '/') {
         (*token)++;
-        vi.vn_idx = fixIndex(atoi((*token)), vnsize);
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.vn_idx = fixIndex(parseIndex((*token)), vnsize, relative, RELATIVE_VN_IDX);
+        (*token) += strcspn((*token), "/ \t\r\n");
         return vi;
     }
 
     // i/j/k or i/j
-    vi.vt_idx = fixIndex(atoi((*token)), vtsize);
-    (*token) += strcspn((*token), "/ \t\r");
+    vi.vt_idx = fixIndex(parseIndex((*token)), vtsize, relative, RELATIVE_VT_IDX);
+    (*token) += strcspn((*token), "/ \t\r\n");
     if ((*token)[0] != '/') {
         return vi;
     }
 
     // i/j/k
     (*token)++;  // skip '/'
-    vi.vn_idx = fixIndex(atoi((*token)), vnsize);
-    (*token) += strcspn((*token), "/ \t\r");
+    vi.vn_idx = fixIndex(parseIndex((*token)), vnsize, relative, RELATIVE_VN_IDX);
+    (*token) += strcspn((*token), "/ \t\r\n");
     return vi;
+}
+
+#ifdef OBJ_LOADER_SIMD
+static inline int countTrailingZeros(unsigned int x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// Count the digits at p (0..16, 16 meaning "16 or more") and, when there
+// are fewer than 16, return their value: the digits are right aligned with
+// a shuffle and combined pairwise, 2 -> 4 -> 8 -> 16 digits. Returns -1 when
+// fewer than 16 bytes are readable; copying such a tail into a stack buffer
+// costs more than the scalar parser.
+CPU_TARGET("sse4.1")
+static inline int scanDigits(const char* p, const char* buffer_end, uint64_t* value) {
+    if (buffer_end - p < 16) {
+        return -1;
+    }
+
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(isDigit));
+    const int count = countTrailingZeros(~mask);
+
+    *value = 0;
+    if (count == 0 || count == 16) {
+        return count;
+    }
+
+    // short runs (most integer parts) are cheaper to sum up directly now
+    // that their length is known
+    if (count <= 4) {
+        uint64_t v = 0;
+        for (int i = 0; i < count; i++) {
+            v = v * 10 + static_cast<uint64_t>(p[i] - '0');
+        }
+        *value = v;
+        return count;
+    }
+
+    // lane i takes digit i - (16 - count); negative lanes have bit 7 set and
+    // are zeroed by pshufb
+    const __m128i shuffle = _mm_add_epi8(
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+        _mm_set1_epi8(static_cast<char>(count - 16)));
+    const __m128i aligned = _mm_shuffle_epi8(digits, shuffle);
+
+    const __m128i pairs = _mm_maddubs_epi16(aligned,
+        _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+    const __m128i quads = _mm_madd_epi16(pairs,
+        _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    const __m128i packed = _mm_packus_epi32(quads, quads);
+    const __m128i octets = _mm_madd_epi16(packed,
+        _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+
+    const uint64_t high = static_cast<uint32_t>(_mm_cvtsi128_si32(octets));
+    const uint64_t low = static_cast<uint32_t>(_mm_extract_epi32(octets, 1));
+    *value = high * 100000000ull + low;
+    return count;
+}
+
+static inline bool isTokenEnd(const char* p, const char* buffer_end) {
+    return p >= buffer_end || IS_SPACE(*p) || IS_NEW_LINE(*p);
+}
+
+// Fast path for the plain "[+-]ddd[.ddd]" numbers that make up almost every
+// OBJ file. The mantissa is kept as an exact integer (at most 15 digits) and
+// scaled by one exactly representable power of ten, so the result is
+// correctly rounded. Exponents, long mantissas and anything unusual return
+// false and go through tryParseDouble.
+CPU_TARGET("sse4.1")
+static inline bool tryParseRealFast(const char* s, const char* buffer_end, double* result,
+    const char** end) {
+    static const double pow10_lut[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    };
+    static const uint64_t pow10_int[] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+        100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+        10000000000000ull, 100000000000000ull, 1000000000000000ull,
+    };
+
+    const char* curr = s;
+    bool negative = false;
+    if (curr < buffer_end && (*curr == '+' || *curr == '-')) {
+        negative = (*curr == '-');
+        curr++;
+    }
+
+    uint64_t mantissa;
+    const int intDigits = scanDigits(curr, buffer_end, &mantissa);
+    if (intDigits <= 0 || intDigits > 15) {
+        return false;
+    }
+    curr += intDigits;
+
+    int fracDigits = 0;
+    if (curr < buffer_end && *curr == '.') {
+        curr++;
+        uint64_t fraction;
+        fracDigits = scanDigits(curr, buffer_end, &fraction);
+        if (fracDigits < 0 || intDigits + fracDigits > 15) {
+            return false;
+        }
+        curr += fracDigits;
+        mantissa = mantissa * pow10_int[fracDigits] + fraction;
+    }
+
+    if (!isTokenEnd(curr, buffer_end)) {
+        return false;
+    }
+
+    const double value = static_cast<double>(mantissa) / pow10_lut[fracDigits];
+    *result = negative ? -value : value;
+    *end = curr;
+    return true;
+}
+
+// Decimal value of the `count` digits at p, optionally preceded by '-'.
+static inline int sumIndexField(const char* p, int count) {
+    const bool negative = (*p == '-');
+    int value = 0;
+    for (int i = negative ? 1 : 0; i < count; i++) {
+        value = value * 10 + (p[i] - '0');
+    }
+    return negative ? -value : value;
+}
+
+// Split one face corner ("i", "i/j", "i//k" or "i/j/k", every index at most
+// 9 digits with an optional leading '-') with a single 16 byte compare: the
+// digit, '-' and '/' masks give the corner length and the field boundaries.
+// Returns false for anything else, which parseTriple then handles.
+CPU_TARGET("sse4.1")
+static inline bool scanCorner(const char* p, const char* buffer_end, int fields[3],
+    int* numFields, bool* noTexcoord, int* length) {
+    if (buffer_end - p < 16) {
+        return false;
+    }
+
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    const unsigned int digitMask = static_cast<unsigned int>(_mm_movemask_epi8(isDigit));
+    const unsigned int slashMask = static_cast<unsigned int>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('/'))));
+    const unsigned int minusMask = static_cast<unsigned int>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('-'))));
+
+    const int len = countTrailingZeros(~(digitMask | slashMask | minusMask));
+    if (len == 0 || len == 16 || !(IS_SPACE(p[len]) || IS_NEW_LINE(p[len]))) {
+        return false;
+    }
+
+    const unsigned int inside = (1u << len) - 1;
+    const unsigned int slashes = slashMask & inside;
+
+    // field starts: position 0 and every position after a slash; a '-' may
+    // only appear there
+    const unsigned int starts = 1u | (slashes << 1);
+    if ((minusMask & inside) & ~starts) {
+        return false;
+    }
+
+    int begin = 0;
+    int count = 0;
+    *noTexcoord = false;
+    unsigned int rest = slashes | (1u << len);  // the corner end closes the last field
+    while (rest) {
+        const int end = countTrailingZeros(rest);
+        rest &= rest - 1;
+        if (count == 3) {
+            return false;  // more than three fields
+        }
+
+        const int width = end - begin;
+        const bool negative = width > 0 && p[begin] == '-';
+        if (width == 0) {
+            // only the texcoord of "i//k" may be empty
+            if (count != 1 || !(slashes & (1u << end))) {
+                return false;
+            }
+            fields[count++] = 0;
+            *noTexcoord = true;
+        }
+        else if (width - (negative ? 1 : 0) == 0 || width - (negative ? 1 : 0) > 9) {
+            return false;
+        }
+        else {
+            fields[count++] = sumIndexField(p + begin, width);
+        }
+        begin = end + 1;
+    }
+
+    *numFields = count;
+    *length = len;
+    return true;
+}
+#endif
+
+// parseReal with the vectorized fast path. buffer_end is the end of the
+// readable memory the token lives in (not necessarily the end of the line).
+static inline real_t parseRealFast(const char** token, const char* buffer_end,
+    double default_value = 0.0) {
+#ifdef OBJ_LOADER_SIMD
+    while (IS_SPACE((**token))) (*token)++;
+    double val;
+    const char* end;
+    if (getCpuFeatures().sse41 && tryParseRealFast((*token), buffer_end, &val, &end)) {
+        (*token) = end;
+        return static_cast<real_t>(val);
+    }
+#endif
+    return parseReal(token, default_value);
+}
+
+static inline void parseReal2Fast(real_t* x, real_t* y, const char** token,
+    const char* buffer_end) {
+    (*x) = parseRealFast(token, buffer_end, 0.0);
+    (*y) = parseRealFast(token, buffer_end, 0.0);
+}
+
+static inline void parseReal3Fast(real_t* x, real_t* y, real_t* z, const char** token,
+    const char* buffer_end) {
+    (*x) = parseRealFast(token, buffer_end, 0.0);
+    (*y) = parseRealFast(token, buffer_end, 0.0);
+    (*z) = parseRealFast(token, buffer_end, 0.0);
+}
+
+// parseTriple with the vectorized fast path for "i", "i/j", "i//k" and
+// "i/j/k"; any other shape is re-parsed from the start by parseTriple.
+static vertex_index parseTripleFast(const char** token, const char* buffer_end, int vsize,
+    int vnsize, int vtsize, unsigned char* relative = nullptr) {
+#ifdef OBJ_LOADER_SIMD
+    int fields[3];
+    int numFields, length;
+    bool noTexcoord;
+    if (getCpuFeatures().sse41 &&
+        scanCorner((*token), buffer_end, fields, &numFields, &noTexcoord, &length)) {
+        unsigned char rel = 0;
+        vertex_index vi(-1);
+
+        vi.v_idx = fixIndex(fields[0], vsize, &rel, RELATIVE_V_IDX);
+        if (numFields >= 2 && !noTexcoord) {
+            vi.vt_idx = fixIndex(fields[1], vtsize, &rel, RELATIVE_VT_IDX);
+        }
+        if (numFields == 3) {
+            vi.vn_idx = fixIndex(fields[2], vnsize, &rel, RELATIVE_VN_IDX);
+        }
+
+        if (relative) (*relative) |= rel;
+        (*token) += length;
+        return vi;
+    }
+#else
+    (void)buffer_end;
+#endif
+    return parseTriple(token, vsize, vnsize, vtsize, relative);
 }
\ No newline at end of file
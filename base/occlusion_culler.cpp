@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "cpu_features.h"
+#include "occlusion_culler.h"
+
+// spans are compiled for avx and sse2 on x86 and the width is chosen at runtime, like the frustum culler
+#if defined(CPU_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define OCCLUSION_CULLER_SIMD 1
+#include <immintrin.h>
+#endif
+
+OcclusionCuller::OcclusionCuller(int width, int height, unsigned threadCount)
+	: _width(width), _height(height) {
+	_stride = (width + 7) / 8 * 8;
+	_tilesX = (width + kTileSize - 1) / kTileSize;
+	_tilesY = (height + kTileSize - 1) / kTileSize;
+	_depth.assign(static_cast<size_t>(_stride) * height, 1.0f);
+	_tileDepth.assign(static_cast<size_t>(_tilesX) * _tilesY, 1.0f);
+
+	if (threadCount == 0) {
+		threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+	// the caller takes a band as well, more threads than bands would only wait
+	threadCount = std::min(threadCount, static_cast<unsigned>(_tilesY - 1));
+	for (unsigned i = 0; i < threadCount; ++i) {
+		_workers.emplace_back(&OcclusionCuller::work, this);
+	}
+}
+
+OcclusionCuller::~OcclusionCuller() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_startCondition.notify_all();
+	for (std::thread& worker : _workers) {
+		worker.join();
+	}
+}
+
+int OcclusionCuller::getWidth() const {
+	return _width;
+}
+
+int OcclusionCuller::getHeight() const {
+	return _height;
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection) {
+	_viewProjection = viewProjection;
+	_triangles.clear();
+	_stats = OcclusionCullStats();
+}
+
+void OcclusionCuller::addOccluder(const glm::mat4& transform, const std::vector<Vertex>& vertices,
+	const uint32_t* indices, size_t indexCount) {
+	const glm::mat4 clip = _viewProjection * transform;
+	++_stats.occluders;
+	_stats.occluderTriangles += indexCount / 3;
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		glm::vec4 corners[3];
+		for (int k = 0; k < 3; ++k) {
+			corners[k] = clip * glm::vec4(vertices[indices[i + k]].position, 1.0f);
+		}
+
+		// outside one of the side planes as a whole
+		bool outside = false;
+		for (int axis = 0; axis < 2 && !outside; ++axis) {
+			outside = (corners[0][axis] > corners[0].w && corners[1][axis] > corners[1].w && corners[2][axis] > corners[2].w) ||
+				(corners[0][axis] < -corners[0].w && corners[1][axis] < -corners[1].w && corners[2][axis] < -corners[2].w);
+		}
+		if (outside) {
+			continue;
+		}
+
+		// clip against the near plane z = -w, which leaves a triangle or a quad
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int k = 0; k < 3; ++k) {
+			const glm::vec4& a = corners[k];
+			const glm::vec4& b = corners[(k + 1) % 3];
+			const float da = a.z + a.w;
+			const float db = b.z + b.w;
+			if (da >= 0.0f) {
+				polygon[count++] = a;
+			}
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				polygon[count++] = a + (b - a) * (da / (da - db));
+			}
+		}
+
+		for (int k = 1; k + 1 < count; ++k) {
+			setupTriangle(polygon[0], polygon[k], polygon[k + 1]);
+		}
+	}
+}
+
+void OcclusionCuller::setupTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+	glm::vec3 v[3];
+	const glm::vec4* corners[3] = { &a, &b, &c };
+	for (int k = 0; k < 3; ++k) {
+		const glm::vec4& p = *corners[k];
+		const float w = std::max(p.w, 1e-6f);
+		v[k] = glm::vec3((p.x / w * 0.5f + 0.5f) * _width, (p.y / w * 0.5f + 0.5f) * _height, p.z / w * 0.5f + 0.5f);
+	}
+
+	const float det = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+	if (std::abs(det) < 1e-8f) {
+		return;
+	}
+
+	// pixels whose centers lie inside the bounds of the triangle
+	Triangle triangle;
+	triangle.minX = std::max(0, static_cast<int>(std::ceil(std::min({ v[0].x, v[1].x, v[2].x }) - 0.5f)));
+	triangle.maxX = std::min(_width - 1, static_cast<int>(std::floor(std::max({ v[0].x, v[1].x, v[2].x }) - 0.5f)));
+	triangle.minY = std::max(0, static_cast<int>(std::ceil(std::min({ v[0].y, v[1].y, v[2].y }) - 0.5f)));
+	triangle.maxY = std::min(_height - 1, static_cast<int>(std::floor(std::max({ v[0].y, v[1].y, v[2].y }) - 0.5f)));
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+		return;
+	}
+
+	// edge k runs between the other two corners and is positive on the side of corner k
+	for (int k = 0; k < 3; ++k) {
+		const glm::vec3& p = v[(k + 1) % 3];
+		const glm::vec3& q = v[(k + 2) % 3];
+		float edgeA = p.y - q.y;
+		float edgeB = q.x - p.x;
+		float edgeC = p.x * q.y - q.x * p.y;
+		if (edgeA * v[k].x + edgeB * v[k].y + edgeC < 0.0f) {
+			edgeA = -edgeA;
+			edgeB = -edgeB;
+			edgeC = -edgeC;
+		}
+		triangle.edgeA[k] = edgeA;
+		triangle.edgeB[k] = edgeB;
+		triangle.edgeC[k] = edgeC;
+	}
+
+	// depth / w is linear in screen space
+	triangle.depthA = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / det;
+	triangle.depthB = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / det;
+	triangle.depthC = v[0].z - triangle.depthA * v[0].x - triangle.depthB * v[0].y;
+
+	_triangles.push_back(triangle);
+}
+
+void OcclusionCuller::rasterize() {
+	const auto start = std::chrono::steady_clock::now();
+	_stats.rasterizedTriangles = _triangles.size();
+
+	_nextBand = 0;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_generation;
+		_busyWorkers = _workers.size();
+	}
+	_startCondition.notify_all();
+
+	rasterizeBands();
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_doneCondition.wait(lock, [this]() { return _busyWorkers == 0; });
+	}
+
+	_stats.rasterizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool OcclusionCuller::isOccluded(const glm::vec3& center, const glm::vec3& extent) {
+	++_stats.tested;
+
+	ScreenRect rect;
+	if (!projectBounds(center, extent, &rect) || rect.minDepth > 1.0f) {
+		return false;
+	}
+
+	const int minX = std::max(0, static_cast<int>(std::floor(rect.minX)));
+	const int maxX = std::min(_width - 1, static_cast<int>(std::floor(rect.maxX)));
+	const int minY = std::max(0, static_cast<int>(std::floor(rect.minY)));
+	const int maxY = std::min(_height - 1, static_cast<int>(std::floor(rect.maxY)));
+	if (minX > maxX || minY > maxY) {
+		return false;
+	}
+
+	// a tile whose farthest depth is nearer than the box hides its part of the box,
+	// otherwise its pixels under the box decide
+	for (int ty = minY / kTileSize; ty <= maxY / kTileSize; ++ty) {
+		for (int tx = minX / kTileSize; tx <= maxX / kTileSize; ++tx) {
+			if (_tileDepth[ty * _tilesX + tx] < rect.minDepth) {
+				continue;
+			}
+
+			const int x0 = std::max(minX, tx * kTileSize);
+			const int x1 = std::min(maxX, tx * kTileSize + kTileSize - 1);
+			const int y0 = std::max(minY, ty * kTileSize);
+			const int y1 = std::min(maxY, ty * kTileSize + kTileSize - 1);
+			for (int y = y0; y <= y1; ++y) {
+				const float* row = &_depth[static_cast<size_t>(y) * _stride];
+				for (int x = x0; x <= x1; ++x) {
+					if (row[x] >= rect.minDepth) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	++_stats.occluded;
+	return true;
+}
+
+float OcclusionCuller::getScreenCoverage(const glm::vec3& center, const glm::vec3& extent) const {
+	ScreenRect rect;
+	if (!projectBounds(center, extent, &rect)) {
+		return 1.0f;
+	}
+
+	const float width = std::min(rect.maxX, static_cast<float>(_width)) - std::max(rect.minX, 0.0f);
+	const float height = std::min(rect.maxY, static_cast<float>(_height)) - std::max(rect.minY, 0.0f);
+	if (width <= 0.0f || height <= 0.0f) {
+		return 0.0f;
+	}
+	return width * height / (static_cast<float>(_width) * _height);
+}
+
+const float* OcclusionCuller::getDepth() const {
+	return _depth.data();
+}
+
+int OcclusionCuller::getStride() const {
+	return _stride;
+}
+
+const OcclusionCullStats& OcclusionCuller::getStats() const {
+	return _stats;
+}
+
+void OcclusionCuller::work() {
+	uint64_t generation = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_startCondition.wait(lock, [&]() { return _stop || _generation != generation; });
+			if (_stop) {
+				return;
+			}
+			generation = _generation;
+		}
+
+		rasterizeBands();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (--_busyWorkers == 0) {
+			_doneCondition.notify_one();
+		}
+	}
+}
+
+void OcclusionCuller::rasterizeBands() {
+	for (int band = _nextBand++; band < _tilesY; band = _nextBand++) {
+		rasterizeBand(band);
+	}
+}
+
+void OcclusionCuller::rasterizeBand(int band) {
+	const int bandMinY = band * kTileSize;
+	const int bandMaxY = std::min(_height, bandMinY + kTileSize) - 1;
+	std::fill(_depth.begin() + static_cast<size_t>(bandMinY) * _stride,
+		_depth.begin() + static_cast<size_t>(bandMaxY + 1) * _stride, 1.0f);
+
+#ifdef OCCLUSION_CULLER_SIMD
+	const bool avx = getCpuFeatures().avx;
+#endif
+	for (const Triangle& t : _triangles) {
+		const int minY = std::max(t.minY, bandMinY);
+		const int maxY = std::min(t.maxY, bandMaxY);
+#ifdef OCCLUSION_CULLER_SIMD
+		if (avx) {
+			rasterizeRowsAvx(t, minY, maxY);
+		} else {
+			rasterizeRowsSse(t, minY, maxY);
+		}
+#else
+		rasterizeRows(t, minY, maxY);
+#endif
+	}
+
+	for (int tx = 0; tx < _tilesX; ++tx) {
+		const int minX = tx * kTileSize;
+		const int maxX = std::min(_width, minX + kTileSize) - 1;
+		float farthest = 0.0f;
+		for (int y = bandMinY; y <= bandMaxY; ++y) {
+			const float* row = &_depth[static_cast<size_t>(y) * _stride];
+			for (int x = minX; x <= maxX; ++x) {
+				farthest = std::max(farthest, row[x]);
+			}
+		}
+		_tileDepth[band * _tilesX + tx] = farthest;
+	}
+}
+
+#ifdef OCCLUSION_CULLER_SIMD
+CPU_TARGET("avx")
+void OcclusionCuller::rasterizeRowsAvx(const Triangle& t, int minY, int maxY) {
+	for (int y = minY; y <= maxY; ++y) {
+		// the edge and depth functions along the row are a * x + row value
+		const float yc = y + 0.5f;
+		const float row0 = t.edgeB[0] * yc + t.edgeC[0];
+		const float row1 = t.edgeB[1] * yc + t.edgeC[1];
+		const float row2 = t.edgeB[2] * yc + t.edgeC[2];
+		const float rowDepth = t.depthB * yc + t.depthC;
+		float* row = &_depth[static_cast<size_t>(y) * _stride];
+
+		const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		for (int x = t.minX & ~7; x <= t.maxX; x += 8) {
+			const __m256 xc = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lanes);
+			const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[0]), xc), _mm256_set1_ps(row0));
+			const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[1]), xc), _mm256_set1_ps(row1));
+			const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[2]), xc), _mm256_set1_ps(row2));
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+				_mm256_cmp_ps(e1, zero, _CMP_GE_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+			const __m256 depth = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.depthA), xc), _mm256_set1_ps(rowDepth));
+			const __m256 old = _mm256_loadu_ps(row + x);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, depth), inside));
+		}
+	}
+}
+
+void OcclusionCuller::rasterizeRowsSse(const Triangle& t, int minY, int maxY) {
+	for (int y = minY; y <= maxY; ++y) {
+		// the edge and depth functions along the row are a * x + row value
+		const float yc = y + 0.5f;
+		const float row0 = t.edgeB[0] * yc + t.edgeC[0];
+		const float row1 = t.edgeB[1] * yc + t.edgeC[1];
+		const float row2 = t.edgeB[2] * yc + t.edgeC[2];
+		const float rowDepth = t.depthB * yc + t.depthC;
+		float* row = &_depth[static_cast<size_t>(y) * _stride];
+
+		const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		for (int x = t.minX & ~3; x <= t.maxX; x += 4) {
+			const __m128 xc = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes);
+			const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edgeA[0]), xc), _mm_set1_ps(row0));
+			const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edgeA[1]), xc), _mm_set1_ps(row1));
+			const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edgeA[2]), xc), _mm_set1_ps(row2));
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+				_mm_cmpge_ps(e2, zero));
+			const __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.depthA), xc), _mm_set1_ps(rowDepth));
+			const __m128 old = _mm_loadu_ps(row + x);
+			const __m128 nearer = _mm_min_ps(old, depth);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+		}
+	}
+}
+#else
+void OcclusionCuller::rasterizeRows(const Triangle& t, int minY, int maxY) {
+	for (int y = minY; y <= maxY; ++y) {
+		// the edge and depth functions along the row are a * x + row value
+		const float yc = y + 0.5f;
+		const float row0 = t.edgeB[0] * yc + t.edgeC[0];
+		const float row1 = t.edgeB[1] * yc + t.edgeC[1];
+		const float row2 = t.edgeB[2] * yc + t.edgeC[2];
+		const float rowDepth = t.depthB * yc + t.depthC;
+		float* row = &_depth[static_cast<size_t>(y) * _stride];
+
+		for (int x = t.minX; x <= t.maxX; ++x) {
+			const float xc = x + 0.5f;
+			if (t.edgeA[0] * xc + row0 >= 0.0f && t.edgeA[1] * xc + row1 >= 0.0f && t.edgeA[2] * xc + row2 >= 0.0f) {
+				row[x] = std::min(row[x], t.depthA * xc + rowDepth);
+			}
+		}
+	}
+}
+#endif
+
+bool OcclusionCuller::projectBounds(const glm::vec3& center, const glm::vec3& extent, ScreenRect* rect) const {
+	rect->minX = rect->minY = rect->minDepth = INFINITY;
+	rect->maxX = rect->maxY = -INFINITY;
+	for (int k = 0; k < 8; ++k) {
+		const glm::vec3 corner = center + extent * glm::vec3(k & 1 ? 1.0f : -1.0f, k & 2 ? 1.0f : -1.0f,
+			k & 4 ? 1.0f : -1.0f);
+		const glm::vec4 clip = _viewProjection * glm::vec4(corner, 1.0f);
+		if (clip.w <= 1e-6f || clip.z < -clip.w) {
+			return false;
+		}
+
+		const float x = (clip.x / clip.w * 0.5f + 0.5f) * _width;
+		const float y = (clip.y / clip.w * 0.5f + 0.5f) * _height;
+		rect->minX = std::min(rect->minX, x);
+		rect->maxX = std::max(rect->maxX, x);
+		rect->minY = std::min(rect->minY, y);
+		rect->maxY = std::max(rect->maxY, y);
+		rect->minDepth = std::min(rect->minDepth, clip.z / clip.w * 0.5f + 0.5f);
+	}
+	return true;
+}
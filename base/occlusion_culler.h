@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex.h"
+
+// counters of one occlusion culled frame
+struct OcclusionCullStats {
+	size_t occluders = 0;
+	// occluder triangles queued, and those left after near clipping and dropping degenerate ones
+	size_t occluderTriangles = 0;
+	size_t rasterizedTriangles = 0;
+	size_t tested = 0;
+	size_t occluded = 0;
+	// time rasterize() took, in milliseconds
+	double rasterizeMs = 0.0;
+};
+
+// software depth buffer at a low resolution for occlusion culling on the cpu: occluder triangles are
+// rasterized into it by bands of rows on worker threads, 8 pixels per instruction with avx, 4 with sse2,
+// 1 otherwise; boxes are then tested against the farthest depth of every 8x8 tile first and the pixels
+// of the tiles that cannot decide it after that
+class OcclusionCuller {
+public:
+	// threadCount 0 leaves one hardware thread to the caller, which works on the bands as well
+	OcclusionCuller(int width = 256, int height = 128, unsigned threadCount = 0);
+
+	~OcclusionCuller();
+
+	OcclusionCuller(const OcclusionCuller&) = delete;
+
+	OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+	int getWidth() const;
+
+	int getHeight() const;
+
+	// start a frame seen through a gl clip space transform, dropping the occluders of the last one
+	void begin(const glm::mat4& viewProjection);
+
+	// queue the triangles indices[0, indexCount) of a mesh placed by transform
+	void addOccluder(const glm::mat4& transform, const std::vector<Vertex>& vertices, const uint32_t* indices,
+		size_t indexCount);
+
+	// rasterize the queued occluders, the depth buffer is cleared on the way
+	void rasterize();
+
+	// true when the world space box (center, half extent) is completely behind the rasterized occluders;
+	// boxes crossing the near plane or outside the screen are never occluded
+	bool isOccluded(const glm::vec3& center, const glm::vec3& extent);
+
+	// fraction of the screen covered by the screen rectangle of the box, 1 when it crosses the near plane
+	float getScreenCoverage(const glm::vec3& center, const glm::vec3& extent) const;
+
+	// depth in [0, 1] of every pixel, rows from the bottom, getStride() floats apart
+	const float* getDepth() const;
+
+	int getStride() const;
+
+	const OcclusionCullStats& getStats() const;
+
+private:
+	static const int kTileSize = 8;
+
+	// an occluder triangle in screen space: three edge functions positive inside, and the depth plane
+	struct Triangle {
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, maxX, minY, maxY;
+	};
+
+	// pixel rectangle and nearest depth of a projected box
+	struct ScreenRect {
+		float minX, minY, maxX, maxY;
+		float minDepth;
+	};
+
+	int _width;
+
+	int _height;
+
+	// the rows are padded to a multiple of 8 pixels, so a span never leaves its row
+	int _stride;
+
+	int _tilesX;
+
+	int _tilesY;
+
+	std::vector<float> _depth;
+
+	// farthest depth of every tile
+	std::vector<float> _tileDepth;
+
+	glm::mat4 _viewProjection = glm::mat4(1.0f);
+
+	std::vector<Triangle> _triangles;
+
+	OcclusionCullStats _stats;
+
+	// bands of kTileSize rows are handed out through _nextBand, _generation starts the workers on a frame
+	std::atomic<int> _nextBand{ 0 };
+
+	uint64_t _generation = 0;
+
+	size_t _busyWorkers = 0;
+
+	bool _stop = false;
+
+	std::mutex _mutex;
+
+	std::condition_variable _startCondition;
+
+	std::condition_variable _doneCondition;
+
+	std::vector<std::thread> _workers;
+
+	void work();
+
+	void rasterizeBands();
+
+	// clear the rows of the band, rasterize the triangles overlapping them and update the band's tiles
+	void rasterizeBand(int band);
+
+	// depth test and write the rows [minY, maxY] of a triangle, avx and sse2 spans on x86, single pixels elsewhere
+	void rasterizeRowsAvx(const Triangle& t, int minY, int maxY);
+
+	void rasterizeRowsSse(const Triangle& t, int minY, int maxY);
+
+	void rasterizeRows(const Triangle& t, int minY, int maxY);
+
+	void setupTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+
+	// false when a corner of the box is behind the near plane
+	bool projectBounds(const glm::vec3& center, const glm::vec3& extent, ScreenRect* rect) const;
+};
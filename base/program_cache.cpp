@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "gl_state.h"
+#include "mesh_cache.h"
+#include "program_cache.h"
+
+// GL_ARB_get_program_binary, not part of the gl 3.3 loader
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length,
+		GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary,
+		GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+
+	const uint32_t kMagic = MESH_CACHE_TAG('P', 'B', 'I', 'N');
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// the strings are hashed with their terminator, so their boundaries count
+	uint64_t hashString(uint64_t hash, const std::string& s) {
+		return hashBytes(hash, s.c_str(), s.size() + 1);
+	}
+
+	std::string getString(GLenum name) {
+		const char* s = reinterpret_cast<const char*>(glGetString(name));
+		return s != nullptr ? s : "";
+	}
+}
+
+ProgramCache& ProgramCache::instance() {
+	static ProgramCache cache;
+	return cache;
+}
+
+bool ProgramCache::open(const std::string& directory, GLADloadproc load) {
+	_open = false;
+
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if ((major < 4 || (major == 4 && minor < 1)) && !hasGLExtension("GL_ARB_get_program_binary")) {
+		return false;
+	}
+
+	getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+	programBinary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+	programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+	if (getProgramBinary == nullptr || programBinary == nullptr || programParameteri == nullptr) {
+		return false;
+	}
+
+	// some drivers have the entry points but no format to save programs in
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats == 0) {
+		return false;
+	}
+
+	// an existing directory fails with EEXIST, a missing parent shows when the first binary is written
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+
+	_directory = directory;
+	_driver = getString(GL_VENDOR) + "\n" + getString(GL_RENDERER) + "\n" + getString(GL_VERSION);
+	_open = true;
+	return true;
+}
+
+bool ProgramCache::isOpen() const {
+	return _open;
+}
+
+uint64_t ProgramCache::makeKey(const std::string& vsCode, const std::string& fsCode) const {
+	uint64_t key = 14695981039346656037ull;
+	const uint32_t version = PROGRAM_CACHE_VERSION;
+	key = hashBytes(key, &version, sizeof(version));
+	key = hashString(key, _driver);
+	key = hashString(key, vsCode);
+	key = hashString(key, fsCode);
+	return key;
+}
+
+GLuint ProgramCache::load(uint64_t key) {
+	if (!_open) {
+		return 0;
+	}
+
+	const std::string path = binaryPath(key);
+	FILE* fp = std::fopen(path.c_str(), "rb");
+	if (fp == nullptr) {
+		++_stats.misses;
+		return 0;
+	}
+
+	Header header;
+	std::vector<char> binary;
+	bool ok = std::fread(&header, sizeof(Header), 1, fp) == 1 &&
+		header.magic == kMagic && header.version == PROGRAM_CACHE_VERSION && header.key == key;
+	if (ok) {
+		binary.resize(header.length);
+		ok = header.length > 0 && std::fread(binary.data(), 1, binary.size(), fp) == binary.size() &&
+			std::fgetc(fp) == EOF;
+	}
+	std::fclose(fp);
+
+	if (!ok) {
+		std::remove(path.c_str());
+		++_stats.misses;
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		// compiled again and stored in its place
+		glDeleteProgram(program);
+		std::remove(path.c_str());
+		++_stats.rejected;
+		++_stats.misses;
+		return 0;
+	}
+
+	++_stats.hits;
+	return program;
+}
+
+void ProgramCache::prepare(GLuint program) {
+	if (_open) {
+		programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+}
+
+bool ProgramCache::store(uint64_t key, GLuint program) {
+	if (!_open) {
+		return false;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return false;
+	}
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	getProgramBinary(program, length, &written, &format, binary.data());
+	if (written <= 0) {
+		return false;
+	}
+
+	Header header{};
+	header.magic = kMagic;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = static_cast<uint32_t>(written);
+
+	// write to a temporary file first so a crash never leaves a partial binary under the key
+	const std::string path = binaryPath(key);
+	const std::string tmpPath = path + ".tmp";
+	FILE* fp = std::fopen(tmpPath.c_str(), "wb");
+	if (fp == nullptr) {
+		return false;
+	}
+
+	bool ok = std::fwrite(&header, sizeof(Header), 1, fp) == 1 &&
+		std::fwrite(binary.data(), 1, header.length, fp) == header.length;
+	ok = (std::fclose(fp) == 0) && ok;
+
+	// rename does not replace an existing file on windows
+	std::remove(path.c_str());
+	if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void ProgramCache::addSetupTime(double ms) {
+	_stats.setupMs += ms;
+}
+
+const ProgramCacheStats& ProgramCache::getStats() const {
+	return _stats;
+}
+
+std::string ProgramCache::binaryPath(uint64_t key) const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.progbin", static_cast<unsigned long long>(key));
+	return _directory + "/" + name;
+}
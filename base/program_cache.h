@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <glad/glad.h>
+
+// bump whenever the layout of a .progbin file changes
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheStats {
+	// programs loaded from a binary, and those compiled because there was none
+	size_t hits = 0;
+	size_t misses = 0;
+	// binaries the driver refused, e.g. after an update it did not show in its version string
+	size_t rejected = 0;
+	// time spent creating programs, compiling or loading them
+	double setupMs = 0.0;
+};
+
+// linked programs saved with glGetProgramBinary as <directory>/<key>.progbin, so later runs skip compiling
+// and linking them; the key hashes the shader code, defines included, with the vendor, renderer and version
+// of the driver, whose binaries are only valid for itself. glGetProgramBinary is core in gl 4.1, the 3.3
+// context needs GL_ARB_get_program_binary, without it or a directory every program is compiled as before
+class ProgramCache {
+public:
+	static ProgramCache& instance();
+
+	ProgramCache(const ProgramCache&) = delete;
+
+	ProgramCache& operator=(const ProgramCache&) = delete;
+
+	// with the context current, load the entry points and create the directory, returns false if the cache is
+	// not available
+	bool open(const std::string& directory, GLADloadproc load);
+
+	bool isOpen() const;
+
+	// key of the program linked from the code
+	uint64_t makeKey(const std::string& vsCode, const std::string& fsCode) const;
+
+	// program created from the binary stored for the key, 0 when there is none or the driver rejects it
+	GLuint load(uint64_t key);
+
+	// mark a program about to be linked so the driver keeps its binary retrievable
+	void prepare(GLuint program);
+
+	// store the binary of a linked program for the key, returns false if it cannot be written
+	bool store(uint64_t key, GLuint program);
+
+	// time spent creating a program, added to the stats by the shader
+	void addSetupTime(double ms);
+
+	const ProgramCacheStats& getStats() const;
+
+private:
+	std::string _directory;
+
+	// vendor, renderer and version of the driver, hashed into every key
+	std::string _driver;
+
+	bool _open = false;
+
+	ProgramCacheStats _stats;
+
+	ProgramCache() = default;
+
+	std::string binaryPath(uint64_t key) const;
+};
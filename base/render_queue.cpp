@@ -0,0 +1,48 @@
+#include <algorithm>
+
+#include "render_queue.h"
+
+uint64_t RenderQueue::makeKey(uint32_t shader, uint32_t material, uint32_t mesh, float depth) {
+	const uint64_t depthMax = (1ull << kDepthBits) - 1;
+	const uint64_t quantized = static_cast<uint64_t>(std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+
+	uint64_t key = shader & ((1u << kShaderBits) - 1);
+	key = key << kMaterialBits | (material & ((1u << kMaterialBits) - 1));
+	key = key << kMeshBits | (mesh & ((1u << kMeshBits) - 1));
+	key = key << kDepthBits | quantized;
+	return key;
+}
+
+uint32_t RenderQueue::getId(Field field, const void* object) {
+	return getId(field, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object)));
+}
+
+uint32_t RenderQueue::getId(Field field, uint64_t value) {
+	std::unordered_map<uint64_t, uint32_t>& ids = _ids[static_cast<int>(field)];
+	return ids.emplace(value, static_cast<uint32_t>(ids.size())).first->second;
+}
+
+void RenderQueue::clear() {
+	_draws.clear();
+	_order.clear();
+	for (auto& ids : _ids) {
+		ids.clear();
+	}
+}
+
+void RenderQueue::push(uint64_t key, std::function<void()> draw) {
+	_order.emplace_back(key, static_cast<uint32_t>(_draws.size()));
+	_draws.push_back(std::move(draw));
+}
+
+void RenderQueue::execute() {
+	// the index breaks ties, which keeps equal keys in submission order
+	std::sort(_order.begin(), _order.end());
+	for (const auto& entry : _order) {
+		_draws[entry.second]();
+	}
+}
+
+size_t RenderQueue::getCount() const {
+	return _draws.size();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// draws collected over a frame and issued in the order of a 64-bit key: shader in the top bits, then material
+// (the texture set), mesh and depth, so draws sharing state run back to back and the gl state cache drops
+// the bindings and uniforms they have in common
+class RenderQueue {
+public:
+	// widths of the key fields from the top, ids wider than their field wrap around
+	static const int kShaderBits = 8;
+	static const int kMaterialBits = 16;
+	static const int kMeshBits = 16;
+	static const int kDepthBits = 24;
+
+	// the fields numbered by getId, each with its own ids
+	enum class Field { Shader, Material, Mesh };
+
+	// depth in [0, 1], nearer draws come first among those sharing the other fields
+	static uint64_t makeKey(uint32_t shader, uint32_t material, uint32_t mesh, float depth);
+
+	// small id of an object or a value for a key field, numbered per field in order of first use since clear(),
+	// so every field starts at 0 and ids only wrap once a field has more values than its bits
+	uint32_t getId(Field field, const void* object);
+
+	uint32_t getId(Field field, uint64_t value);
+
+	void clear();
+
+	void push(uint64_t key, std::function<void()> draw);
+
+	// issue the draws by key, draws with equal keys keep the order they were pushed in
+	void execute();
+
+	size_t getCount() const;
+
+private:
+	std::vector<std::function<void()>> _draws;
+
+	// key and index of every draw
+	std::vector<std::pair<uint64_t, uint32_t>> _order;
+
+	// ids of the shader, material and mesh fields
+	std::unordered_map<uint64_t, uint32_t> _ids[3];
+};
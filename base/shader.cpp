@@ -1,5 +1,62 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <vector>
+
+#include "gl_state.h"
+#include "program_cache.h"
 #include "shader.h"
+#include "shader_build_queue.h"
+
+namespace {
+/*
+ * @brief whether a uniform variable of gl type type can be set through a handle of T
+ */
+template <typename T>
+bool matchesType(GLenum type);
+
+template <>
+bool matchesType<bool>(GLenum type) {
+    return type == GL_BOOL;
+}
+
+template <>
+bool matchesType<int>(GLenum type) {
+    // samplers are set to their texture unit
+    return type == GL_INT || type == GL_SAMPLER_2D || type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE ||
+        type == GL_SAMPLER_2D_ARRAY;
+}
+
+template <>
+bool matchesType<float>(GLenum type) {
+    return type == GL_FLOAT;
+}
+
+template <>
+bool matchesType<glm::vec2>(GLenum type) {
+    return type == GL_FLOAT_VEC2;
+}
+
+template <>
+bool matchesType<glm::vec3>(GLenum type) {
+    return type == GL_FLOAT_VEC3;
+}
+
+template <>
+bool matchesType<glm::vec4>(GLenum type) {
+    return type == GL_FLOAT_VEC4;
+}
+
+template <>
+bool matchesType<glm::mat3>(GLenum type) {
+    return type == GL_FLOAT_MAT3;
+}
+
+template <>
+bool matchesType<glm::mat4>(GLenum type) {
+    return type == GL_FLOAT_MAT4;
+}
+}
 
 
 /*
@@ -19,19 +76,56 @@ Shader::Shader(const std::string& vsFilepath, const std::string& fsFilepath) {
     createShaderProgram(vsCode, fsCode);
 }
 
+/*
+ * @brief constructor, take string as code of a shader with compile-time features
+ * @param vsCode vertex shader code
+ * @param fsCode fragment shader code
+ * @param features names #define'd by the variants, bit i of a variant mask stands for features[i]
+ */
+Shader::Shader(const char* vsCode, const char* fsCode, const std::vector<std::string>& features)
+    : _vsCode(vsCode), _fsCode(fsCode), _features(features) {
+    if (_features.size() > 32) {
+        throw std::runtime_error("a shader has at most 32 features");
+    }
+
+    // the variant without features is submitted right away, the others on first use
+    submitShaderProgram(_vsCode, _fsCode);
+    if (!_ready) {
+        ShaderBuildQueue::instance().add(this);
+    }
+}
+
 /*
  * @brief constructor, read shader code from file to create opengl shader
  */
 Shader::Shader(Shader&& shader) noexcept {
     _id = shader._id;
+    _uniforms = std::move(shader._uniforms);
+    _vsCode = std::move(shader._vsCode);
+    _fsCode = std::move(shader._fsCode);
+    _features = std::move(shader._features);
+    _variants = std::move(shader._variants);
+    _blockBindings = std::move(shader._blockBindings);
+    _build = std::move(shader._build);
+    _ready = shader._ready;
+    if (_id > 0 && !_ready) {
+        ShaderBuildQueue::instance().remove(&shader);
+        ShaderBuildQueue::instance().add(this);
+    }
     shader._id = 0;
+    shader._build = Build();
 }
 
 /*
  * @brief destructor
  */
 Shader::~Shader() {
+    if (_id > 0 && !_ready) {
+        ShaderBuildQueue::instance().remove(this);
+        deleteBuild();
+    }
     if (_id > 0) {
+        GLStateCache::instance().forgetProgram(_id);
         glDeleteProgram(_id);
     }
 }
@@ -40,7 +134,7 @@ Shader::~Shader() {
  * @brief use current shader for object rendering
  */
 void Shader::use() {
-    glUseProgram(_id);
+    GLStateCache::instance().useProgram(_id);
 }
 
 /*
@@ -49,7 +143,7 @@ void Shader::use() {
  * @param value bool value to be pass to shader
  */
 void Shader::setBool(const std::string& name, bool value) const {
-    glUniform1i(glGetUniformLocation(_id, name.c_str()), static_cast<int>(value));
+    set(Uniform<bool>{ getUniformLocation(name) }, value);
 }
 
 /*
@@ -58,7 +152,7 @@ void Shader::setBool(const std::string& name, bool value) const {
  * @param value int value to be pass to shader
  */
 void Shader::setInt(const std::string& name, int value) const {
-    glUniform1i(glGetUniformLocation(_id, name.c_str()), value);
+    set(Uniform<int>{ getUniformLocation(name) }, value);
 }
 
 /*
@@ -67,7 +161,7 @@ void Shader::setInt(const std::string& name, int value) const {
  * @param value float value to be pass to shader
  */
 void Shader::setFloat(const std::string& name, float value) const {
-    glUniform1f(glGetUniformLocation(_id, name.c_str()), value);
+    set(Uniform<float>{ getUniformLocation(name) }, value);
 }
 
 /*
@@ -76,7 +170,7 @@ void Shader::setFloat(const std::string& name, float value) const {
  * @param v2 vec2 to be pass to shader
  */
 void Shader::setVec2(const std::string& name, const glm::vec2& v2) const {
-    glUniform2fv(glGetUniformLocation(_id, name.c_str()), 1, &v2[0]);
+    set(Uniform<glm::vec2>{ getUniformLocation(name) }, v2);
 }
 
 
@@ -86,7 +180,7 @@ void Shader::setVec2(const std::string& name, const glm::vec2& v2) const {
  * @param v3 vec3 to be pass to shader
  */
 void Shader::setVec3(const std::string& name, const glm::vec3& v3) const {
-    glUniform3fv(glGetUniformLocation(_id, name.c_str()), 1, &v3[0]);
+    set(Uniform<glm::vec3>{ getUniformLocation(name) }, v3);
 }
 
 /*
@@ -95,7 +189,7 @@ void Shader::setVec3(const std::string& name, const glm::vec3& v3) const {
  * @param v4 vec4 to be pass to shader
  */
 void Shader::setVec4(const std::string& name, const glm::vec4& v4) const {
-    glUniform4fv(glGetUniformLocation(_id, name.c_str()), 1, &v4[0]);
+    set(Uniform<glm::vec4>{ getUniformLocation(name) }, v4);
 }
 
 /*
@@ -104,7 +198,7 @@ void Shader::setVec4(const std::string& name, const glm::vec4& v4) const {
  * @param value mat3 value to be pass to shader
  */
 void Shader::setMat3(const std::string& name, const glm::mat3& mat3) const {
-    glUniform3fv(glGetUniformLocation(_id, name.c_str()), 1, &mat3[0][0]);
+    set(Uniform<glm::mat3>{ getUniformLocation(name) }, mat3);
 }
 
 /*
@@ -113,7 +207,286 @@ void Shader::setMat3(const std::string& name, const glm::mat3& mat3) const {
  * @param value mat4 value to be pass to shader
  */
 void Shader::setMat4(const std::string& name, const glm::mat4& mat4) const {
-    glUniformMatrix4fv(glGetUniformLocation(_id, name.c_str()), 1, GL_FALSE, &mat4[0][0]);
+    set(Uniform<glm::mat4>{ getUniformLocation(name) }, mat4);
+}
+
+/*
+ * @brief get the handle of an active uniform variable
+ * @param name name of the variable
+ * @return handle with location -1 when the program has no active variable by that name
+ */
+template <typename T>
+Shader::Uniform<T> Shader::getUniform(const std::string& name) const {
+    Uniform<T> uniform;
+    auto it = _uniforms.find(name);
+    if (it != _uniforms.end()) {
+        if (!matchesType<T>(it->second.type)) {
+            throw std::runtime_error("uniform " + name + " is not of the handle's type");
+        }
+        uniform.location = it->second.location;
+    }
+    return uniform;
+}
+
+template Shader::Uniform<bool> Shader::getUniform<bool>(const std::string& name) const;
+template Shader::Uniform<int> Shader::getUniform<int>(const std::string& name) const;
+template Shader::Uniform<float> Shader::getUniform<float>(const std::string& name) const;
+template Shader::Uniform<glm::vec2> Shader::getUniform<glm::vec2>(const std::string& name) const;
+template Shader::Uniform<glm::vec3> Shader::getUniform<glm::vec3>(const std::string& name) const;
+template Shader::Uniform<glm::vec4> Shader::getUniform<glm::vec4>(const std::string& name) const;
+template Shader::Uniform<glm::mat3> Shader::getUniform<glm::mat3>(const std::string& name) const;
+template Shader::Uniform<glm::mat4> Shader::getUniform<glm::mat4>(const std::string& name) const;
+
+/*
+ * @brief set bool uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<bool> uniform, bool value) const {
+    const int v = static_cast<int>(value);
+    if (GLStateCache::instance().changeUniform(uniform.location, &v, sizeof(v))) {
+        glUniform1i(uniform.location, v);
+    }
+}
+
+/*
+ * @brief set int uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<int> uniform, int value) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &value, sizeof(value))) {
+        glUniform1i(uniform.location, value);
+    }
+}
+
+/*
+ * @brief set float uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<float> uniform, float value) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &value, sizeof(value))) {
+        glUniform1f(uniform.location, value);
+    }
+}
+
+/*
+ * @brief set vec2 uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<glm::vec2> uniform, const glm::vec2& v2) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &v2[0], sizeof(v2))) {
+        glUniform2fv(uniform.location, 1, &v2[0]);
+    }
+}
+
+/*
+ * @brief set vec3 uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<glm::vec3> uniform, const glm::vec3& v3) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &v3[0], sizeof(v3))) {
+        glUniform3fv(uniform.location, 1, &v3[0]);
+    }
+}
+
+/*
+ * @brief set vec4 uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<glm::vec4> uniform, const glm::vec4& v4) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &v4[0], sizeof(v4))) {
+        glUniform4fv(uniform.location, 1, &v4[0]);
+    }
+}
+
+/*
+ * @brief set mat3 uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<glm::mat3> uniform, const glm::mat3& mat3) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &mat3[0][0], sizeof(mat3))) {
+        glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat3[0][0]);
+    }
+}
+
+/*
+ * @brief set mat4 uniform variable through its handle, unchanged values are skipped
+ */
+void Shader::set(Uniform<glm::mat4> uniform, const glm::mat4& mat4) const {
+    if (GLStateCache::instance().changeUniform(uniform.location, &mat4[0][0], sizeof(mat4))) {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat4[0][0]);
+    }
+}
+
+/*
+ * @brief read a uniform block from the buffer range bound to a binding point
+ * @param name name of the block
+ * @param binding uniform buffer binding point
+ */
+void Shader::bindUniformBlock(const std::string& name, GLuint binding) {
+    // a program still being built gets its blocks bound once it is linked
+    if (_ready) {
+        applyUniformBlock(name, binding);
+    }
+
+    _blockBindings.emplace_back(name, binding);
+    for (auto& variant : _variants) {
+        if (variant.second) {
+            variant.second->bindUniformBlock(name, binding);
+        }
+    }
+}
+
+/*
+ * @brief bind a uniform block of the linked program to a binding point
+ * @param name name of the block
+ * @param binding uniform buffer binding point
+ */
+void Shader::applyUniformBlock(const std::string& name, GLuint binding) {
+    const GLuint index = glGetUniformBlockIndex(_id, name.c_str());
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(_id, index, binding);
+    }
+}
+
+/*
+ * @brief whether the program is linked
+ * @return true once the program can be used
+ */
+bool Shader::isReady() const {
+    return _ready;
+}
+
+/*
+ * @brief finish building the program if the driver is done with it
+ * @return true once the program is ready
+ */
+bool Shader::poll() {
+    if (_ready) {
+        return true;
+    }
+    if (_id == 0 || !ShaderBuildQueue::instance().isComplete(_id)) {
+        return false;
+    }
+
+    finishShaderProgram();
+    return true;
+}
+
+/*
+ * @brief get the variant of the shader with the features of a mask defined
+ * @param features bit i set defines features[i] of the shader
+ * @return this shader for mask 0, otherwise a variant submitted to the build queue on the first call with its mask
+ */
+Shader& Shader::getVariant(uint32_t features) {
+    features = maskFeatures(features);
+    if (features == 0) {
+        return *this;
+    }
+
+    std::unique_ptr<Shader>& variant = _variants[features];
+    if (!variant) {
+        std::string defines;
+        for (size_t i = 0; i < _features.size(); ++i) {
+            if (features & (1u << i)) {
+                defines += "#define " + _features[i] + "\n";
+            }
+        }
+
+        std::unique_ptr<Shader> compiled(new Shader);
+        compiled->_blockBindings = _blockBindings;
+        compiled->submitShaderProgram(addDefines(_vsCode, defines), addDefines(_fsCode, defines));
+        if (compiled->_ready) {
+            for (const auto& block : _blockBindings) {
+                compiled->applyUniformBlock(block.first, block.second);
+            }
+        } else {
+            ShaderBuildQueue::instance().add(compiled.get());
+        }
+        variant = std::move(compiled);
+    }
+
+    return *variant;
+}
+
+/*
+ * @brief get the variant of the shader to draw with now
+ * @param features bit i set defines features[i] of the shader
+ * @return the variant of the mask when it is ready, else the ready variant with the most of its features and no
+ *         other, nullptr while there is none; a missing variant is submitted either way
+ */
+Shader* Shader::getReadyVariant(uint32_t features) {
+    features = maskFeatures(features);
+    Shader& variant = getVariant(features);
+    if (variant._ready) {
+        return &variant;
+    }
+
+    Shader* fallback = _ready ? this : nullptr;
+    size_t fallbackFeatures = 0;
+    for (const auto& other : _variants) {
+        if (!other.second || !other.second->_ready || (other.first & ~features) != 0) {
+            continue;
+        }
+
+        size_t count = 0;
+        for (uint32_t bits = other.first; bits != 0; bits &= bits - 1) {
+            ++count;
+        }
+        if (count > fallbackFeatures) {
+            fallback = other.second.get();
+            fallbackFeatures = count;
+        }
+    }
+
+    return fallback;
+}
+
+/*
+ * @brief number of variants built so far
+ * @return the ready variants in the cache and this shader if it is ready
+ */
+size_t Shader::getVariantCount() const {
+    size_t count = _ready ? 1 : 0;
+    for (const auto& variant : _variants) {
+        if (variant.second && variant.second->_ready) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*
+ * @brief clear the bits of a mask past the features of the shader
+ * @param features variant mask
+ * @return the mask of the features the shader has
+ */
+uint32_t Shader::maskFeatures(uint32_t features) const {
+    if (_features.size() < 32) {
+        features &= (1u << _features.size()) - 1;
+    }
+    return features;
+}
+
+/*
+ * @brief insert #define lines into shader code
+ * @param code shader code, starting with its #version line if it has one
+ * @param defines the #define lines
+ * @return the code with the defines after the #version line, which has to stay the first one
+ */
+std::string Shader::addDefines(const std::string& code, const std::string& defines) {
+    size_t position = 0;
+    if (code.compare(0, 8, "#version") == 0) {
+        position = code.find('\n');
+        if (position == std::string::npos) {
+            return code + "\n" + defines;
+        }
+        ++position;
+    }
+
+    return code.substr(0, position) + defines + code.substr(position);
+}
+
+/*
+ * @brief location of a uniform variable from the table
+ * @param name name of the variable
+ * @return the location, -1 when the program has no active variable by that name
+ */
+GLint Shader::getUniformLocation(const std::string& name) const {
+    auto it = _uniforms.find(name);
+    return it == _uniforms.end() ? -1 : it->second.location;
 }
 
 /*
@@ -138,10 +511,10 @@ std::string Shader::readFile(const std::string& filePath) {
 }
 
 /*
- * @brief create a vertex / fragment shader
+ * @brief create a vertex / fragment shader and start compiling it
  * @param code shader code of the shader
  * @param shaderType type of the shader
- * @return the shader handle
+ * @return the shader handle, its status is checked by checkShader()
  */
 GLuint Shader::createShader(const std::string& code, GLenum shaderType) {
     GLuint shader = glCreateShader(shaderType);
@@ -153,6 +526,15 @@ GLuint Shader::createShader(const std::string& code, GLenum shaderType) {
     glShaderSource(shader, 1, &codeBuf, nullptr);
     glCompileShader(shader);
 
+    return shader;
+}
+
+/*
+ * @brief check that a vertex / fragment shader compiled
+ * @param shader the shader handle
+ * @param code shader code of the shader, printed on error
+ */
+void Shader::checkShader(GLuint shader, const std::string& code) {
     GLint success;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -161,37 +543,75 @@ GLuint Shader::createShader(const std::string& code, GLenum shaderType) {
         std::cerr << code << std::endl;
         throw std::runtime_error("compile error: \n" + std::string(buffer));
     }
-
-    return shader;
 }
 
 /*
- * @brief create a shader program
+ * @brief create a shader program, waiting until it is linked
  * @param vsCode vertex shader code
  * @param fsCode fragment shader code
  */
 void Shader::createShaderProgram(const std::string& vsCode, const std::string& fsCode) {
-    GLuint vs = 0, fs = 0;
-    try {
-        vs = createShader(vsCode, GL_VERTEX_SHADER);
-        if (!vs) {
-            throw std::runtime_error("create vertex shader failure");
-        }
+    submitShaderProgram(vsCode, fsCode);
+    if (!_ready) {
+        finishShaderProgram();
+    }
+}
 
-        fs = createShader(fsCode, GL_FRAGMENT_SHADER);
-        if (!fs) {
-            throw std::runtime_error("create fragment shader failure");
-        }
+/*
+ * @brief load a shader program from the program cache, or start compiling and linking it
+ * @param vsCode vertex shader code
+ * @param fsCode fragment shader code
+ */
+void Shader::submitShaderProgram(const std::string& vsCode, const std::string& fsCode) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    ProgramCache& cache = ProgramCache::instance();
+
+    // a program linked by an earlier run skips compiling and linking
+    _build.key = cache.makeKey(vsCode, fsCode);
+    _id = cache.load(_build.key);
+    if (_id != 0) {
+        readUniforms();
+        _ready = true;
+        cache.addSetupTime(std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count());
+        return;
+    }
+
+    // no status is queried here, which would wait for the driver to finish
+    try {
+        _build.vs = createShader(vsCode, GL_VERTEX_SHADER);
+        _build.fs = createShader(fsCode, GL_FRAGMENT_SHADER);
 
         _id = glCreateProgram();
         if (_id == 0) {
             throw std::runtime_error("create shader program failure");
         }
 
-        glAttachShader(_id, vs);
-        glAttachShader(_id, fs);
+        glAttachShader(_id, _build.vs);
+        glAttachShader(_id, _build.fs);
 
+        cache.prepare(_id);
         glLinkProgram(_id);
+    } catch (const std::exception&) {
+        deleteBuild();
+        throw;
+    }
+
+    _build.vsCode = vsCode;
+    _build.fsCode = fsCode;
+    cache.addSetupTime(std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count());
+}
+
+/*
+ * @brief check the submitted shader program, waiting for the driver if it is not done
+ */
+void Shader::finishShaderProgram() {
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    try {
+        checkShader(_build.vs, _build.vsCode);
+        checkShader(_build.fs, _build.fsCode);
 
         GLint success;
         glGetProgramiv(_id, GL_LINK_STATUS, &success);
@@ -201,12 +621,66 @@ void Shader::createShaderProgram(const std::string& vsCode, const std::string& f
             throw std::runtime_error("link program error: " + std::string(buffer));
         }
 
-        glDeleteShader(vs);
-        glDeleteShader(fs);
-    } catch (const std::exception& e) {
-        if (vs) glDeleteShader(vs);
-        if (fs) glDeleteShader(fs);
-        if (_id) glDeleteProgram(_id);
-        throw e;
+        readUniforms();
+        ProgramCache::instance().store(_build.key, _id);
+    } catch (const std::exception&) {
+        deleteBuild();
+        throw;
+    }
+
+    glDeleteShader(_build.vs);
+    glDeleteShader(_build.fs);
+    _build = Build();
+    _ready = true;
+
+    // blocks were bound by name while the program was not linked yet
+    for (const auto& block : _blockBindings) {
+        applyUniformBlock(block.first, block.second);
+    }
+
+    ProgramCache::instance().addSetupTime(std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count());
+}
+
+/*
+ * @brief delete the shaders and program of a build that failed or is abandoned
+ */
+void Shader::deleteBuild() {
+    if (_build.vs) glDeleteShader(_build.vs);
+    if (_build.fs) glDeleteShader(_build.fs);
+    if (_id) glDeleteProgram(_id);
+    _id = 0;
+    _build = Build();
+}
+
+/*
+ * @brief fill the uniform table with the active uniform variables of the linked program
+ */
+void Shader::readUniforms() {
+    _uniforms.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> buffer(std::max(maxLength, 1));
+
+    for (GLint i = 0; i < count; ++i) {
+        GLint size = 0;
+        GLenum type = 0;
+        GLsizei length = 0;
+        glGetActiveUniform(_id, i, static_cast<GLsizei>(buffer.size()), &length, &size, &type, buffer.data());
+        const std::string name(buffer.data(), length);
+
+        // members of uniform blocks have no location
+        const GLint location = glGetUniformLocation(_id, name.c_str());
+        if (location < 0) {
+            continue;
+        }
+
+        _uniforms[name] = { location, type };
+        // arrays are listed as name[0], their first element is set by the plain name as well
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+            _uniforms[name.substr(0, name.size() - 3)] = { location, type };
+        }
     }
-}
\ No newline at end of file
+}
@@ -1,15 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
 class Shader {
 public:
+    /*
+     * @brief handle of a uniform variable of type T, set by the set() overload taking it
+     */
+    template <typename T>
+    struct Uniform {
+        GLint location = -1;
+    };
+
     /*
      * @brief constructor, take string as shader code to create opengl shader
      */
@@ -20,6 +33,13 @@ public:
      */
     Shader(const std::string& vsFilepath, const std::string& fsFilepath);
 
+    /*
+     * @brief constructor, take string as code of a shader with compile-time features; the variant of a mask
+     *        has feature i #define'd for every set bit i, this shader is the variant with none of them. the
+     *        variants are built by the ShaderBuildQueue, not ready to be used until it has finished them
+     */
+    Shader(const char* vsCode, const char* fsCode, const std::vector<std::string>& features);
+
     /*
      * @brief move constructor
      */
@@ -35,6 +55,17 @@ public:
      */
     void use();
 
+    /*
+     * @brief whether the program is linked and can be used, shaders without features are once constructed
+     */
+    bool isReady() const;
+
+    /*
+     * @brief finish building the program if the driver is done with it, true once it is ready;
+     *        throws on compile and link errors as the constructors do
+     */
+    bool poll();
+
     /*
      * @brief set bool uniform variable to shader
      */
@@ -75,22 +106,151 @@ public:
      */
     void setMat4(const std::string& name, const glm::mat4& mat4) const;
 
+    /*
+     * @brief get the handle of an active uniform variable, location -1 when there is none by that name
+     */
+    template <typename T>
+    Uniform<T> getUniform(const std::string& name) const;
+
+    /*
+     * @brief set uniform variables through handles, without looking up names
+     */
+    void set(Uniform<bool> uniform, bool value) const;
+
+    void set(Uniform<int> uniform, int value) const;
+
+    void set(Uniform<float> uniform, float value) const;
+
+    void set(Uniform<glm::vec2> uniform, const glm::vec2& v2) const;
+
+    void set(Uniform<glm::vec3> uniform, const glm::vec3& v3) const;
+
+    void set(Uniform<glm::vec4> uniform, const glm::vec4& v4) const;
+
+    void set(Uniform<glm::mat3> uniform, const glm::mat3& mat3) const;
+
+    void set(Uniform<glm::mat4> uniform, const glm::mat4& mat4) const;
+
+    /*
+     * @brief read a uniform block from the buffer range bound to binding point binding
+     */
+    void bindUniformBlock(const std::string& name, GLuint binding);
+
+    /*
+     * @brief get the variant with the features of a mask, compiled the first time it is asked for;
+     *        bits past the features of the shader are ignored
+     */
+    Shader& getVariant(uint32_t features);
+
+    /*
+     * @brief get the variant with the features of a mask if it is ready, otherwise the ready variant with the most
+     *        of them and no other, to draw with until it is; nullptr while none is ready
+     */
+    Shader* getReadyVariant(uint32_t features);
+
+    /*
+     * @brief number of variants built so far, this shader included
+     */
+    size_t getVariantCount() const;
+
 private:
+    /* location and type of an active uniform variable */
+    struct UniformInfo {
+        GLint location;
+        GLenum type;
+    };
+
     /* shader program handle */
     GLuint _id = 0;
 
+    /* active uniform variables by name, read from the program once it is linked */
+    std::unordered_map<std::string, UniformInfo> _uniforms;
+
+    /* code and feature names the variants are compiled from, empty for a shader without features */
+    std::string _vsCode, _fsCode;
+    std::vector<std::string> _features;
+
+    /* variants by feature mask, mask 0 is this shader itself */
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> _variants;
+
+    /* uniform block binding points, given to variants compiled later as well */
+    std::vector<std::pair<std::string, GLuint>> _blockBindings;
+
+    /* shaders, cache key and code of a program submitted but not checked yet */
+    struct Build {
+        GLuint vs = 0;
+        GLuint fs = 0;
+        uint64_t key = 0;
+        std::string vsCode, fsCode;
+    };
+
+    Build _build;
+
+    /* whether the program is linked, set when its build is finished */
+    bool _ready = false;
+
+    /*
+     * @brief constructor of a variant, its program is created by getVariant()
+     */
+    Shader() = default;
+
+    /*
+     * @brief insert #define lines after the #version line of shader code
+     */
+    static std::string addDefines(const std::string& code, const std::string& defines);
+
+    /*
+     * @brief clear the bits of a variant mask past the features of the shader
+     */
+    uint32_t maskFeatures(uint32_t features) const;
+
+    /*
+     * @brief bind a uniform block of the linked program to a binding point
+     */
+    void applyUniformBlock(const std::string& name, GLuint binding);
+
+    /*
+     * @brief location of a uniform variable, -1 when the program has none by that name
+     */
+    GLint getUniformLocation(const std::string& name) const;
+
+    /*
+     * @brief fill the uniform table from the linked program
+     */
+    void readUniforms();
+
     /*
      * @brief read shader code from file
      */
     std::string readFile(const std::string& filePath);
 
     /*
-     * @brief create a vertex / fragment shader
+     * @brief create a vertex / fragment shader and start compiling it
      */
     GLuint createShader(const std::string& code, GLenum shaderType);
 
     /*
-     * @brief create a shader program
+     * @brief check that a vertex / fragment shader compiled
+     */
+    void checkShader(GLuint shader, const std::string& code);
+
+    /*
+     * @brief create a shader program, waiting until it is linked
      */
     void createShaderProgram(const std::string& vsCode, const std::string& fsCode);
+
+    /*
+     * @brief load a shader program from the program cache or start building it, without waiting for the driver
+     */
+    void submitShaderProgram(const std::string& vsCode, const std::string& fsCode);
+
+    /*
+     * @brief check the submitted shader program and read its uniforms, waiting for the driver if it is not done
+     */
+    void finishShaderProgram();
+
+    /*
+     * @brief delete the shaders and program of a build that failed or is abandoned
+     */
+    void deleteBuild();
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <algorithm>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "shader_build_queue.h"
+
+// GL_KHR_parallel_shader_compile, the ARB extension has the same values; not part of the gl 3.3 loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+	typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+}
+
+ShaderBuildQueue& ShaderBuildQueue::instance() {
+	static ShaderBuildQueue queue;
+	return queue;
+}
+
+bool ShaderBuildQueue::enableParallel(GLADloadproc load) {
+	MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+	if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+	} else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+		maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+	}
+
+	// 0xffffffff leaves the number of threads to the driver
+	if (maxShaderCompilerThreads != nullptr) {
+		maxShaderCompilerThreads(0xffffffffu);
+	}
+
+	_parallel = maxShaderCompilerThreads != nullptr;
+	return _parallel;
+}
+
+bool ShaderBuildQueue::isParallel() const {
+	return _parallel;
+}
+
+bool ShaderBuildQueue::isComplete(GLuint program) const {
+	if (!_parallel) {
+		return true;
+	}
+
+	GLint complete = GL_FALSE;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete != GL_FALSE;
+}
+
+void ShaderBuildQueue::add(Shader* shader) {
+	_pending.push_back(shader);
+}
+
+void ShaderBuildQueue::remove(Shader* shader) {
+	_pending.erase(std::remove(_pending.begin(), _pending.end(), shader), _pending.end());
+}
+
+size_t ShaderBuildQueue::update() {
+	size_t finished = 0;
+	for (auto it = _pending.begin(); it != _pending.end();) {
+		// without the extension finishing a program waits until the driver has built it
+		if (!_parallel && finished > 0) {
+			break;
+		}
+
+		bool ready = false;
+		try {
+			ready = (*it)->poll();
+		} catch (...) {
+			// the shader has dropped its program, it is not polled again
+			_pending.erase(it);
+			throw;
+		}
+
+		if (ready) {
+			it = _pending.erase(it);
+			++finished;
+		} else {
+			++it;
+		}
+	}
+
+	return _pending.size();
+}
+
+size_t ShaderBuildQueue::getPendingCount() const {
+	return _pending.size();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+class Shader;
+
+// shaders whose programs are compiled and linked in the background, submitted at once and finished by update()
+// between frames, so no frame waits on the driver; with GL_KHR_parallel_shader_compile the driver builds them on
+// its own threads and GL_COMPLETION_STATUS_KHR tells when one is done, without it update() finishes one program
+// per call, waiting for it, so the waits are spread over the frames
+class ShaderBuildQueue {
+public:
+	static ShaderBuildQueue& instance();
+
+	ShaderBuildQueue(const ShaderBuildQueue&) = delete;
+
+	ShaderBuildQueue& operator=(const ShaderBuildQueue&) = delete;
+
+	// with the context current, let the driver compile on as many threads as it likes when it has the
+	// KHR or ARB parallel shader compile extension, returns false if it does not
+	bool enableParallel(GLADloadproc load);
+
+	bool isParallel() const;
+
+	// whether querying the status of the linked program returns without waiting for the driver
+	bool isComplete(GLuint program) const;
+
+	// a shader whose program is submitted but not finished, until it is ready or removed
+	void add(Shader* shader);
+
+	void remove(Shader* shader);
+
+	// finish the programs the driver is done with, errors are thrown as by the shader constructor;
+	// returns the number of shaders still pending
+	size_t update();
+
+	size_t getPendingCount() const;
+
+private:
+	std::vector<Shader*> _pending;
+
+	bool _parallel = false;
+
+	ShaderBuildQueue() = default;
+};
@@ -1,3 +1,4 @@
+#include "gl_state.h"
 #include "skybox.h"
 
 SkyBox::SkyBox(const std::vector<std::string>& textureFilenames) {
@@ -49,14 +50,14 @@ SkyBox::SkyBox(const std::vector<std::string>& textureFilenames) {
     glGenVertexArrays(1, &_vao);
     glGenBuffers(1, &_vbo);
 
-    glBindVertexArray(_vao);
+    GLStateCache::instance().bindVertexArray(_vao);
     glBindBuffer(GL_ARRAY_BUFFER, _vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
 
-    glBindVertexArray(0);
+    GLStateCache::instance().bindVertexArray(0);
 
     try {
         // init texture
@@ -110,9 +111,8 @@ void SkyBox::draw(const glm::mat4& projection, const glm::mat4& view) {
     glm::mat4 view2 = glm::mat4(glm::mat3(view));
     _shader->setMat4("view", view2);
  
-    glBindVertexArray(_vao);
-    glActiveTexture(GL_TEXTURE0);
-    _texture->bind();
+    GLStateCache::instance().bindVertexArray(_vao);
+    _texture->bindToUnit(0);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glDepthFunc(GL_LESS);
     
@@ -126,6 +126,7 @@ void SkyBox::cleanup() {
     }
 
     if (_vao != 0) {
+        GLStateCache::instance().forgetVertexArray(_vao);
         glDeleteVertexArrays(1, &_vao);
         _vao = 0;
     }
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 
+#include "gl_state.h"
 #include "texture.h"
 
 Texture::Texture() {
@@ -10,6 +13,7 @@ Texture::Texture() {
 Texture::~Texture() {
 	// destroy texture object
 	if (_handle != 0) {
+		GLStateCache::instance().forgetTexture(_handle);
 		glDeleteTextures(1, &_handle);
 		_handle = 0;
 	}
@@ -17,45 +21,93 @@ Texture::~Texture() {
 
 void Texture::cleanup() {
 	if (_handle != 0) {
+		GLStateCache::instance().forgetTexture(_handle);
 		glDeleteTextures(1, &_handle);
 		_handle = 0;
 	}
 }
 
-Texture2D::Texture2D(const std::string path): _path(path) {
-	// load image to the memory
-	stbi_set_flip_vertically_on_load(true);
-	int width = 0, height = 0, channels = 0;
-	unsigned char* data = stbi_load(_path.c_str(), &width, &height, &channels, 0);
-	if (data == nullptr) {
-		glDeleteTextures(1, &_handle);
-		_handle = 0;
+void Texture::bindToUnit(GLuint unit) const {
+	GLStateCache::instance().activeTexture(unit);
+	bind();
+}
+
+TextureImage::TextureImage(const std::string& path) {
+	// load image to the memory; images are loaded on the asynchronous loader's workers too, the flag is set
+	// for the calling thread only instead of the global one they would all write
+	stbi_set_flip_vertically_on_load_thread(true);
+	_pixels.reset(stbi_load(path.c_str(), &_width, &_height, &_channels, 0));
+	if (_pixels == nullptr) {
 		throw std::runtime_error("load " + path + " failure");
 	}
+}
+
+int TextureImage::getWidth() const {
+	return _width;
+}
+
+int TextureImage::getHeight() const {
+	return _height;
+}
+
+int TextureImage::getChannels() const {
+	return _channels;
+}
+
+const unsigned char* TextureImage::getPixels() const {
+	return _pixels.get();
+}
+
+size_t TextureImage::getPitch() const {
+	return _width * _channels * sizeof(unsigned char);
+}
+
+Texture2D::Texture2D(const std::string path)
+	: Texture2D(std::make_shared<const TextureImage>(path)) {
+	_path = path;
+	upload();
+}
 
+Texture2D::Texture2D(std::shared_ptr<const TextureImage> image) : _pending(image) {
 	// choose image format
-	GLenum format = GL_RGB;
-	switch (channels) {
-	case 1: format = GL_RED;  break;
-	case 3: format = GL_RGB;  break;
-	case 4: format = GL_RGBA; break;
+	switch (image->getChannels()) {
+	case 1: _format = GL_RED;  break;
+	case 3: _format = GL_RGB;  break;
+	case 4: _format = GL_RGBA; break;
 	default:
 		cleanup();
-		stbi_image_free(data);
 		throw std::runtime_error("unsupported format");
 	}
 
 	// set texture parameters
-	glBindTexture(GL_TEXTURE_2D, _handle);
+	bind();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-	// transfer data to gpu
+	// allocate the storage, the rows follow in upload()
+	glTexImage2D(GL_TEXTURE_2D, 0, _format, image->getWidth(), image->getHeight(), 0, _format, GL_UNSIGNED_BYTE, nullptr);
+	_byteSize = image->getPitch() * image->getHeight();
+
+	// unbind texture
+	unbind();
+}
+
+bool Texture2D::upload(size_t maxBytes) {
+	if (_pending == nullptr) {
+		return true;
+	}
+
+	// transfer data to gpu, at least one row per call
+	const size_t pitch = _pending->getPitch();
+	const int rows = static_cast<int>(std::min<size_t>(_pending->getHeight() - _uploadedRows,
+		std::max<size_t>(maxBytes / pitch, 1)));
+
+	bind();
+
 	// 1. set alignment for data transfer
 	GLint alignment = 1;
-	size_t pitch = width * channels * sizeof(unsigned char);
 	if (pitch % 8 == 0)      alignment = 8;
 	else if (pitch % 4 == 0) alignment = 4;
 	else if (pitch % 2 == 0) alignment = 2;
@@ -64,16 +116,15 @@ Texture2D::Texture2D(const std::string path): _path(path) {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
 
 	// 2. transfer data
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, _uploadedRows, _pending->getWidth(), rows, _format, GL_UNSIGNED_BYTE,
+		_pending->getPixels() + _uploadedRows * pitch);
+	_uploadedRows += rows;
 
 	// 3. restore alignment
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
 	// unbind texture
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// free data
-	stbi_image_free(data);
+	unbind();
 
 	GLenum error = glGetError();
 	if (error != GL_NO_ERROR) {
@@ -82,14 +133,25 @@ Texture2D::Texture2D(const std::string path): _path(path) {
 		cleanup();
 		throw std::runtime_error(ss.str());
 	}
+
+	// free data
+	if (_uploadedRows == _pending->getHeight()) {
+		_pending.reset();
+		return true;
+	}
+	return false;
 }
 
 void Texture2D::bind() const {
-	glBindTexture(GL_TEXTURE_2D, _handle);
+	GLStateCache::instance().bindTexture(GL_TEXTURE_2D, _handle);
 }
 
 void Texture2D::unbind() const {
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLStateCache::instance().bindTexture(GL_TEXTURE_2D, 0);
+}
+
+size_t Texture2D::getByteSize() const {
+	return _byteSize;
 }
 
 TextureCubemap::TextureCubemap(const std::vector<std::string>& filenames)
@@ -99,8 +161,10 @@ TextureCubemap::TextureCubemap(const std::vector<std::string>& filenames)
 	// write your code to generate texture cubemap
 	//unsigned int textureID;
 	glGenTextures(1, &_handle);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, _handle);
+	bind();
 
+	// flipped like the 2d textures, which used to leave the global flag set before the skybox was loaded
+	stbi_set_flip_vertically_on_load_thread(true);
 	int width, height, nrChannels;
 	for (unsigned int i = 0; i < filenames.size(); i++)
 	{
@@ -124,9 +188,9 @@ TextureCubemap::TextureCubemap(const std::vector<std::string>& filenames)
 }
 
 void TextureCubemap::bind() const {
-	glBindTexture(GL_TEXTURE_CUBE_MAP, _handle);
+	GLStateCache::instance().bindTexture(GL_TEXTURE_CUBE_MAP, _handle);
 }
 
 void TextureCubemap::unbind() const {
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	GLStateCache::instance().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -7,6 +9,29 @@
 #include <glad/glad.h>
 #include <stb_image.h>
 
+// pixels of an image file decoded on the cpu, loading needs no gl context so it can run on any thread
+class TextureImage {
+public:
+	TextureImage(const std::string& path);
+
+	int getWidth() const;
+
+	int getHeight() const;
+
+	int getChannels() const;
+
+	const unsigned char* getPixels() const;
+
+	// bytes between the starts of two rows
+	size_t getPitch() const;
+
+private:
+	int _width = 0;
+	int _height = 0;
+	int _channels = 0;
+	std::unique_ptr<unsigned char, void (*)(void*)> _pixels{ nullptr, stbi_image_free };
+};
+
 class Texture {
 public:
 	Texture();
@@ -17,6 +42,9 @@ public:
 
 	virtual void unbind() const = 0;
 
+	// bind to texture unit unit, through the gl state cache like bind()
+	void bindToUnit(GLuint unit) const;
+
 protected:
 	GLuint _handle = {};
 
@@ -27,14 +55,32 @@ class Texture2D : public Texture {
 public:
 	Texture2D(const std::string path);
 
+	// allocates the texture, the pixels are transferred by upload()
+	explicit Texture2D(std::shared_ptr<const TextureImage> image);
+
 	~Texture2D() = default;
 
+	// transfer up to maxBytes of pending rows, true once the whole image is on the gpu
+	bool upload(size_t maxBytes = SIZE_MAX);
+
 	void bind() const override;
 
 	virtual void unbind() const;
 
+	// bytes of the decoded image uploaded to the gpu
+	size_t getByteSize() const;
+
 private:
 	std::string _path;
+
+	size_t _byteSize = 0;
+
+	// image still being transferred and its first row not on the gpu yet
+	std::shared_ptr<const TextureImage> _pending;
+
+	int _uploadedRows = 0;
+
+	GLenum _format = GL_RGB;
 };
 
 class TextureCubemap : public Texture {
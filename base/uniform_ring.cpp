@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstring>
+
+#include "gl_state.h"
+#include "uniform_ring.h"
+
+UniformRing::~UniformRing() {
+	for (GLsync& fence : _fences) {
+		if (fence != nullptr) {
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	if (_buffer != 0) {
+		GLStateCache::instance().forgetBuffer(_buffer);
+		glDeleteBuffers(1, &_buffer);
+		_buffer = 0;
+	}
+}
+
+void UniformRing::begin() {
+	if (_alignment == 0) {
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		_alignment = std::max<GLint>(alignment, 16);
+	}
+
+	_region = (_region + 1) % kFrames;
+	GLsync& fence = _fences[_region];
+	if (fence != nullptr) {
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			++_waits;
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	_data.clear();
+}
+
+size_t UniformRing::push(const void* data, size_t size) {
+	const size_t offset = (_data.size() + _alignment - 1) / _alignment * _alignment;
+	_data.resize(offset + size);
+	std::memcpy(_data.data() + offset, data, size);
+	return offset;
+}
+
+void UniformRing::flush() {
+	if (_data.empty()) {
+		return;
+	}
+
+	if (_data.size() > _regionSize) {
+		// the new storage is not read by any frame yet, so the fences of the old one are dropped with it
+		for (GLsync& fence : _fences) {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+		if (_buffer != 0) {
+			GLStateCache::instance().forgetBuffer(_buffer);
+			glDeleteBuffers(1, &_buffer);
+		}
+
+		_regionSize = std::max<size_t>(_regionSize * 2, 64 * 1024);
+		_regionSize = std::max(_regionSize, (_data.size() + _alignment - 1) / _alignment * _alignment);
+		glGenBuffers(1, &_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+		glBufferData(GL_UNIFORM_BUFFER, kFrames * _regionSize, nullptr, GL_STREAM_DRAW);
+	} else {
+		glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+	}
+
+	// no frame in flight reads this region, so the driver need not synchronize the write
+	void* mapped = glMapBufferRange(GL_UNIFORM_BUFFER, _region * _regionSize, _data.size(),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (mapped != nullptr) {
+		std::memcpy(mapped, _data.data(), _data.size());
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	} else {
+		glBufferSubData(GL_UNIFORM_BUFFER, _region * _regionSize, _data.size(), _data.data());
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRing::bindRange(GLuint binding, size_t offset, size_t size) {
+	GLStateCache::instance().bindUniformBuffer(binding, _buffer, _region * _regionSize + offset, size);
+}
+
+void UniformRing::end() {
+	if (_buffer != 0) {
+		_fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+size_t UniformRing::getFrameBytes() const {
+	return _data.size();
+}
+
+size_t UniformRing::getWaits() const {
+	return _waits;
+}
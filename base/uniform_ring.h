@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+// uniform block data of a frame, gathered on the cpu and uploaded with one buffer update; the buffer holds
+// kFrames regions written in turn, and a region is only rewritten once the fence of the frame that read it
+// last has passed, so the update is unsynchronized and never stalls on the gpu
+class UniformRing {
+public:
+	static const size_t kFrames = 3;
+
+	UniformRing() = default;
+
+	~UniformRing();
+
+	UniformRing(const UniformRing&) = delete;
+
+	UniformRing& operator=(const UniformRing&) = delete;
+
+	// start the data of a frame in the next region, waiting only when the gpu still reads it
+	void begin();
+
+	// append size bytes aligned for binding, returning their offset among the data of the frame
+	size_t push(const void* data, size_t size);
+
+	template <typename T>
+	size_t push(const T& value) {
+		return push(&value, sizeof(T));
+	}
+
+	// upload the data pushed since begin(), the buffer grows when the region is too small for it
+	void flush();
+
+	// bind the uploaded data at offset to uniform block binding point binding
+	void bindRange(GLuint binding, size_t offset, size_t size);
+
+	// after the draws reading the frame's data, the region is reused once the gpu is past this point
+	void end();
+
+	// bytes uploaded by the last flush()
+	size_t getFrameBytes() const;
+
+	// times begin() had to wait for the gpu
+	size_t getWaits() const;
+
+private:
+	GLuint _buffer = 0;
+
+	size_t _regionSize = 0;
+
+	size_t _region = 0;
+
+	// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, read by the first begin()
+	size_t _alignment = 0;
+
+	std::vector<unsigned char> _data;
+
+	GLsync _fences[kFrames] = {};
+
+	size_t _waits = 0;
+};
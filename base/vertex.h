@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+
 #include <glm/glm.hpp>
 
 struct Vertex {
@@ -14,6 +17,30 @@ struct Vertex {
 	}
 };
 
+// 16-byte gpu vertex: position as unorm16 inside the mesh aabb, octahedral normal as int16
+// in [-32767, 32767] (converted in the shader, snorm conversion differs between gl versions),
+// texCoord as unorm16 when every uv of the mesh is in [0, 1], as half float otherwise
+struct PackedVertex {
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t texCoord[2];
+};
+
+// octahedral mapping of a unit vector onto [-1, 1]^2, a zero vector maps to +z
+inline glm::vec2 octEncode(const glm::vec3& n) {
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (sum == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+
+	glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+	if (n.z < 0.0f) {
+		glm::vec2 sign(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+		p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * sign;
+	}
+	return p;
+}
+
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
 
@@ -2,7 +2,9 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <iostream>
+#include <algorithm>
 #include <fstream>
+#include <tuple>
 #include "time.h"
 
 #include "texture_mapping.h"
@@ -27,63 +29,82 @@ const std::vector<std::string> skyboxTexturePaths = {
 	"../data/starfield/Back_Tex.jpg"
 };
 
+// linked shader programs of earlier runs
+const std::string shaderCachePath = "../data/shader_cache";
+
+// compile-time features of the shaders, in the order of Object::InstanceKey::textures
+const std::vector<std::string> textureMapFeatures = {
+	"ALBEDO_MAP", "NORMAL_MAP", "ROUGHNESS_MAP", "METALLIC_MAP", "AO_MAP"
+};
+
 Object::Object(std::string path_model, std::string name,
 	std::string path_albedo, std::string path_normal, std::string path_roughness,
-	std::string path_metallic, std::string path_ao): 
+	std::string path_metallic, std::string path_ao, const ModelOptions& model_options, AssetCache* assets,
+	AsyncLoader* loader):
 	objPath(path_model), Name(name),
 	texPathAlbedo(path_albedo), texPathNormal(path_normal), texPathRoughness(path_roughness),
 	texPathMetallic(path_metallic), texPathAO(path_ao)
 {
+	// with a loader the members are filled in by its update() once each asset is on the gpu
+	auto loadTexture = [this, assets, loader](const std::string& path, std::shared_ptr<Texture>& texture)
+	{
+		if (loader) loader->loadTexture(path, [&texture](std::shared_ptr<Texture2D> loaded) { texture = loaded; });
+		else if (assets) texture = assets->getTexture(path);
+		else texture = std::make_shared<Texture2D>(path);
+	};
+
 	if (path_model != "")
 	{
-		model.reset(new Model(path_model));
+		if (loader) loader->loadModel(path_model, model_options, [this](std::shared_ptr<Model> loaded) { model = loaded; });
+		else if (assets) model = assets->getModel(path_model, model_options);
+		else model.reset(new Model(path_model, model_options));
 	}
 	if (path_albedo != "")
 	{
-		_texAlbedo.reset(new Texture2D(path_albedo));
+		loadTexture(path_albedo, _texAlbedo);
 	}
 	else _showTexAlbedo = false;
 	if (path_normal != "")
 	{
-		_texNormal.reset(new Texture2D(path_normal));
+		loadTexture(path_normal, _texNormal);
 	}
 	else _showTexNormal = false;
 	if (path_roughness != "")
 	{
-		_texRoughness.reset(new Texture2D(path_roughness));
+		loadTexture(path_roughness, _texRoughness);
 	}
 	else _showTexRoughness = false;
 	if (path_metallic != "")
 	{
-		_texMetallic.reset(new Texture2D(path_metallic));
+		loadTexture(path_metallic, _texMetallic);
 	}
 	else _showTexMetallic = false;
 	if (path_ao != "")
 	{
-		_texAO.reset(new Texture2D(path_ao));
+		loadTexture(path_ao, _texAO);
 	}
 	else _showTexAO = false;
 }
 
 void Object::SetPosition(float x, float y, float z)
 {
-	model->position = glm::vec3(x, y, z);
+	transform.position = glm::vec3(x, y, z);
 }
 
 void Object::SetScale(float x, float y, float z)
 {
-	model->scale = glm::vec3(x, y, z);
+	transform.scale = glm::vec3(x, y, z);
 }
 
 void Object::SetRotation(glm::quat rotation)
 {
-	model->rotation = rotation;
+	transform.rotation = rotation;
 }
 
 void Object::SetRotation(glm::vec3 axis, float angle)
 {
-	model->rotation = glm::angleAxis(angle, axis) * glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
-	//std::cout << "SET: " << model->rotation.x << " " << model->rotation.y << " " << model->rotation.z << std::endl;
+	transform.rotation = glm::angleAxis(angle, axis) * glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
+	//std::cout << "SET: " << transform.rotation.x << " " << transform.rotation.y << " " << transform.rotation.z << std::endl;
 }
 
 std::shared_ptr<Model> Object::GetModel() const
@@ -93,116 +114,208 @@ std::shared_ptr<Model> Object::GetModel() const
 
 glm::vec3 Object::GetPosition() const
 {
-	return model->position;
+	return transform.position;
 }
 
 glm::vec3 Object::GetScale() const
 {
-	return model->scale;
+	return transform.scale;
 }
 
 glm::quat Object::GetRotation() const
 {
-	//std::cout << "GET: " << model->rotation.x << " " << model->rotation.y << " " << model->rotation.z << std::endl;
-	return model->rotation;
+	//std::cout << "GET: " << transform.rotation.x << " " << transform.rotation.y << " " << transform.rotation.z << std::endl;
+	return transform.rotation;
+}
+
+ObjectUniforms::ObjectUniforms(const Shader& shader)
+{
+	positionOffset = shader.getUniform<glm::vec3>("positionOffset");
+	positionScale = shader.getUniform<glm::vec3>("positionScale");
+	frameBlend = shader.getUniform<float>("frameBlend");
+	packedVertex = shader.getUniform<bool>("packedVertex");
+	instanced = shader.getUniform<bool>("instanced");
+	texAlbedo = shader.getUniform<int>("texAlbedo");
+	diffuse = shader.getUniform<int>("diffuse");
+	normal = shader.getUniform<int>("normal");
+	roughness = shader.getUniform<int>("roughness");
+	metallic = shader.getUniform<int>("metallic");
+	ao = shader.getUniform<int>("ao");
 }
 
-void Object::Render(std::shared_ptr<Shader> shader, RenderMode render_mode, float delta_time, std::shared_ptr<Texture> texture)
+// static objects do not animate, the frame time is used by sequences
+void Object::Render(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode, float, std::shared_ptr<Texture> texture)
 {
 	if (hidden && index_2048<0)
 		return;
 
+	// still loading, textures that are not there yet fall back to the material values
+	if (!model)
+		return;
+
 	//std::cout << "Rendering " << objPath << std::endl;
 
+	// the model matrix and material come from the object block bound for this draw
+	SetSharedState(shader, uniforms, render_mode, texture);
+
+	if (cullClusters && lod == 0)
+	{
+		model->drawClusters(transform, cullViewProjection, cullCameraPosition, &cullStats);
+	}
+	else
+	{
+		model->draw(lod);
+	}
+}
+
+bool Object::InstanceKey::operator<(const InstanceKey& other) const
+{
+	return std::tie(model, lod, textures[0], textures[1], textures[2], textures[3], textures[4]) <
+		std::tie(other.model, other.lod, other.textures[0], other.textures[1], other.textures[2], other.textures[3],
+			other.textures[4]);
+}
+
+uint32_t Object::GetTextureFeatures() const
+{
+	const std::string* paths[5] = { &texPathAlbedo, &texPathNormal, &texPathRoughness, &texPathMetallic, &texPathAO };
+	uint32_t features = 0;
+	for (size_t i = 0; i < 5; i++)
+	{
+		if (*paths[i] != "") features |= 1u << i;
+	}
+	return features;
+}
+
+uint32_t Object::InstanceKey::getFeatures() const
+{
+	uint32_t features = 0;
+	for (size_t i = 0; i < 5; i++)
+	{
+		if (textures[i]) features |= 1u << i;
+	}
+	return features;
+}
+
+bool Object::GetInstanceKey(RenderMode render_mode, std::shared_ptr<Texture> texture, InstanceKey* key) const
+{
+	*key = InstanceKey();
+	key->model = model.get();
+	key->lod = lod;
 	switch (render_mode) {
 	case RenderMode::Simple:
-		shader->setMat4("model", model->getModelMatrix());
-		shader->setVec3("albedo", Albedo);
-		shader->setBool("showAlbedo", _showTexAlbedo);
-		shader->setInt("texAlbedo", 0);
-		glActiveTexture(GL_TEXTURE0);
-		if (_showTexAlbedo && _texAlbedo)
-		{
-			_texAlbedo->bind();
-		}
+		if (_showTexAlbedo && _texAlbedo) key->textures[0] = _texAlbedo.get();
 		break;
 	case RenderMode::FBR:
-		shader->setMat4("model", model->getModelMatrix());
+		if (_showTexAlbedo && (ObjectType ? texture : _texAlbedo)) key->textures[0] = ObjectType ? texture.get() : _texAlbedo.get();
+		if (_showTexNormal && _texNormal) key->textures[1] = _texNormal.get();
+		if (_showTexRoughness && _texRoughness) key->textures[2] = _texRoughness.get();
+		if (_showTexMetallic && _texMetallic) key->textures[3] = _texMetallic.get();
+		if (_showTexAO && _texAO) key->textures[4] = _texAO.get();
+		break;
+	}
 
-		shader->setVec3("material.albedo", Albedo);
-		shader->setFloat("material.roughness", Roughness);
-		shader->setFloat("material.metallic", Metallic);
+	// hidden objects go through Render, which skips them; cluster culling works per object, so only models that
+	// have clusters to cull are left out of instancing
+	return !(hidden && index_2048 < 0) && model && !(cullClusters && lod == 0 && model->hasClusters());
+}
 
-		shader->setBool("showAlbedo", _showTexAlbedo);
-		shader->setBool("showNormal", _showTexNormal);
-		shader->setBool("showRoughness", _showTexRoughness);
-		shader->setBool("showMetallic", _showTexMetallic);
-		shader->setBool("showAO", _showTexAO);
+InstanceData Object::GetInstanceData() const
+{
+	InstanceData instance;
+	instance.model = transform.getModelMatrix();
+	instance.albedo = Albedo;
+	instance.material = glm::vec2(Roughness, Metallic);
+	instance.normal = glm::transpose(glm::inverse(glm::mat3(instance.model)));
+	return instance;
+}
 
-		shader->setInt("diffuse", 0);
-		shader->setInt("normal", 1);
-		shader->setInt("roughness", 2);
-		shader->setInt("metallic", 3);
-		shader->setInt("ao", 4);
+ObjectBlock Object::GetObjectBlock() const
+{
+	ObjectBlock block = {};
+	block.model = transform.getModelMatrix();
+	block.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(block.model))));
+	block.albedo = Albedo;
+	block.roughness = Roughness;
+	block.metallic = Metallic;
+	return block;
+}
+
+void Object::SetSharedState(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode, std::shared_ptr<Texture> texture)
+{
+	switch (render_mode) {
+	case RenderMode::Simple:
+		shader->set(uniforms.positionOffset, model->getPositionOffset());
+		shader->set(uniforms.positionScale, model->getPositionScale());
+		shader->set(uniforms.frameBlend, 0.0f);
+		shader->set(uniforms.texAlbedo, 0);
+		if (_showTexAlbedo && _texAlbedo)
+		{
+			_texAlbedo->bindToUnit(0);
+		}
+		break;
+	case RenderMode::FBR:
+		shader->set(uniforms.positionOffset, model->getPositionOffset());
+		shader->set(uniforms.positionScale, model->getPositionScale());
+		shader->set(uniforms.packedVertex, model->isPacked());
+		shader->set(uniforms.frameBlend, 0.0f);
+
+		// the maps sampled are compiled into the shader variant, picked from the instance key
+		shader->set(uniforms.diffuse, 0);
+		shader->set(uniforms.normal, 1);
+		shader->set(uniforms.roughness, 2);
+		shader->set(uniforms.metallic, 3);
+		shader->set(uniforms.ao, 4);
 
-		glActiveTexture(GL_TEXTURE0);
 		if (ObjectType)
 		{
-			texture->bind();
+			if (texture) texture->bindToUnit(0);
 		}
 		else if (_showTexAlbedo && _texAlbedo)
 		{
-			_texAlbedo->bind();
+			_texAlbedo->bindToUnit(0);
 		}
-		glActiveTexture(GL_TEXTURE1);
 		if (_showTexNormal && _texNormal)
 		{
-			_texNormal->bind();
+			_texNormal->bindToUnit(1);
 		}
-		glActiveTexture(GL_TEXTURE2);
 		if (_showTexRoughness && _texRoughness)
 		{
-			_texRoughness->bind();
+			_texRoughness->bindToUnit(2);
 		}
-		glActiveTexture(GL_TEXTURE3);
 		if (_showTexMetallic && _texMetallic)
 		{
-			_texMetallic->bind();
+			_texMetallic->bindToUnit(3);
 		}
-		glActiveTexture(GL_TEXTURE4);
 		if (_showTexAO && _texAO)
 		{
-			_texAO->bind();
+			_texAO->bindToUnit(4);
 		}
 		//----------------------------------------------------------------
 		break;
 	}
-
-	model->draw();
 }
 
 ObjectSequence::ObjectSequence(std::string path_model, int frame_num, int fps, std::string name,
 	std::string path_albedo, std::string path_normal, std::string path_roughness,
-	std::string path_metallic, std::string path_ao) :
-	Object("", name, path_albedo, path_normal, path_roughness, path_metallic, path_ao), frameNumber(frame_num), FPS(fps)
+	std::string path_metallic, std::string path_ao, AssetCache* assets, const MeshSequenceOptions& sequence_options) :
+	Object("", name, path_albedo, path_normal, path_roughness, path_metallic, path_ao, ModelOptions(), assets),
+	frameNumber(frame_num), FPS(fps)
 {
-	for (int i = 0; i < frame_num; i++)
-	{
-		std::string path = path_model + std::to_string(i) + ".obj";
-		std::shared_ptr<Model> model_frame;
-		model_frame.reset(new Model(path));
-		models.push_back(model_frame);
-	}
+	sequence = std::make_shared<MeshSequence>(path_model, frame_num, sequence_options);
 }
 
-void ObjectSequence::Render(std::shared_ptr<Shader> shader, RenderMode render_mode, float delta_time, std::shared_ptr<Texture> texture)
+// a sequence draws with its own albedo map, the shared texture of the base class is not used
+void ObjectSequence::Render(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode, float delta_time, std::shared_ptr<Texture>)
 {	
+	const float duration = (float)frameNumber / FPS;
 	currentTime += delta_time;
-	if (currentTime > FPS * frameNumber)
+	if (currentTime >= duration)
 	{
-		currentTime -= FPS * frameNumber;
+		currentTime = std::fmod(currentTime, duration);
 	}
-	currentFrame = (int)(currentTime * FPS) % frameNumber;
+	float framePosition = currentTime * FPS;
+	currentFrame = (int)framePosition % frameNumber;
+	frameBlend = framePosition - std::floor(framePosition);
 	
 	if (hidden)
 		return;
@@ -211,118 +324,73 @@ void ObjectSequence::Render(std::shared_ptr<Shader> shader, RenderMode render_mo
 
 	switch (render_mode) {
 	case RenderMode::Simple:
-		shader->setMat4("model", models[currentFrame]->getModelMatrix());
-		shader->setVec3("albedo", Albedo);
-		shader->setBool("showAlbedo", _showTexAlbedo);
-		shader->setInt("texAlbedo", 0);
-		glActiveTexture(GL_TEXTURE0);
+		shader->set(uniforms.positionOffset, sequence->getPositionOffset());
+		shader->set(uniforms.positionScale, sequence->getPositionScale());
+		shader->set(uniforms.frameBlend, frameBlend);
+		shader->set(uniforms.texAlbedo, 0);
 		if (_showTexAlbedo && _texAlbedo)
 		{
-			_texAlbedo->bind();
+			_texAlbedo->bindToUnit(0);
 		}
 		break;
 	case RenderMode::FBR:
-		shader->setMat4("model", models[currentFrame]->getModelMatrix());
-
-		shader->setVec3("material.albedo", Albedo);
-		shader->setFloat("material.roughness", Roughness);
-		shader->setFloat("material.metallic", Metallic);
-
-		shader->setBool("showAlbedo", _showTexAlbedo);
-		shader->setBool("showNormal", _showTexNormal);
-		shader->setBool("showRoughness", _showTexRoughness);
-		shader->setBool("showMetallic", _showTexMetallic);
-		shader->setBool("showAO", _showTexAO);
+		shader->set(uniforms.positionOffset, sequence->getPositionOffset());
+		shader->set(uniforms.positionScale, sequence->getPositionScale());
+		shader->set(uniforms.packedVertex, sequence->isQuantized());
+		shader->set(uniforms.frameBlend, frameBlend);
+
+		// the maps sampled are compiled into the shader variant, picked from the instance key
+		shader->set(uniforms.diffuse, 0);
+		shader->set(uniforms.normal, 1);
+		shader->set(uniforms.roughness, 2);
+		shader->set(uniforms.metallic, 3);
+		shader->set(uniforms.ao, 4);
 
-		shader->setInt("diffuse", 0);
-		shader->setInt("normal", 1);
-		shader->setInt("roughness", 2);
-		shader->setInt("metallic", 3);
-		shader->setInt("ao", 4);
-
-		glActiveTexture(GL_TEXTURE0);
 		if (_showTexAlbedo && _texAlbedo)
 		{
-			_texAlbedo->bind();
+			_texAlbedo->bindToUnit(0);
 		}
-		glActiveTexture(GL_TEXTURE1);
 		if (_showTexNormal && _texNormal)
 		{
-			_texNormal->bind();
+			_texNormal->bindToUnit(1);
 		}
-		glActiveTexture(GL_TEXTURE2);
 		if (_showTexRoughness && _texRoughness)
 		{
-			_texRoughness->bind();
+			_texRoughness->bindToUnit(2);
 		}
-		glActiveTexture(GL_TEXTURE3);
 		if (_showTexMetallic && _texMetallic)
 		{
-			_texMetallic->bind();
+			_texMetallic->bindToUnit(3);
 		}
-		glActiveTexture(GL_TEXTURE4);
 		if (_showTexAO && _texAO)
 		{
-			_texAO->bind();
+			_texAO->bindToUnit(4);
 		}
 		//----------------------------------------------------------------
 		break;
 	}
 
-	models[currentFrame]->draw();
-}
-
-void ObjectSequence::SetPosition(float x, float y, float z)
-{
-	for (auto& model : models)
-		model->position = glm::vec3(x, y, z);
-}
-
-void ObjectSequence::SetScale(float x, float y, float z)
-{
-	for (auto& model : models)
-		model->scale = glm::vec3(x, y, z);
-}
-
-void ObjectSequence::SetRotation(glm::quat rotation)
-{
-	for (auto& model : models)
-		model->rotation = rotation;
-}
-
-void ObjectSequence::SetRotation(glm::vec3 axis, float angle)
-{
-	for (auto& model : models)
-		model->rotation = glm::angleAxis(angle, axis) * glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
-}
-
-std::shared_ptr<Model> ObjectSequence::GetModel() const
-{
-	return models[currentFrame];
-}
-
-glm::vec3 ObjectSequence::GetPosition() const
-{
-	return models[0]->position;
-}
-
-glm::vec3 ObjectSequence::GetScale() const
-{
-	return models[0]->scale;
-}
-
-glm::quat ObjectSequence::GetRotation() const
-{
-	return models[0]->rotation;
+	sequence->draw(currentFrame, (currentFrame + 1) % frameNumber);
 }
 
-
 TextureMapping::TextureMapping() {
 	_windowTitle = "Texture Mapping";
 
+	// programs linked by an earlier run on the same driver are loaded instead of compiled
+	if (!ProgramCache::instance().open(shaderCachePath, (GLADloadproc)glfwGetProcAddress))
+		std::cout << "Program binaries not supported, shaders are compiled on every run" << std::endl;
+	// programs are built in the background and finished between frames
+	if (!ShaderBuildQueue::instance().enableParallel((GLADloadproc)glfwGetProcAddress))
+		std::cout << "Parallel shader compile not supported, one program is finished per frame" << std::endl;
+
 	std::cout << "Loading model.." << std::endl;
 
 	_pathModel = _pathAlbedo = _pathNormal = _pathMetallic = _pathRoughness = _pathAO = "";
+	_modelOptions.optimizeMesh = true;
+	_modelOptions.generateLods = true;
+	_modelOptions.buildClusters = true;
+	_arena = std::make_shared<GeometryArena>();
+	_modelOptions.arena = _arena;
 	
 	//create new 2048 bricks 
 	//for (int i = 0;i < _objects.size();i++) _objects[i]->hidden = true;
@@ -336,11 +404,17 @@ TextureMapping::TextureMapping() {
 	"../data/2048bricks/tex13.png",	"../data/2048bricks/tex14.png",
 	"../data/2048bricks/tex15.png",	"../data/2048bricks/tex16.png"
 	};
-	for(int i=0;i<16;i++) _texAlbedoList[i].reset(new Texture2D(s[i]));
+	// models and textures load in the background, renderFrame uploads them as they arrive
+	_loader.reset(new AsyncLoader(&_assets));
+	ModelOptions brickOptions;
+	brickOptions.arena = _arena;
+	for (int i = 0; i < 16; i++)
+		_loader->loadTexture(s[i], [this, i](std::shared_ptr<Texture2D> texture) { _texAlbedoList[i] = texture; });
 	float width = 2.2f, start = -3.3f;
 	for (int i = 0;i < 16;i++)
 	{
-		Object* brick = new Object("../data/cube.obj", "Cube", "../data/2048bricks/tex1.png");
+		Object* brick = new Object("../data/cube.obj", "Cube", "../data/2048bricks/tex1.png", "", "", "", "",
+			brickOptions, &_assets, _loader.get());
 		brick->ObjectType = 1;
 		brick->SetPosition(start + (i / 4) * width, 0.0f, start + (i % 4) * width);
 		brick->hidden = true;
@@ -389,10 +463,14 @@ TextureMapping::TextureMapping() {
 	//_showTexNormal = false;
 
 	// init shaders
+	_shaderSetupStart = std::chrono::high_resolution_clock::now();
 	initSimpleShader();
 
 	initFBRShader();
 
+	for (auto brick : _2048bricks)
+		requestShaderVariants(brick);
+
 	// init imgui
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
@@ -440,6 +518,32 @@ void TextureMapping::ParseArguments(int argc, char* argv[])
 			i++;
 			size = atof(argv[i]);
 		}
+		else if (!strcmp(argv[i], "-nooptimize")) {
+			_modelOptions.optimizeMesh = false;
+		}
+		else if (!strcmp(argv[i], "-pack")) {
+			_modelOptions.packVertices = true;
+		}
+		else if (!strcmp(argv[i], "-nolod")) {
+			_modelOptions.generateLods = false;
+		}
+		else if (!strcmp(argv[i], "-noarena")) {
+			_modelOptions.arena.reset();
+		}
+		else if (!strcmp(argv[i], "-sequence")) {
+			// -sequence <path prefix> <frame count>: frames are <path prefix>0.obj, <path prefix>1.obj, ...
+			i++;
+			_pathModel = argv[i];
+			i++;
+			_sequenceFrames = atoi(argv[i]);
+		}
+		else if (!strcmp(argv[i], "-stream")) {
+			_sequenceOptions.stream = true;
+		}
+		else if (!strcmp(argv[i], "-uploadbudget")) {
+			i++;
+			_uploadBudgetMs = (float)atof(argv[i]);
+		}
 	}
 	if (_pathModel == "")
 	{
@@ -460,11 +564,17 @@ void TextureMapping::ParseArguments(int argc, char* argv[])
 		"Metallic: " << _pathMetallic << std::endl <<
 		"AO: " << _pathAO << std::endl;
 
-	Object* obj = new Object(_pathModel, "Object",
-		_pathAlbedo, _pathNormal, _pathRoughness, _pathMetallic, _pathAO);
+	Object* obj;
+	if (_sequenceFrames > 0)
+		obj = new ObjectSequence(_pathModel, _sequenceFrames, 24, "Sequence",
+			_pathAlbedo, _pathNormal, _pathRoughness, _pathMetallic, _pathAO, &_assets, _sequenceOptions);
+	else
+		obj = new Object(_pathModel, "Object",
+			_pathAlbedo, _pathNormal, _pathRoughness, _pathMetallic, _pathAO, _modelOptions, &_assets, _loader.get());
 	obj->SetPosition(0.0f, 0.0f, 0.0f);
 	obj->SetScale(size, size, size);
 	_objects.push_back(obj);
+	requestShaderVariants(obj);
 
 }
 
@@ -475,28 +585,73 @@ void TextureMapping::initSimpleShader() {
 		"layout(location = 0) in vec3 aPosition;\n"
 		"layout(location = 1) in vec3 aNormal;\n"
 		"layout(location = 2) in vec2 aTexCoord;\n"
+		"layout(location = 3) in vec3 aNextPosition;\n"
+		"layout(location = 5) in mat4 aInstanceModel;\n"
+		"layout(location = 9) in vec3 aInstanceAlbedo;\n"
 		"out vec2 TexCoord;\n"
-		"uniform mat4 projection;\n"
-		"uniform mat4 view;\n"
-		"uniform mat4 model;\n"
+		"flat out vec3 InstanceAlbedo;\n"
+		"struct Material {\n"
+		"	vec3 albedo;\n"
+		"	float roughness;\n"
+		"	float metallic;\n"
+		"};\n"
+		"layout(std140) uniform FrameBlock {\n"
+		"	mat4 projection;\n"
+		"	mat4 view;\n"
+		"	vec4 cameraPosition;\n"
+		"};\n"
+		"layout(std140) uniform ObjectBlock {\n"
+		"	mat4 model;\n"
+		"	mat4 normalMatrix;\n"
+		"	Material material;\n"
+		"};\n"
+		"// instanced draws take the model matrix and the material from attributes 5-13 instead\n"
+		"uniform bool instanced;\n"
+		"// packed positions are unorm16 inside the mesh aabb, (0, 1) for float vertices\n"
+		"uniform vec3 positionOffset;\n"
+		"uniform vec3 positionScale;\n"
+		"// mesh sequences blend towards the next frame in attribute 3, 0 for models\n"
+		"uniform float frameBlend;\n"
 
 		"void main() {\n"
+		"	vec3 position = positionOffset + mix(aPosition, aNextPosition, frameBlend) * positionScale;\n"
+		"	mat4 world = instanced ? aInstanceModel : model;\n"
 		"	TexCoord = aTexCoord;\n"
-		"	gl_Position = projection * view * model * vec4(aPosition, 1.0f);\n"
+		"	InstanceAlbedo = aInstanceAlbedo;\n"
+		"	gl_Position = projection * view * world * vec4(position, 1.0f);\n"
 		"}\n";
 
 	const char* fragCode =
 		"#version 330 core\n"
 		"in vec2 TexCoord;\n"
+		"flat in vec3 InstanceAlbedo;\n"
 		"out vec4 color;\n"
+		"#ifdef ALBEDO_MAP\n"
 		"uniform sampler2D texAlbedo;\n"
-		"uniform bool showAlbedo;\n"
-		"uniform vec3 albedo;\n"
+		"#endif\n"
+		"struct Material {\n"
+		"	vec3 albedo;\n"
+		"	float roughness;\n"
+		"	float metallic;\n"
+		"};\n"
+		"layout(std140) uniform ObjectBlock {\n"
+		"	mat4 model;\n"
+		"	mat4 normalMatrix;\n"
+		"	Material material;\n"
+		"};\n"
+		"uniform bool instanced;\n"
 		"void main() {\n"
-		"	color = showAlbedo ? texture(texAlbedo, TexCoord) : vec4(albedo, 1.0);\n"
+		"#ifdef ALBEDO_MAP\n"
+		"	color = texture(texAlbedo, TexCoord);\n"
+		"#else\n"
+		"	color = vec4(instanced ? InstanceAlbedo : material.albedo, 1.0);\n"
+		"#endif\n"
 		"}\n";
 
-	_simpleShader.reset(new Shader(vertCode, fragCode));
+	// only the albedo map is sampled, the other bits select the same variant
+	_simpleShader.reset(new Shader(vertCode, fragCode, { textureMapFeatures[0] }));
+	_simpleShader->bindUniformBlock("FrameBlock", kFrameBlockBinding);
+	_simpleShader->bindUniformBlock("ObjectBlock", kObjectBlockBinding);
 }
 
 void TextureMapping::initFBRShader() {
@@ -505,18 +660,64 @@ void TextureMapping::initFBRShader() {
 		"layout(location = 0) in vec3 aPosition;\n"
 		"layout(location = 1) in vec3 aNormal;\n"
 		"layout(location = 2) in vec2 aTexCoord;\n"
+		"layout(location = 3) in vec3 aNextPosition;\n"
+		"layout(location = 4) in vec3 aNextNormal;\n"
+		"layout(location = 5) in mat4 aInstanceModel;\n"
+		"layout(location = 9) in vec3 aInstanceAlbedo;\n"
+		"layout(location = 10) in vec2 aInstanceMaterial;\n"
+		"layout(location = 11) in mat3 aInstanceNormal;\n"
 		"out vec3 FragPos;\n"
 		"out vec3 Normal;\n"
 		"out vec2 TexCoord;\n"
-		"uniform mat4 projection;\n"
-		"uniform mat4 view;\n"
-		"uniform mat4 model;\n"
+		"flat out vec3 InstanceAlbedo;\n"
+		"flat out vec2 InstanceMaterial;\n"
+		"struct Material {\n"
+		"	vec3 albedo;\n"
+		"	float roughness;\n"
+		"	float metallic;\n"
+		"};\n"
+		"layout(std140) uniform FrameBlock {\n"
+		"	mat4 projection;\n"
+		"	mat4 view;\n"
+		"	vec4 cameraPosition;\n"
+		"};\n"
+		"layout(std140) uniform ObjectBlock {\n"
+		"	mat4 model;\n"
+		"	mat4 normalMatrix;\n"
+		"	Material material;\n"
+		"};\n"
+		"// instanced draws take the model matrix and the material from attributes 5-13 instead\n"
+		"uniform bool instanced;\n"
+		"// packed positions are unorm16 inside the mesh aabb, (0, 1) for float vertices\n"
+		"uniform vec3 positionOffset;\n"
+		"uniform vec3 positionScale;\n"
+		"// packed normals are octahedral, two int16 in [-32767, 32767]\n"
+		"uniform bool packedVertex;\n"
+		"// mesh sequences blend towards the next frame in attributes 3/4, 0 for models\n"
+		"uniform float frameBlend;\n"
+
+		"vec3 octDecode(vec2 e) {\n"
+		"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+		"	if (n.z < 0.0) {\n"
+		"		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+		"	}\n"
+		"	return normalize(n);\n"
+		"}\n"
 
 		"void main() {\n"
-		"	FragPos = vec3(model * vec4(aPosition, 1.0f));\n"
-		"	Normal = mat3(transpose(inverse(model))) * aNormal;\n"
+		"	vec3 position = positionOffset + mix(aPosition, aNextPosition, frameBlend) * positionScale;\n"
+		"	vec3 normal = packedVertex ? octDecode(aNormal.xy / 32767.0) : aNormal;\n"
+		"	if (frameBlend > 0.0) {\n"
+		"		vec3 nextNormal = packedVertex ? octDecode(aNextNormal.xy / 32767.0) : aNextNormal;\n"
+		"		normal = mix(normal, nextNormal, frameBlend);\n"
+		"	}\n"
+		"	mat4 world = instanced ? aInstanceModel : model;\n"
+		"	FragPos = vec3(world * vec4(position, 1.0f));\n"
+		"	Normal = (instanced ? aInstanceNormal : mat3(normalMatrix)) * normal;\n"
 		"	TexCoord = aTexCoord;\n"
-		"	gl_Position = projection * view * model * vec4(aPosition, 1.0f);\n"
+		"	InstanceAlbedo = aInstanceAlbedo;\n"
+		"	InstanceMaterial = aInstanceMaterial;\n"
+		"	gl_Position = projection * view * world * vec4(position, 1.0f);\n"
 		"}\n";
 
 	//----------------------------------------------------------------
@@ -529,17 +730,19 @@ void TextureMapping::initFBRShader() {
 		"in vec3 FragPos;\n"
 		"in vec3 Normal;\n"
 		"in vec2 TexCoord;\n"
+		"flat in vec3 InstanceAlbedo;\n"
+		"flat in vec2 InstanceMaterial;\n"
 		"out vec4 color;\n"
 
-		"uniform vec3 CamPos;\n"
+		"uniform bool instanced;\n"
 
-		"// spot light data structure declaration\n"
+		"// spot light data structure declaration, the floats fill the vec3s up to std140 vec4 slots\n"
 		"struct SpotLight {\n"
 		"	vec3 position;\n"
-		"	vec3 direction;\n"
 		"	float intensity;\n"
-		"	vec3 color;\n"
+		"	vec3 direction;\n"
 		"	float angle;\n"
+		"	vec3 color;\n"
 		"	float kc;\n"
 		"	float kl;\n"
 		"	float kq;\n"
@@ -547,8 +750,8 @@ void TextureMapping::initFBRShader() {
 
 		"struct DirectionalLight {\n"
 		"	vec3 direction;\n"
-		"	vec3 color;\n"
 		"	float intensity;\n"
+		"	vec3 color;\n"
 		"};\n"
 
 		"struct Material {\n"
@@ -557,21 +760,37 @@ void TextureMapping::initFBRShader() {
 		"	float metallic;\n"
 		"};\n"
 
-		"uniform DirectionalLight directionalLight;\n"
-		"uniform SpotLight spotLight;\n"
-		"uniform Material material;\n"
+		"layout(std140) uniform FrameBlock {\n"
+		"	mat4 projection;\n"
+		"	mat4 view;\n"
+		"	vec4 cameraPosition;\n"
+		"};\n"
+		"layout(std140) uniform LightBlock {\n"
+		"	DirectionalLight directionalLight;\n"
+		"	SpotLight spotLight;\n"
+		"};\n"
+		"layout(std140) uniform ObjectBlock {\n"
+		"	mat4 model;\n"
+		"	mat4 normalMatrix;\n"
+		"	Material material;\n"
+		"};\n"
 
+		"// the maps sampled are compiled in, objects without one use the material value instead\n"
+		"#ifdef ALBEDO_MAP\n"
 		"uniform sampler2D diffuse;\n"
+		"#endif\n"
+		"#ifdef NORMAL_MAP\n"
 		"uniform sampler2D normal;\n"
+		"#endif\n"
+		"#ifdef ROUGHNESS_MAP\n"
 		"uniform sampler2D roughness;\n"
+		"#endif\n"
+		"#ifdef METALLIC_MAP\n"
 		"uniform sampler2D metallic;\n"
+		"#endif\n"
+		"#ifdef AO_MAP\n"
 		"uniform sampler2D ao;\n"
-
-		"uniform bool showAlbedo;\n"
-		"uniform bool showNormal;\n"
-		"uniform bool showRoughness;\n"
-		"uniform bool showMetallic;\n"
-		"uniform bool showAO;\n"
+		"#endif\n"
 
 		"const float PI = 3.14159265359;\n"
 
@@ -586,26 +805,23 @@ void TextureMapping::initFBRShader() {
 
 		"vec3 getNormalFromMap()\n"
 		"{\n"
-		"	if (showNormal)\n"
-		"	{\n"
-		"		vec3 tangentNormal = texture(normal, TexCoord).xyz * 2.0 - 1.0;\n"
-
-		"		vec3 Q1 = dFdx(FragPos);\n"
-		"		vec3 Q2 = dFdy(FragPos);\n"
-		"		vec2 st1 = dFdx(TexCoord);\n"
-		"		vec2 st2 = dFdy(TexCoord);\n"
-
-		"		vec3 N = normalize(Normal);\n"
-		"		vec3 T = normalize(Q1 * st2.t - Q2 * st1.t);\n"
-		"		vec3 B = -normalize(cross(N, T));\n"
-		"		mat3 TBN = mat3(T, B, N);\n"
-			
-		"		return normalize(TBN * tangentNormal);\n"
-		"   }\n"
-		"   else\n"
-		"	{\n"
-		"		return normalize(Normal);\n"
-		"	}\n"
+		"#ifdef NORMAL_MAP\n"
+		"	vec3 tangentNormal = texture(normal, TexCoord).xyz * 2.0 - 1.0;\n"
+
+		"	vec3 Q1 = dFdx(FragPos);\n"
+		"	vec3 Q2 = dFdy(FragPos);\n"
+		"	vec2 st1 = dFdx(TexCoord);\n"
+		"	vec2 st2 = dFdy(TexCoord);\n"
+
+		"	vec3 N = normalize(Normal);\n"
+		"	vec3 T = normalize(Q1 * st2.t - Q2 * st1.t);\n"
+		"	vec3 B = -normalize(cross(N, T));\n"
+		"	mat3 TBN = mat3(T, B, N);\n"
+
+		"	return normalize(TBN * tangentNormal);\n"
+		"#else\n"
+		"	return normalize(Normal);\n"
+		"#endif\n"
 		"}\n"
 
 		"// ----------------------------------------------------------------------------\n"
@@ -652,16 +868,35 @@ void TextureMapping::initFBRShader() {
 		"void main() {\n"
 		"	vec3 normal = normalize(Normal);\n"
 		"	// ambient color\n"
-		"	vec3 col_albedo = showAlbedo ? pow(texture(diffuse, TexCoord).rgb, vec3(2.2)) : pow(material.albedo, vec3(2.2));\n"
-		"	float col_roughness = showRoughness ? texture(roughness, TexCoord).r : material.roughness;\n"
-		"	float col_metallic = showMetallic ? texture(metallic, TexCoord).r : material.metallic;\n"
-		"	float col_ao = showAO ? texture(ao, TexCoord).r : 1.0;\n"
+		"	vec3 mat_albedo = instanced ? InstanceAlbedo : material.albedo;\n"
+		"	float mat_roughness = instanced ? InstanceMaterial.x : material.roughness;\n"
+		"	float mat_metallic = instanced ? InstanceMaterial.y : material.metallic;\n"
+		"#ifdef ALBEDO_MAP\n"
+		"	vec3 col_albedo = pow(texture(diffuse, TexCoord).rgb, vec3(2.2));\n"
+		"#else\n"
+		"	vec3 col_albedo = pow(mat_albedo, vec3(2.2));\n"
+		"#endif\n"
+		"#ifdef ROUGHNESS_MAP\n"
+		"	float col_roughness = texture(roughness, TexCoord).r;\n"
+		"#else\n"
+		"	float col_roughness = mat_roughness;\n"
+		"#endif\n"
+		"#ifdef METALLIC_MAP\n"
+		"	float col_metallic = texture(metallic, TexCoord).r;\n"
+		"#else\n"
+		"	float col_metallic = mat_metallic;\n"
+		"#endif\n"
+		"#ifdef AO_MAP\n"
+		"	float col_ao = texture(ao, TexCoord).r;\n"
+		"#else\n"
+		"	float col_ao = 1.0;\n"
+		"#endif\n"
 
 		"	vec3 N = getNormalFromMap();\n"
 		"	vec3 Lo = vec3(0.0);\n"
 		"	vec3 F0 = vec3(0.04);\n"
 		"	F0 = mix(F0, col_albedo, col_metallic);\n"
-		"	vec3 viewDir = normalize(CamPos-FragPos);\n"
+		"	vec3 viewDir = normalize(cameraPosition.xyz - FragPos);\n"
 		"	vec3 L = normalize(spotLight.position - FragPos);\n"
 		"	vec3 H = normalize(viewDir + L);\n"
 		"	float distance = length(spotLight.position - FragPos);\n"
@@ -707,7 +942,25 @@ void TextureMapping::initFBRShader() {
 	//----------------------------------------------------------------
 
 
-	_FBRShader.reset(new Shader(vertCode, fragCode));
+	_FBRShader.reset(new Shader(vertCode, fragCode, textureMapFeatures));
+	_FBRShader->bindUniformBlock("FrameBlock", kFrameBlockBinding);
+	_FBRShader->bindUniformBlock("LightBlock", kLightBlockBinding);
+	_FBRShader->bindUniformBlock("ObjectBlock", kObjectBlockBinding);
+}
+
+void TextureMapping::requestShaderVariants(const Object* obj) {
+	// the simple shader ignores the bits past its albedo map
+	const uint32_t features = obj->GetTextureFeatures();
+	_simpleShader->getVariant(features);
+	_FBRShader->getVariant(features);
+}
+
+const ObjectUniforms& TextureMapping::getUniforms(const Shader& shader) {
+	auto it = _variantUniforms.find(&shader);
+	if (it == _variantUniforms.end()) {
+		it = _variantUniforms.emplace(&shader, ObjectUniforms(shader)).first;
+	}
+	return it->second;
 }
 
 void TextureMapping::update() {
@@ -869,18 +1122,7 @@ void TextureMapping::handleInput() {
 		//collision detection
 		if (pd) {
 			//std::cout << _camera->position.x << " " << _camera->position.y << " " << _camera->position.z << std::endl;
-			pd = 0;
-			for (auto obj : _objects)
-			{
-				if (pd) break;
-				if (obj->GetModel()->inside(_camera->position)) pd = 1;
-			}
-			for (auto obj : _2048bricks)
-			{
-				if (pd) break;
-				if (obj->GetModel()->inside(_camera->position)) pd = 1;
-			}
-			if (pd) _camera->position = temp;
+			_camera->position = collideCamera(temp, _camera->position);
 		}
 
 		if (_mouseInput.move.xCurrent != _mouseInput.move.xOld) {
@@ -943,6 +1185,45 @@ void TextureMapping::handleInput() {
 	}
 }
 
+glm::vec3 TextureMapping::collideCamera(const glm::vec3& from, const glm::vec3& to) const
+{
+	// the camera is a small sphere, it stops at the first surface on its way and slides along it once
+	const float cameraRadius = 0.05f;
+	glm::vec3 position = from;
+	glm::vec3 move = to - from;
+	for (int i = 0; i < 2; i++)
+	{
+		MeshHit first, hit;
+		first.t = 1.0f;
+
+		// only objects whose bounds touch the box around the whole sweep are tested triangle by triangle
+		const glm::vec3 sweepMin = glm::min(position, position + move) - glm::vec3(cameraRadius);
+		const glm::vec3 sweepMax = glm::max(position, position + move) + glm::vec3(cameraRadius);
+		for (auto list : { &_objects, &_2048bricks })
+		{
+			for (auto obj : *list)
+			{
+				// sequences have no model and no collision, asynchronous loads none until they are done
+				std::shared_ptr<Model> model = obj->GetModel();
+				if (!model) continue;
+
+				glm::vec3 center, extent;
+				transformBounds(obj->transform.getModelMatrix(), glm::vec3(model->minx, model->miny, model->minz),
+					glm::vec3(model->maxx, model->maxy, model->maxz), &center, &extent);
+				if (glm::any(glm::lessThan(center + extent, sweepMin)) || glm::any(glm::greaterThan(center - extent, sweepMax))) continue;
+
+				if (model->sweepSphere(obj->transform, position, cameraRadius, move, &hit) && hit.t < first.t) first = hit;
+			}
+		}
+
+		position += move * first.t;
+		if (first.t >= 1.0f) break;
+		move *= 1.0f - first.t;
+		move -= glm::dot(move, first.normal) * first.normal;
+	}
+	return position;
+}
+
 void TextureMapping::renderFrame() {
 	// some options related to imGUI
 	static bool wireframe = false;
@@ -954,47 +1235,67 @@ void TextureMapping::renderFrame() {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
 
+	// imgui binds its own program, vertex array and texture behind the state cache's back
+	GLStateCache::instance().invalidate();
+	GLStateCache::instance().resetStats();
+
 	if (wireframe) {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	} else {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	}
 
+	// hand finished loads to their objects, the transfers stop once the budget is spent
+	_loader->update(_uploadBudgetMs);
+
+	// programs the driver has finished become usable, draws use a fallback variant until then
+	if (ShaderBuildQueue::instance().update() == 0 && !_shaderSetupReported)
+	{
+		// reported once everything requested at startup is built, including the variants of the main object
+		const ProgramCacheStats& programStats = ProgramCache::instance().getStats();
+		const float readyMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - _shaderSetupStart).count();
+		std::cout << "Shader setup: all programs ready after " << readyMs << " ms, " << programStats.setupMs << " ms spent building, " <<
+			programStats.hits << " programs from cache, " << programStats.misses << " compiled" << std::endl;
+		_shaderSetupReported = true;
+	}
+
 	const glm::mat4& projection = _camera->getProjectionMatrix();
 	const glm::mat4& view = _camera->getViewMatrix();
 
+	// camera and lights go to the uniform ring once per frame, the objects' blocks follow as they are queued
+	_uniformRing.begin();
+	FrameBlock frameBlock;
+	frameBlock.projection = projection;
+	frameBlock.view = view;
+	frameBlock.cameraPosition = glm::vec4(_camera->position, 1.0f);
+	const size_t frameBlockOffset = _uniformRing.push(frameBlock);
+	LightBlock lightBlock = {};
+	lightBlock.directionalDirection = _directionalLight->getFront();
+	lightBlock.directionalIntensity = _directionalLight->intensity;
+	lightBlock.directionalColor = _directionalLight->color;
+	lightBlock.spotPosition = _spotLight->position;
+	lightBlock.spotIntensity = _spotLight->intensity;
+	lightBlock.spotDirection = _spotLight->getFront();
+	lightBlock.spotAngle = _spotLight->angle;
+	lightBlock.spotColor = _spotLight->color;
+	lightBlock.spotKc = _spotLight->kc;
+	lightBlock.spotKl = _spotLight->kl;
+	lightBlock.spotKq = _spotLight->kq;
+	const size_t lightBlockOffset = _uniformRing.push(lightBlock);
+
 	switch (_renderMode) {
 	case RenderMode::Simple:
-		// 1. use the shader
-		_simpleShader->use();
-		// 2. transfer mvp matrices to gpu 
-		_simpleShader->setMat4("projection", projection);
-		_simpleShader->setMat4("view", view);
+		// 1. every draw uses the shader variant for its maps
+		// 2. mvp matrices are in the frame and object blocks
 		//_simpleShader->setMat4("model", _extintor->getModelMatrix());
 		// 3. enable textures and transform textures to gpu
 		/*glActiveTexture(GL_TEXTURE0);
 		_texAlbedo->bind();*/
 		break;
 	case RenderMode::FBR:
-		// 1. use the shader
-		_FBRShader->use();
-		// 2. transfer mvp matrices to gpu 
-		_FBRShader->setMat4("projection", projection);
-		_FBRShader->setMat4("view", view);
+		// 1. every draw uses the shader variant for its maps
+		// 2. mvp matrices, camera position and light attributes are in the frame, light and object blocks
 		/*_FBRShader->setMat4("model", _extintor->getModelMatrix());*/
-		_FBRShader->setVec3("CamPos", _camera->position);
-		// 3. transfer light attributes to the shader
-		_FBRShader->setVec3("spotLight.position", _spotLight->position);
-		_FBRShader->setVec3("spotLight.direction", _spotLight->getFront());
-		_FBRShader->setFloat("spotLight.intensity", _spotLight->intensity);
-		_FBRShader->setVec3("spotLight.color", _spotLight->color);
-		_FBRShader->setFloat("spotLight.angle", _spotLight->angle);
-		_FBRShader->setFloat("spotLight.kc", _spotLight->kc);
-		_FBRShader->setFloat("spotLight.kl", _spotLight->kl);
-		_FBRShader->setFloat("spotLight.kq", _spotLight->kq);
-		_FBRShader->setVec3("directionalLight.direction", _directionalLight->getFront());
-		_FBRShader->setFloat("directionalLight.intensity", _directionalLight->intensity);
-		_FBRShader->setVec3("directionalLight.color", _directionalLight->color);
 		
 		//_FBRShader->setVec3("material.albedo", _albedo);
 		//_FBRShader->setFloat("material.roughness", _roughness);
@@ -1066,45 +1367,231 @@ void TextureMapping::renderFrame() {
 
 	/*_extintor->draw();*/
 
+	// pick the coarsest level of detail whose error stays below one pixel
+	const float pixelsPerUnit = 0.5f * _windowHeight / std::tan(0.5f * _camera->fovy);
+	ClusterCullStats cullStats;
 	for (auto obj : _objects)
 	{
-		switch (_renderMode) {
-		case RenderMode::Simple:
-			obj->Render(_simpleShader, RenderMode::Simple, _deltaTime,obj->_texAlbedo);
-			break;
-		case RenderMode::FBR:
-			obj->Render(_FBRShader, RenderMode::FBR, _deltaTime, obj->_texAlbedo);
-			break;
+		if (obj->GetModel()) obj->lod = obj->GetModel()->selectLod(obj->transform, _camera->position, pixelsPerUnit);
+		obj->cullClusters = _cullClusters;
+		obj->cullViewProjection = projection * view;
+		obj->cullCameraPosition = _camera->position;
+		obj->cullStats = ClusterCullStats();
+	}
+
+	// objects whose world space box is outside the view are skipped, objects without a model are always drawn
+	struct ObjectBounds {
+		Object* obj;
+		size_t box;
+		glm::vec3 center, extent;
+		// drawn into the depth buffer this frame, never tested against it
+		bool occluding = false;
+	};
+	std::vector<ObjectBounds> bounds;
+	glm::vec4 frustum[6];
+	_camera->getFrustumPlanes(frustum);
+	_frustumCuller.clear();
+	for (auto list : { &_objects, &_2048bricks })
+	{
+		for (auto obj : *list)
+		{
+			obj->culled = false;
+			std::shared_ptr<Model> model = obj->GetModel();
+			if (!model)
+				continue;
+
+			ObjectBounds objBounds;
+			objBounds.obj = obj;
+			transformBounds(obj->transform.getModelMatrix(), glm::vec3(model->minx, model->miny, model->minz),
+				glm::vec3(model->maxx, model->maxy, model->maxz), &objBounds.center, &objBounds.extent);
+			if (_cullObjects) objBounds.box = _frustumCuller.add(objBounds.center, objBounds.extent);
+			bounds.push_back(objBounds);
 		}
-		
+	}
+	if (_cullObjects)
+	{
+		_frustumCuller.cull(frustum);
+		for (auto& objBounds : bounds)
+		{
+			objBounds.obj->culled = !_frustumCuller.isVisible(objBounds.box);
+		}
+	}
+
+	// the remaining ones are tested against a software depth buffer holding the large objects, drawn
+	// at the coarsest level of detail whose error stays below one of its pixels
+	_occlusionCuller.begin(projection * view);
+	if (_cullOcclusion)
+	{
+		const float occluderPixelsPerUnit = 0.5f * _occlusionCuller.getHeight() / std::tan(0.5f * _camera->fovy);
+		for (auto& objBounds : bounds)
+		{
+			Object* obj = objBounds.obj;
+			if (obj->culled || (obj->hidden && obj->index_2048 < 0))
+				continue;
+			if (!obj->occluder && _occlusionCuller.getScreenCoverage(objBounds.center, objBounds.extent) < _occluderCoverage)
+				continue;
+
+			std::shared_ptr<Model> model = obj->GetModel();
+			const size_t occluderLod = model->selectLod(obj->transform, _camera->position, occluderPixelsPerUnit);
+			const std::vector<uint32_t>& indices = model->getLodIndices(occluderLod);
+			_occlusionCuller.addOccluder(obj->transform.getModelMatrix(), model->_vertices, indices.data(), indices.size());
+			objBounds.occluding = true;
+		}
+		_occlusionCuller.rasterize();
+
+		for (auto& objBounds : bounds)
+		{
+			Object* obj = objBounds.obj;
+			// a coarse level of detail may stick out of the box's nearest depth and hide its own object
+			if (!obj->culled && !objBounds.occluding && !(obj->hidden && obj->index_2048 < 0))
+				obj->culled = _occlusionCuller.isOccluded(objBounds.center, objBounds.extent);
+		}
+	}
+
+	// objects that can share a draw are collected here and drawn after the others
+	struct InstanceCandidate {
+		Object::InstanceKey key;
+		Object* obj;
+		std::shared_ptr<Texture> texture;
+	};
+	std::vector<InstanceCandidate> candidates;
+	std::shared_ptr<Shader> shader = _renderMode == RenderMode::Simple ? _simpleShader : _FBRShader;
+
+	// every draw uses the shader variant sampling just the maps of its key, built when first needed; until it is
+	// the ready variant closest to it is used, and the draw is skipped while not even the plain shader is ready
+	auto variantOf = [&](const Object::InstanceKey& key)
+	{
+		Shader* variant = shader->getReadyVariant(key.getFeatures());
+		return variant ? std::shared_ptr<Shader>(shader, variant) : std::shared_ptr<Shader>();
+	};
+
+	// the draws are queued and issued sorted, so objects sharing variants, textures and meshes follow each other
+	_renderQueue.clear();
+	auto packetKey = [&](const Shader* variant, const Object::InstanceKey& key, const void* mesh,
+		const glm::vec3& position)
+	{
+		uint64_t textures = 14695981039346656037ull;
+		for (const Texture* texture : key.textures)
+			textures = (textures ^ reinterpret_cast<uintptr_t>(texture)) * 1099511628211ull;
+		return RenderQueue::makeKey(_renderQueue.getId(RenderQueue::Field::Shader, variant),
+			_renderQueue.getId(RenderQueue::Field::Material, textures), _renderQueue.getId(RenderQueue::Field::Mesh, mesh),
+			glm::distance(position, _camera->position) / _camera->zfar);
+	};
+	auto queueRender = [&](Object* obj, std::shared_ptr<Texture> texture, const Object::InstanceKey& key)
+	{
+		const void* mesh = key.model ? static_cast<const void*>(key.model) : obj;
+		std::shared_ptr<Shader> variant = variantOf(key);
+		if (!variant)
+			return;
+		const ObjectUniforms* uniforms = &getUniforms(*variant);
+		const size_t block = _uniformRing.push(obj->GetObjectBlock());
+		_renderQueue.push(packetKey(variant.get(), key, mesh, obj->transform.position),
+			[this, variant, uniforms, obj, texture, block]()
+		{
+			_uniformRing.bindRange(kObjectBlockBinding, block, sizeof(ObjectBlock));
+			variant->use();
+			obj->Render(variant, *uniforms, _renderMode, _deltaTime, texture);
+		});
+	};
+	auto submit = [&](Object* obj, std::shared_ptr<Texture> texture)
+	{
 		if (obj->texPathAlbedo != "")		obj->_showTexAlbedo = _showTexAlbedo;
 		if (obj->texPathNormal != "")		obj->_showTexNormal = _showTexNormal;
 		if (obj->texPathRoughness != "")	obj->_showTexRoughness = _showTexRoughness;
 		if (obj->texPathMetallic != "")		obj->_showTexMetallic = _showTexMetallic;
 		if (obj->texPathAO != "")			obj->_showTexAO = _showTexAO;
 
+		if (obj->culled)
+			return;
+
+		InstanceCandidate candidate;
+		if (obj->GetInstanceKey(_renderMode, texture, &candidate.key) && _instancing)
+		{
+			candidate.obj = obj;
+			candidate.texture = texture;
+			candidates.push_back(candidate);
+		}
+		else
+		{
+			queueRender(obj, texture, candidate.key);
+		}
+	};
+
+	for (auto obj : _objects)
+	{
+		submit(obj, obj->_texAlbedo);
 	}
 
 	//draw 2048 bricks
 	for (auto obj : _2048bricks)
 	{
-		switch (_renderMode) {
-		case RenderMode::Simple:
-			obj->Render(_simpleShader, RenderMode::Simple, _deltaTime, _texAlbedoList[mx(obj->index_2048,0)]);
-			break;
-		case RenderMode::FBR:
-			obj->Render(_FBRShader, RenderMode::FBR, _deltaTime, _texAlbedoList[mx(obj->index_2048, 0)]);
-			break;
+		submit(obj, _texAlbedoList[mx(obj->index_2048, 0)]);
+	}
+
+	// one instanced draw for every key shared by several objects, the others are drawn one by one
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const InstanceCandidate& a, const InstanceCandidate& b) { return a.key < b.key; });
+	std::vector<InstanceData> instances;
+	instances.reserve(candidates.size());
+	for (const InstanceCandidate& candidate : candidates)
+	{
+		instances.push_back(candidate.obj->GetInstanceData());
+	}
+	if (!instances.empty())
+	{
+		_instances.upload(instances);
+	}
+
+	_instancedDraws = _instancedObjects = 0;
+	for (size_t first = 0; first < candidates.size();)
+	{
+		size_t last = first + 1;
+		while (last < candidates.size() && !(candidates[first].key < candidates[last].key)) last++;
+
+		InstanceCandidate& candidate = candidates[first];
+		if (last - first == 1)
+		{
+			queueRender(candidate.obj, candidate.texture, candidate.key);
 		}
-		if (obj->texPathAlbedo != "")		obj->_showTexAlbedo = _showTexAlbedo;
-		if (obj->texPathNormal != "")		obj->_showTexNormal = _showTexNormal;
-		if (obj->texPathRoughness != "")	obj->_showTexRoughness = _showTexRoughness;
-		if (obj->texPathMetallic != "")		obj->_showTexMetallic = _showTexMetallic;
-		if (obj->texPathAO != "")			obj->_showTexAO = _showTexAO;
+		else if (std::shared_ptr<Shader> variant = variantOf(candidate.key))
+		{
+			Object* obj = candidate.obj;
+			std::shared_ptr<Texture> texture = candidate.texture;
+			const size_t lod = candidate.key.lod, count = last - first;
+			// the instances read their blocks' values from attributes, a block is still bound for the draw
+			const ObjectUniforms* uniforms = &getUniforms(*variant);
+			const size_t block = _uniformRing.push(obj->GetObjectBlock());
+			_renderQueue.push(packetKey(variant.get(), candidate.key, candidate.key.model, obj->transform.position),
+				[this, variant, uniforms, obj, texture, lod, first, count, block]()
+			{
+				_uniformRing.bindRange(kObjectBlockBinding, block, sizeof(ObjectBlock));
+				variant->use();
+				obj->SetSharedState(variant, *uniforms, _renderMode, texture);
+				variant->set(uniforms->instanced, true);
+				obj->model->drawInstanced(lod, _instances, first, count);
+				variant->set(uniforms->instanced, false);
+			});
+			_instancedDraws++;
+			_instancedObjects += count;
+		}
+		first = last;
+	}
+
+	// one upload for every block of the frame, the draws then only bind their ranges
+	_uniformRing.flush();
+	_uniformRing.bindRange(kFrameBlockBinding, frameBlockOffset, sizeof(FrameBlock));
+	_uniformRing.bindRange(kLightBlockBinding, lightBlockOffset, sizeof(LightBlock));
+	_renderQueue.execute();
+	_uniformRing.end();
+
+	for (auto obj : _objects)
+	{
+		cullStats.add(obj->cullStats);
 	}
 
 	// draw skybox
 	_skybox->draw(projection, view);
+	_glStats = GLStateCache::instance().getStats();
 
 	// draw ui elements
 	ImGui_ImplOpenGL3_NewFrame();
@@ -1155,6 +1642,99 @@ void TextureMapping::renderFrame() {
 		ImGui::Checkbox("AO", &_showTexAO);
 		ImGui::NewLine();
 
+		for (auto obj : _objects)
+		{
+			ObjectSequence* seq = dynamic_cast<ObjectSequence*>(obj);
+			if (!seq || !seq->sequence->isStreamed()) continue;
+			MeshSequenceStreamStats streamStats = seq->sequence->getStreamStats();
+			ImGui::Text("Sequence Streaming");
+			ImGui::Separator();
+			ImGui::Text("frame: %d / %d", seq->currentFrame, seq->frameNumber);
+			ImGui::Text("loaded: %zu, underruns: %zu", streamStats.framesLoaded, streamStats.underruns);
+			ImGui::NewLine();
+		}
+
+		const AsyncLoaderStats& loaderStats = _loader->getStats();
+		ImGui::Text("Loading");
+		ImGui::Separator();
+		ImGui::SliderFloat("upload budget (ms)", &_uploadBudgetMs, 0.5f, 16.0f);
+		ImGui::Text("pending: %zu, failed: %zu", _loader->getPendingCount(), loaderStats.failed);
+		ImGui::Text("models: %zu, textures: %zu", loaderStats.modelsLoaded, loaderStats.texturesLoaded);
+		ImGui::Text("longest update: %.2f ms", loaderStats.maxUpdateMs);
+		ImGui::NewLine();
+
+		ImGui::Text("Frustum Culling");
+		ImGui::Separator();
+		ImGui::Checkbox("cull objects", &_cullObjects);
+		ImGui::Text("visible: %zu, culled: %zu", _frustumCuller.getVisibleCount(),
+			_frustumCuller.getCount() - _frustumCuller.getVisibleCount());
+		ImGui::NewLine();
+
+		const OcclusionCullStats& occlusionStats = _occlusionCuller.getStats();
+		ImGui::Text("Occlusion Culling");
+		ImGui::Separator();
+		ImGui::Checkbox("cull hidden objects", &_cullOcclusion);
+		ImGui::SliderFloat("occluder coverage", &_occluderCoverage, 0.0f, 1.0f);
+		ImGui::Text("occluders: %zu, triangles: %zu", occlusionStats.occluders, occlusionStats.rasterizedTriangles);
+		ImGui::Text("tested: %zu, occluded: %zu", occlusionStats.tested, occlusionStats.occluded);
+		ImGui::Text("rasterize: %.2f ms", occlusionStats.rasterizeMs);
+		ImGui::NewLine();
+
+		ImGui::Text("Instancing");
+		ImGui::Separator();
+		ImGui::Checkbox("instanced draws", &_instancing);
+		ImGui::Text("draws: %zu, objects: %zu", _instancedDraws, _instancedObjects);
+		ImGui::NewLine();
+
+		ImGui::Text("Render Queue");
+		ImGui::Separator();
+		bool stateCache = GLStateCache::instance().isEnabled();
+		if (ImGui::Checkbox("skip redundant state", &stateCache))
+			GLStateCache::instance().setEnabled(stateCache);
+		ImGui::Text("packets: %zu", _renderQueue.getCount());
+		ImGui::Text("state changes: %zu, skipped: %zu", _glStats.getIssued(), _glStats.getSkipped());
+		ImGui::Text("programs: %zu / %zu", _glStats.programChanges, _glStats.programsSkipped);
+		ImGui::Text("vertex arrays: %zu / %zu", _glStats.vertexArrayChanges, _glStats.vertexArraysSkipped);
+		ImGui::Text("textures: %zu / %zu", _glStats.textureChanges, _glStats.texturesSkipped);
+		ImGui::Text("uniforms: %zu / %zu", _glStats.uniformChanges, _glStats.uniformsSkipped);
+		ImGui::Text("uniform buffers: %zu / %zu", _glStats.uniformBufferChanges, _glStats.uniformBuffersSkipped);
+		ImGui::Text("uniform ring: %zu bytes/frame, gpu waits: %zu", _uniformRing.getFrameBytes(), _uniformRing.getWaits());
+		ImGui::Text("shader variants: %zu simple, %zu fbr", _simpleShader->getVariantCount(), _FBRShader->getVariantCount());
+		ImGui::Text("shaders building: %zu, parallel compile: %s", ShaderBuildQueue::instance().getPendingCount(),
+			ShaderBuildQueue::instance().isParallel() ? "yes" : "no");
+		const ProgramCacheStats& programStats = ProgramCache::instance().getStats();
+		ImGui::Text("shader setup: %.1f ms, cached: %zu, compiled: %zu, rejected: %zu", programStats.setupMs,
+			programStats.hits, programStats.misses, programStats.rejected);
+		ImGui::NewLine();
+
+		ImGui::Text("Cluster Culling");
+		ImGui::Separator();
+		ImGui::Checkbox("enabled", &_cullClusters);
+		ImGui::Text("clusters: %zu", cullStats.clusters);
+		ImGui::Text("frustum culled: %zu", cullStats.frustumCulled);
+		ImGui::Text("backface culled: %zu", cullStats.backfaceCulled);
+		ImGui::Text("triangles: %zu / %zu", cullStats.trianglesSubmitted, cullStats.trianglesTotal);
+		ImGui::NewLine();
+
+		if (_arena != nullptr) {
+			const GeometryArenaStats arenaStats = _arena->getStats();
+			ImGui::Text("Geometry Arena");
+			ImGui::Separator();
+			ImGui::Text("vertices: %.1f / %.1f MB", arenaStats.vertexBytesUsed / (1024.0 * 1024.0),
+				arenaStats.vertexBytes / (1024.0 * 1024.0));
+			ImGui::Text("indices: %.1f / %.1f MB", arenaStats.indexBytesUsed / (1024.0 * 1024.0),
+				arenaStats.indexBytes / (1024.0 * 1024.0));
+			ImGui::Text("allocations: %zu, grows: %zu", arenaStats.allocations, arenaStats.grows);
+			ImGui::NewLine();
+		}
+
+		const AssetCacheStats& assetStats = _assets.getStats();
+		ImGui::Text("Assets");
+		ImGui::Separator();
+		ImGui::Text("loaded: %zu, shared: %zu", assetStats.misses, assetStats.hits);
+		ImGui::Text("saved: %.1f MB", assetStats.bytesSaved / (1024.0 * 1024.0));
+		ImGui::NewLine();
+
 		if (ImGui::Button("Screenshot", ImVec2(80.0f, 20.0f)))
 		{
 			//std::cout << "Button Clicked\n";
@@ -1294,6 +1874,7 @@ void TextureMapping::takeScreenshot()
 void TextureMapping::exportObject(Object* obj)
 {
 	std::shared_ptr<Model> model = obj->GetModel();
+	if (!model) return;
 	std::vector<Vertex>& vertices = model->_vertices;
 	std::vector<uint32_t>& indices = model->_indices;
 	char obj_path[100];
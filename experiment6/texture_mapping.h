@@ -2,14 +2,26 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "../base/application.h"
+#include "../base/asset_cache.h"
+#include "../base/async_loader.h"
+#include "../base/geometry_arena.h"
 #include "../base/model.h"
+#include "../base/mesh_sequence.h"
 #include "../base/light.h"
 #include "../base/shader.h"
+#include "../base/shader_build_queue.h"
 #include "../base/texture.h"
 #include "../base/camera.h"
+#include "../base/frustum_culler.h"
+#include "../base/gl_state.h"
+#include "../base/occlusion_culler.h"
+#include "../base/program_cache.h"
+#include "../base/render_queue.h"
 #include "../base/skybox.h"
+#include "../base/uniform_ring.h"
 
 
 enum class RenderMode {
@@ -20,11 +32,70 @@ enum class RenderScene {
 	Geometry, Extintor
 };
 
+// std140 uniform blocks of the shaders, laid out like their glsl declarations
+struct FrameBlock {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 cameraPosition;
+};
+
+struct LightBlock {
+	// DirectionalLight
+	glm::vec3 directionalDirection;
+	float directionalIntensity;
+	glm::vec3 directionalColor;
+	float padding0;
+	// SpotLight
+	glm::vec3 spotPosition;
+	float spotIntensity;
+	glm::vec3 spotDirection;
+	float spotAngle;
+	glm::vec3 spotColor;
+	float spotKc;
+	float spotKl;
+	float spotKq;
+	float padding1[2];
+};
+
+struct ObjectBlock {
+	glm::mat4 model;
+	// inverse transpose of the model matrix in the upper 3x3, computed once per object rather than per vertex
+	glm::mat4 normalMatrix;
+	// Material
+	glm::vec3 albedo;
+	float roughness;
+	float metallic;
+	float padding[3];
+};
+
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock does not match its std140 layout");
+static_assert(sizeof(LightBlock) == 96, "LightBlock does not match its std140 layout");
+static_assert(sizeof(ObjectBlock) == 160, "ObjectBlock does not match its std140 layout");
+
+// uniform buffer binding points of the blocks
+const GLuint kFrameBlockBinding = 0;
+const GLuint kLightBlockBinding = 1;
+const GLuint kObjectBlockBinding = 2;
+
+// handles of the uniforms objects set, read once from each shader they are drawn with;
+// uniforms a shader does not have are left at location -1 and never set
+struct ObjectUniforms {
+	ObjectUniforms() {}
+	explicit ObjectUniforms(const Shader& shader);
+
+	Shader::Uniform<glm::vec3> positionOffset, positionScale;
+	Shader::Uniform<float> frameBlend;
+	Shader::Uniform<bool> packedVertex, instanced;
+	Shader::Uniform<int> texAlbedo, diffuse, normal, roughness, metallic, ao;
+};
+
 
 class Object {
 public:
 	std::string objPath;
+	// the model may be shared with other objects, the placement is the object's own
 	std::shared_ptr<Model> model;
+	Object3D transform;
 	std::string texPathAlbedo, texPathRoughness, texPathMetallic, texPathNormal, texPathAO;
 	std::shared_ptr<Texture> _texAlbedo, _texNormal, _texMetallic, _texRoughness, _texAO;
 	bool _showTexAlbedo, _showTexNormal, _showTexMetallic, _showTexRoughness, _showTexAO;
@@ -36,10 +107,26 @@ public:
 
 	bool hidden = false;
 
+	// outside the view or hidden behind occluders, set every frame; culled objects are not drawn
+	bool culled = false;
+
+	// drawn into the occlusion buffer whatever its size on screen
+	bool occluder = false;
+
+	// level of detail drawn by Render, chosen every frame from the camera distance
+	size_t lod = 0;
+
+	// view the full mesh is cluster culled against, set every frame while cullClusters is on
+	bool cullClusters = false;
+	glm::mat4 cullViewProjection = glm::mat4(1.0f);
+	glm::vec3 cullCameraPosition = glm::vec3(0.0f);
+	ClusterCullStats cullStats;
+
 	Object() {}
 	Object(std::string path_model, std::string name = "DefaultObject",
 		std::string path_albedo = "", std::string path_normal = "", std::string path_roughness = "",
-		std::string path_metallic = "", std::string path_ao = "");
+		std::string path_metallic = "", std::string path_ao = "", const ModelOptions& model_options = ModelOptions(),
+		AssetCache* assets = nullptr, AsyncLoader* loader = nullptr);
 
 	virtual void SetPosition(float x, float y, float z);
 	virtual void SetScale(float x, float y, float z);
@@ -50,7 +137,36 @@ public:
 	virtual glm::vec3 GetScale() const;
 	virtual glm::quat GetRotation() const;
 
-	virtual void Render(std::shared_ptr<Shader> shader, RenderMode render_mode, float delta_time, std::shared_ptr<Texture> texture);
+	virtual void Render(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode, float delta_time,
+		std::shared_ptr<Texture> texture);
+
+	// what an instanced draw shares between its objects, their transforms and material values may differ
+	struct InstanceKey {
+		const Model* model = nullptr;
+		size_t lod = 0;
+		// albedo, normal, roughness, metallic and ao as sampled, null where the material value is used
+		const Texture* textures[5] = {};
+
+		bool operator<(const InstanceKey& other) const;
+
+		// the maps sampled as a shader variant mask, bit i is set when textures[i] is
+		uint32_t getFeatures() const;
+	};
+
+	// false when the object has to be drawn on its own by Render, the arguments are those Render would get;
+	// the key is filled either way, the render queue sorts by its textures
+	bool GetInstanceKey(RenderMode render_mode, std::shared_ptr<Texture> texture, InstanceKey* key) const;
+
+	InstanceData GetInstanceData() const;
+
+	// the maps the object has paths for as a shader variant mask, known before its textures are loaded
+	uint32_t GetTextureFeatures() const;
+
+	ObjectBlock GetObjectBlock() const;
+
+	// set the uniforms and textures of the key, the part of Render an instanced draw shares
+	void SetSharedState(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode,
+		std::shared_ptr<Texture> texture);
 
 	int ObjectType = 0;
 	int index_2048 = -1;
@@ -63,21 +179,18 @@ public:
 	float currentTime = 0.0;
 	int FPS = 24;
 	int currentFrame = 0;
-	std::vector< std::shared_ptr<Model> > models;
+	// fraction of the way from currentFrame to the next frame, blended in the vertex shader
+	float frameBlend = 0.0f;
+	// the frames share one index buffer, there is no Model so GetModel() returns nullptr
+	std::shared_ptr<MeshSequence> sequence;
 	ObjectSequence() : Object() {}
 	ObjectSequence(std::string path_model, int frame_num, int fps=24, std::string name = "DefaultObject",
 		std::string path_albedo = "", std::string path_normal = "", std::string path_roughness = "",
-		std::string path_metallic = "", std::string path_ao = "");
-
-	virtual void Render(std::shared_ptr<Shader> shader, RenderMode render_mode, float delta_time, std::shared_ptr<Texture> texture) override;
-	void SetPosition(float x, float y, float z);
-	void SetScale(float x, float y, float z);
-	void SetRotation(glm::quat rotation);
-	void SetRotation(glm::vec3 axis, float angle);
-	std::shared_ptr<Model> GetModel() const;
-	glm::vec3 GetPosition() const;
-	glm::vec3 GetScale() const;
-	glm::quat GetRotation() const;
+		std::string path_metallic = "", std::string path_ao = "", AssetCache* assets = nullptr,
+		const MeshSequenceOptions& sequence_options = MeshSequenceOptions());
+
+	virtual void Render(std::shared_ptr<Shader> shader, const ObjectUniforms& uniforms, RenderMode render_mode, float delta_time,
+		std::shared_ptr<Texture> texture) override;
 
 };
 
@@ -90,6 +203,16 @@ public:
 	void ParseArguments(int argc, char* argv[]);
 
 private:
+	// every model and texture is loaded through here, so repeated ones are shared
+	AssetCache _assets;
+
+	// shared vertex and index buffers of the static models, -noarena keeps the main object out of it
+	std::shared_ptr<GeometryArena> _arena;
+
+	// loads on worker threads and uploads in renderFrame, at most _uploadBudgetMs per frame
+	std::unique_ptr<AsyncLoader> _loader;
+	float _uploadBudgetMs = 2.0f;
+
 	std::vector<Object*> _objects;
 	
 	//std::unique_ptr<Model> _extintor;
@@ -97,15 +220,47 @@ private:
 	enum RenderMode _renderMode = RenderMode::FBR;
 	enum RenderScene _renderScene = RenderScene::Extintor;
 
+	bool _cullClusters = true;
+
+	// world space boxes of the objects with a model, culled against the camera frustum every frame
+	bool _cullObjects = true;
+	FrustumCuller _frustumCuller;
+
+	// objects covering at least _occluderCoverage of the screen, and flagged ones, hide the objects behind them
+	bool _cullOcclusion = true;
+	float _occluderCoverage = 0.1f;
+	OcclusionCuller _occlusionCuller;
+
+	// objects with the same instance key are drawn with one instanced draw
+	bool _instancing = true;
+	InstanceBuffer _instances;
+	size_t _instancedDraws = 0;
+	size_t _instancedObjects = 0;
+
+	// every object draw goes through the queue, sorted by shader, textures, mesh and distance
+	RenderQueue _renderQueue;
+	GLStateStats _glStats;
+
+	// camera, lights and object blocks of a frame, uploaded at once before the queue is drawn
+	UniformRing _uniformRing;
+
+	// both shaders have a variant for every combination of texture maps, built in the background when first needed
 	std::shared_ptr<Shader> _simpleShader;
 
 	std::shared_ptr<Shader> _FBRShader;
+
+	// handles of every shader variant drawn with so far
+	std::unordered_map<const Shader*, ObjectUniforms> _variantUniforms;
 	glm::vec3 _albedo = { 1.0f, 1.0f, 1.0f };
 	float _roughness = 0.0f;
 	float _metallic = 0.0f;
 
 
 	std::string _pathModel, _pathAlbedo, _pathNormal, _pathMetallic, _pathRoughness, _pathAO;
+	ModelOptions _modelOptions;
+	// frame count when _pathModel is the prefix of a mesh sequence, 0 for a single model
+	int _sequenceFrames = 0;
+	MeshSequenceOptions _sequenceOptions;
 	std::unique_ptr<Texture> _texAlbedo, _texNormal, _texMetallic, _texRoughness, _texAO, _texWhite, _texBlack, _texBlue;
 	bool _showTexAlbedo, _showTexNormal, _showTexMetallic, _showTexRoughness, _showTexAO;
 
@@ -118,12 +273,23 @@ private:
 
 	bool _firstFrame = true;
 
+	// startup shader builds, reported by renderFrame once the build queue is empty
+	std::chrono::high_resolution_clock::time_point _shaderSetupStart;
+	bool _shaderSetupReported = false;
+
 	void initSimpleShader();
 
 	void initFBRShader();
 
+	// submit the shader variants for the object's maps, so they are built by the time its textures are loaded
+	void requestShaderVariants(const Object* obj);
+
+	const ObjectUniforms& getUniforms(const Shader& shader);
+
 	void handleInput() override;
 
+	glm::vec3 collideCamera(const glm::vec3& from, const glm::vec3& to) const;
+
 	void renderFrame() override;
 
 	std::shared_ptr<Texture> _texAlbedoList[16];
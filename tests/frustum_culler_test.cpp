@@ -0,0 +1,53 @@
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../base/frustum_culler.h"
+#include "test.h"
+
+TEST(frustumCullerMatchesPlaneTest) {
+	const glm::mat4 viewProjection = glm::perspective(0.9f, 1.5f, 0.1f, 100.0f) *
+		glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(10.0f, 0.0f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+
+	// a count that is not a multiple of the simd width, so the padding is covered
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f), size(0.1f, 3.0f);
+	FrustumCuller culler;
+	std::vector<glm::vec3> centers, extents;
+	for (int i = 0; i < 1003; ++i) {
+		centers.push_back(glm::vec3(position(random), position(random) * 0.2f, position(random)));
+		extents.push_back(glm::vec3(size(random), size(random), size(random)));
+		CHECK(culler.add(centers.back(), extents.back()) == static_cast<size_t>(i));
+	}
+	culler.cull(planes);
+
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < centers.size(); ++i) {
+		bool outside = false;
+		for (int p = 0; p < 6; ++p) {
+			const glm::vec3 normal(planes[p]);
+			outside = outside || glm::dot(normal, centers[i]) + planes[p].w + glm::dot(glm::abs(normal), extents[i]) < 0.0f;
+		}
+		CHECK(culler.isVisible(i) == !outside);
+		visibleCount += !outside;
+	}
+	CHECK(culler.getVisibleCount() == visibleCount);
+	CHECK(visibleCount > 0 && visibleCount < centers.size());
+}
+
+TEST(transformBoundsContainsCorners) {
+	const glm::mat4 transform = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 2.0f, 3.0f)),
+		0.7f, glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f))), glm::vec3(2.0f, 0.5f, 1.0f));
+	const glm::vec3 boundsMin(-1.0f, -0.5f, -1.0f), boundsMax(1.0f, 0.5f, 2.0f);
+	glm::vec3 center, extent;
+	transformBounds(transform, boundsMin, boundsMax, &center, &extent);
+	for (int k = 0; k < 8; ++k) {
+		const glm::vec3 corner(k & 1 ? boundsMax.x : boundsMin.x, k & 2 ? boundsMax.y : boundsMin.y,
+			k & 4 ? boundsMax.z : boundsMin.z);
+		const glm::vec3 world = glm::vec3(transform * glm::vec4(corner, 1.0f));
+		CHECK(glm::all(glm::lessThanEqual(glm::abs(world - center), extent + 1e-4f)));
+	}
+}
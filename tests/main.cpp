@@ -0,0 +1,31 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "test.h"
+
+int testFailures = 0;
+
+std::vector<TestCase>& getTestCases() {
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+// obj_parser_benchmark.cpp
+int runObjParserBenchmark(const char* path);
+
+// runs every test, or with -benchmark [file.obj] times the obj parser line by line
+int main(int argc, char* argv[]) {
+	if (argc > 1 && std::strcmp(argv[1], "-benchmark") == 0) {
+		return runObjParserBenchmark(argc > 2 ? argv[2] : "../data/ext/Extintor.obj");
+	}
+
+	for (const TestCase& test : getTestCases()) {
+		const int failures = testFailures;
+		test.run();
+		std::cout << (testFailures == failures ? "[pass] " : "[FAIL] ") << test.name << std::endl;
+	}
+
+	std::cout << getTestCases().size() << " tests, " << testFailures << " failed checks" << std::endl;
+	return testFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
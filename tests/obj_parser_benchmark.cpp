@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../base/my_obj_loader_misc.h"
+
+namespace {
+	typedef void (*ParseLine)(const char* token, const char* bufferEnd, real_t* sink);
+
+	void parseVertexScalar(const char* token, const char*, real_t* sink) {
+		real_t x, y, z;
+		parseReal3(&x, &y, &z, &token);
+		*sink += x + y + z;
+	}
+
+	void parseVertexFast(const char* token, const char* bufferEnd, real_t* sink) {
+		real_t x, y, z;
+		parseReal3Fast(&x, &y, &z, &token, bufferEnd);
+		*sink += x + y + z;
+	}
+
+	void parseFaceScalar(const char* token, const char*, real_t* sink) {
+		while (!IS_NEW_LINE(*token)) {
+			const vertex_index vi = parseTriple(&token, 1 << 30, 1 << 30, 1 << 30);
+			*sink += static_cast<real_t>(vi.v_idx + vi.vt_idx + vi.vn_idx);
+			token += strspn(token, " \t");
+		}
+	}
+
+	void parseFaceFast(const char* token, const char* bufferEnd, real_t* sink) {
+		while (!IS_NEW_LINE(*token)) {
+			const vertex_index vi = parseTripleFast(&token, bufferEnd, 1 << 30, 1 << 30, 1 << 30);
+			*sink += static_cast<real_t>(vi.v_idx + vi.vt_idx + vi.vn_idx);
+			token += strspn(token, " \t");
+		}
+	}
+
+	// best time per line over a number of passes, in nanoseconds
+	double timeLines(const std::vector<const char*>& lines, const char* bufferEnd, ParseLine parse, real_t* sink) {
+		const int passes = 15;
+		double best = 1e30;
+		for (int pass = 0; pass < passes; ++pass) {
+			const auto start = std::chrono::steady_clock::now();
+			for (const char* line : lines) {
+				parse(line, bufferEnd, sink);
+			}
+			const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			best = std::min(best, elapsed.count() / static_cast<double>(lines.size()));
+		}
+		return best;
+	}
+}
+
+// per line cost of the scalar and the vectorized parsers on the v and f lines of an obj file
+int runObjParserBenchmark(const char* path) {
+	// the scalar parsers read up to the terminator, so the file is copied into a string rather than mapped
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream) {
+		std::cerr << "cannot open " << path << std::endl;
+		return EXIT_FAILURE;
+	}
+	const std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+	// the tokens after "v " and "f ", a line ends at a newline or the terminator
+	std::vector<const char*> vertices, faces;
+	const char* p = text.c_str();
+	const char* end = p + text.size();
+	while (p < end) {
+		if (end - p > 2 && p[1] == ' ' && (p[0] == 'v' || p[0] == 'f')) {
+			(p[0] == 'v' ? vertices : faces).push_back(p + 2);
+		}
+		p = std::find(p, end, '\n');
+		if (p < end) {
+			++p;
+		}
+	}
+
+	real_t sink = 0.0f;
+	std::cout << path << ": " << vertices.size() << " v lines, " << faces.size() << " f lines, sse4.1 "
+		<< (getCpuFeatures().sse41 ? "on" : "off") << std::endl;
+	if (!vertices.empty()) {
+		const double scalar = timeLines(vertices, end, parseVertexScalar, &sink);
+		const double fast = timeLines(vertices, end, parseVertexFast, &sink);
+		std::cout << "  v: " << scalar << " -> " << fast << " ns per line" << std::endl;
+	}
+	if (!faces.empty()) {
+		const double scalar = timeLines(faces, end, parseFaceScalar, &sink);
+		const double fast = timeLines(faces, end, parseFaceFast, &sink);
+		std::cout << "  f: " << scalar << " -> " << fast << " ns per line" << std::endl;
+	}
+
+	// keeps the parsed values alive
+	return sink == 12345.0f ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "../base/my_obj_loader_misc.h"
+#include "test.h"
+
+namespace {
+	// the line is followed by more readable bytes, as in a mapped file, so the vectorized scanners are used
+	struct Line {
+		std::string text;
+		const char* begin;
+		const char* bufferEnd;
+
+		Line(const std::string& line) : text(line + "\n" + std::string(32, ' ')) {
+			begin = text.c_str();
+			bufferEnd = begin + text.size();
+		}
+	};
+
+	bool sameReals(const std::string& line) {
+		Line fast(line), scalar(line);
+		const char* fastToken = fast.begin;
+		const char* scalarToken = scalar.begin;
+		for (int i = 0; i < 3; ++i) {
+			// the fast path rounds the exact value once, the scalar parser may be off by one ulp
+			const double exact = std::strtod(scalarToken, nullptr);
+			const real_t a = parseRealFast(&fastToken, fast.bufferEnd);
+			const real_t b = parseReal(&scalarToken);
+			if ((a != b && a != static_cast<real_t>(exact)) || fastToken - fast.begin != scalarToken - scalar.begin) {
+				std::printf("  \"%s\": %.9g != %.9g\n", line.c_str(), a, b);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool sameCorners(const std::string& line) {
+		Line fast(line), scalar(line);
+		const char* fastToken = fast.begin;
+		const char* scalarToken = scalar.begin;
+		while (!IS_NEW_LINE(*scalarToken)) {
+			unsigned char fastRelative = 0, scalarRelative = 0;
+			const vertex_index a = parseTripleFast(&fastToken, fast.bufferEnd, 100, 100, 100, &fastRelative);
+			const vertex_index b = parseTriple(&scalarToken, 100, 100, 100, &scalarRelative);
+			if (a.v_idx != b.v_idx || a.vt_idx != b.vt_idx || a.vn_idx != b.vn_idx ||
+				fastRelative != scalarRelative || fastToken - fast.begin != scalarToken - scalar.begin) {
+				std::printf("  \"%s\" differs\n", line.c_str());
+				return false;
+			}
+			fastToken += strspn(fastToken, " \t");
+			scalarToken += strspn(scalarToken, " \t");
+		}
+		return true;
+	}
+}
+
+TEST(parseRealFastMatchesScalar) {
+	const char* lines[] = {
+		"0 0 0",
+		"1.5 -2.25 +3.125",
+		"0.000001 123456.789 -0.5",
+		"123456789012345 1.23456789012345 -9.99999999999999",
+		"1234567890123456 1.234567890123456 12345678.123456789",
+		"1e3 -2.5E-4 3.0e+2",
+		".5 -.25 5.",
+		"1.0junk 2 3",
+		"nan inf -0",
+	};
+	for (const char* line : lines) {
+		CHECK(sameReals(line));
+	}
+
+	// random numbers with every digit count the fast path takes, and some it gives to the scalar parser
+	std::mt19937 random(3);
+	std::uniform_int_distribution<int> digits(1, 17);
+	char line[128];
+	for (int i = 0; i < 20000; ++i) {
+		const int precision = digits(random) % 10;
+		const double value = std::ldexp(static_cast<double>(random()) - 2147483648.0, digits(random) - 20);
+		std::snprintf(line, sizeof(line), "%.*f %.*f %.*f", precision, value, precision + 3, -value / 7.0,
+			digits(random), value * 1e-5);
+		if (!sameReals(line)) {
+			CHECK(false);
+			break;
+		}
+	}
+}
+
+TEST(parseTripleFastMatchesScalar) {
+	const char* lines[] = {
+		"1 2 3",
+		"1/2 3/4 5/6",
+		"1//2 3//4 5//6",
+		"1/2/3 4/5/6 7/8/9",
+		"-1/-2/-3 -4//-5 -6",
+		"123456789/1/2 1/123456789/2",
+		"1234567890/1/2 1//12345678901",
+		"1/2/3/4 1///2 /1/2",
+		"1-2/3 1/2-3",
+		"1/2/3\t4/5/6",
+	};
+	for (const char* line : lines) {
+		CHECK(sameCorners(line));
+	}
+}
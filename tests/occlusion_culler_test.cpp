@@ -0,0 +1,115 @@
+#include <cstring>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../base/occlusion_culler.h"
+#include "test.h"
+
+namespace {
+	// camera at z = 5 looking at the origin
+	glm::mat4 getViewProjection() {
+		return glm::perspective(0.9f, 2.0f, 0.1f, 100.0f) *
+			glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	// a 4x4 square in the plane z = 0, as two triangles
+	struct Wall {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices = { 0, 1, 2, 0, 2, 3 };
+
+		Wall() : vertices(4) {
+			vertices[0].position = glm::vec3(-2.0f, -2.0f, 0.0f);
+			vertices[1].position = glm::vec3(2.0f, -2.0f, 0.0f);
+			vertices[2].position = glm::vec3(2.0f, 2.0f, 0.0f);
+			vertices[3].position = glm::vec3(-2.0f, 2.0f, 0.0f);
+		}
+	};
+
+	void rasterizeWall(OcclusionCuller& culler, const glm::mat4& transform) {
+		const Wall wall;
+		culler.begin(getViewProjection());
+		culler.addOccluder(transform, wall.vertices, wall.indices.data(), wall.indices.size());
+		culler.rasterize();
+	}
+}
+
+TEST(occlusionCullerEmptyBufferOccludesNothing) {
+	OcclusionCuller culler(64, 32, 1);
+	culler.begin(getViewProjection());
+	culler.rasterize();
+	CHECK(!culler.isOccluded(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.5f)));
+
+	const float* depth = culler.getDepth();
+	bool cleared = true;
+	for (int y = 0; y < culler.getHeight(); ++y) {
+		for (int x = 0; x < culler.getWidth(); ++x) {
+			cleared = cleared && depth[y * culler.getStride() + x] == 1.0f;
+		}
+	}
+	CHECK(cleared);
+}
+
+TEST(occlusionCullerTestsBoxesAgainstWall) {
+	OcclusionCuller culler(256, 128, 2);
+	rasterizeWall(culler, glm::mat4(1.0f));
+
+	CHECK(culler.isOccluded(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.5f)));
+	CHECK(culler.isOccluded(glm::vec3(0.0f, 0.0f, -0.2f), glm::vec3(1.0f, 1.0f, 0.1f)));
+	// in front of the wall, intersecting it, reaching past its edge
+	CHECK(!culler.isOccluded(glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.5f)));
+	CHECK(!culler.isOccluded(glm::vec3(0.0f), glm::vec3(1.0f, 1.0f, 0.1f)));
+	CHECK(!culler.isOccluded(glm::vec3(1.9f, 0.0f, -1.0f), glm::vec3(0.5f)));
+	// around the camera, so crossing the near plane, and outside the screen
+	CHECK(!culler.isOccluded(glm::vec3(0.0f, 0.0f, 6.0f), glm::vec3(1.0f)));
+	CHECK(!culler.isOccluded(glm::vec3(10.0f, 0.0f, -3.0f), glm::vec3(0.5f)));
+
+	const OcclusionCullStats& stats = culler.getStats();
+	CHECK(stats.occluders == 1);
+	CHECK(stats.occluderTriangles == 2);
+	CHECK(stats.rasterizedTriangles == 2);
+	CHECK(stats.tested == 7);
+	CHECK(stats.occluded == 2);
+}
+
+TEST(occlusionCullerBeginDropsOccluders) {
+	OcclusionCuller culler(256, 128, 2);
+	rasterizeWall(culler, glm::mat4(1.0f));
+	CHECK(culler.isOccluded(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.5f)));
+
+	culler.begin(getViewProjection());
+	culler.rasterize();
+	CHECK(!culler.isOccluded(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.5f)));
+	CHECK(culler.getStats().occluders == 0);
+}
+
+TEST(occlusionCullerClipsAtNearPlane) {
+	// the wall turned to run from behind the camera into the scene still hides what is behind its far part
+	OcclusionCuller culler(256, 128, 2);
+	const glm::mat4 transform = glm::scale(glm::rotate(glm::mat4(1.0f), glm::radians(80.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+		glm::vec3(4.0f, 1.0f, 1.0f));
+	rasterizeWall(culler, transform);
+	// one triangle is cut to a quad and one to a triangle
+	CHECK(culler.getStats().rasterizedTriangles == 3);
+	CHECK(culler.isOccluded(glm::vec3(0.0f, 0.0f, -6.0f), glm::vec3(0.3f)));
+	CHECK(!culler.isOccluded(glm::vec3(3.0f, 0.0f, -6.0f), glm::vec3(0.3f)));
+}
+
+TEST(occlusionCullerThreadCountDoesNotChangeDepth) {
+	OcclusionCuller single(256, 128, 1), several(256, 128, 4);
+	const glm::mat4 transform = glm::rotate(glm::mat4(1.0f), 0.4f, glm::vec3(1.0f, 1.0f, 0.0f));
+	rasterizeWall(single, transform);
+	rasterizeWall(several, transform);
+	CHECK(std::memcmp(single.getDepth(), several.getDepth(),
+		sizeof(float) * single.getStride() * single.getHeight()) == 0);
+}
+
+TEST(occlusionCullerScreenCoverage) {
+	OcclusionCuller culler(256, 128, 1);
+	culler.begin(getViewProjection());
+	const float wall = culler.getScreenCoverage(glm::vec3(0.0f), glm::vec3(2.0f, 2.0f, 0.0f));
+	const float small = culler.getScreenCoverage(glm::vec3(0.0f), glm::vec3(0.2f, 0.2f, 0.0f));
+	CHECK(wall > 0.2f && wall < 0.5f);
+	CHECK(small > 0.0f && small < wall);
+	CHECK(culler.getScreenCoverage(glm::vec3(0.0f, 0.0f, 6.0f), glm::vec3(1.0f)) == 1.0f);
+}
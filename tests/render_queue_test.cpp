@@ -0,0 +1,34 @@
+#include <string>
+
+#include "../base/render_queue.h"
+#include "test.h"
+
+TEST(renderQueueNumbersEachFieldFromZero) {
+	RenderQueue queue;
+	const int shaders[2] = { 0, 0 }, meshes[3] = { 0, 0, 0 };
+	CHECK(queue.getId(RenderQueue::Field::Shader, &shaders[0]) == 0);
+	CHECK(queue.getId(RenderQueue::Field::Mesh, &meshes[0]) == 0);
+	CHECK(queue.getId(RenderQueue::Field::Mesh, &meshes[1]) == 1);
+	CHECK(queue.getId(RenderQueue::Field::Material, 12345ull) == 0);
+	CHECK(queue.getId(RenderQueue::Field::Shader, &shaders[1]) == 1);
+	CHECK(queue.getId(RenderQueue::Field::Mesh, &meshes[2]) == 2);
+	CHECK(queue.getId(RenderQueue::Field::Mesh, &meshes[0]) == 0);
+	// the same value in another field gets that field's next id
+	CHECK(queue.getId(RenderQueue::Field::Material, static_cast<const void*>(&meshes[1])) == 1);
+
+	queue.clear();
+	CHECK(queue.getId(RenderQueue::Field::Mesh, &meshes[2]) == 0);
+}
+
+TEST(renderQueueIssuesDrawsByKey) {
+	RenderQueue queue;
+	std::string order;
+	queue.push(RenderQueue::makeKey(0, 1, 0, 0.5f), [&]() { order += 'c'; });
+	queue.push(RenderQueue::makeKey(0, 0, 1, 0.9f), [&]() { order += 'b'; });
+	queue.push(RenderQueue::makeKey(0, 0, 1, 0.1f), [&]() { order += 'a'; });
+	queue.push(RenderQueue::makeKey(0, 1, 0, 0.5f), [&]() { order += 'd'; });
+	queue.push(RenderQueue::makeKey(1, 0, 0, 0.0f), [&]() { order += 'e'; });
+	CHECK(queue.getCount() == 5);
+	queue.execute();
+	CHECK(order == "abcde");
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// a test is a function registered by TEST(name) and run by main; a failed CHECK prints the
+// expression and the test goes on, so one run reports every failure
+struct TestCase {
+	const char* name;
+	void (*run)();
+};
+
+std::vector<TestCase>& getTestCases();
+
+// number of failed checks so far
+extern int testFailures;
+
+struct TestRegistrar {
+	TestRegistrar(const char* name, void (*run)()) {
+		getTestCases().push_back({ name, run });
+	}
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistrar name##Registrar(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++testFailures; \
+		} \
+	} while (0)